@@ -0,0 +1,246 @@
+#include "bskiplist.h"
+
+#ifdef BSKIPLIST_TEST_MAIN
+#include <map>
+#include <chrono>
+#include <random>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+
+using namespace bRedis;
+
+/* Live heap bytes, to compare the footprint of the two layouts */
+size_t heapBytes(void)
+{
+    return mallinfo2().uordblks;
+}
+
+long long usec(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void ok(void)
+{
+    printf("OK\n");
+}
+
+/* Same ordering as std::less<std::string>, but not known to
+ * bskiplistKeyPrefix: the list is built without prefixes. */
+struct plainLess
+{
+    bool operator()(const std::string &a, const std::string &b) const { return a < b; }
+};
+
+/* Every element must be at its rank, and agree with the reference map */
+template <typename List, typename Map>
+void checkAgainst(List &sl, Map &m)
+{
+    assert(sl.size() == m.size());
+    size_t n = 0;
+    auto it = sl.begin();
+    for (auto &kv : m)
+    {
+        ++n;
+        assert(it != sl.end() && it->first == kv.first && it->second == kv.second);
+        assert(sl.rank(kv.first) == n);
+        assert(sl.atRank(n) == it);
+        ++it;
+    }
+    assert(it == sl.end());
+}
+
+std::string randomKey(std::mt19937_64 &gen, size_t len)
+{
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    std::string s(len, ' ');
+    for (auto &c : s)
+        c = chars[gen() % (sizeof(chars) - 1)];
+    return s;
+}
+
+/* Build a list from keys, then time lookups of every key in shuffled
+ * order. Print ns per insert and per find, and heap bytes per element. */
+template <typename List>
+void bench(const char *name, const std::vector<std::string> &keys, const std::vector<std::string> &probes)
+{
+    size_t before = heapBytes();
+    List *sl = new List();
+    long long t0 = usec();
+    for (size_t i = 0; i < keys.size(); ++i)
+        sl->insert(keys[i], i);
+    long long t1 = usec();
+    size_t bytes = heapBytes() - before;
+
+    size_t found = 0;
+    long long t2 = usec();
+    for (auto &k : probes)
+        found += sl->find(k) != sl->end();
+    long long t3 = usec();
+    assert(found == probes.size());
+
+    printf("  %-26s insert %5lldns  find %5lldns  %4zu bytes/elem\n", name,
+           (t1 - t0) * 1000 / (long long)keys.size(), (t3 - t2) * 1000 / (long long)probes.size(),
+           bytes / keys.size());
+    delete sl;
+}
+
+int main(int argc, char **argv)
+{
+    printf("Random insert/erase against std::map (block 4): "); {
+        BSKIPLIST<int, int, std::less<int>, 4> sl;
+        std::map<int, int> m;
+        std::mt19937 gen(1);
+        for (int i = 0; i < 20000; ++i)
+        {
+            int k = gen() % 2000;
+            if (gen() % 3)
+                assert(sl.insert(k, i) == m.emplace(k, i).second);
+            else
+                assert(sl.erase(k) == (m.erase(k) == 1));
+        }
+        checkAgainst(sl, m);
+        while (!m.empty())
+        {
+            int k = m.begin()->first;
+            m.erase(m.begin());
+            assert(sl.erase(k));
+        }
+        assert(sl.empty() && sl.begin() == sl.end());
+        ok();
+    }
+
+    printf("Random insert/erase against std::map (block 16): "); {
+        BSKIPLIST<long, long> sl;
+        std::map<long, long> m;
+        std::mt19937 gen(2);
+        for (int round = 0; round < 5; ++round)
+        {
+            for (int i = 0; i < 10000; ++i)
+            {
+                long k = gen() % 50000;
+                assert(sl.insert(k, k) == m.emplace(k, k).second);
+            }
+            for (int i = 0; i < 8000; ++i)
+            {
+                long k = gen() % 50000;
+                assert(sl.erase(k) == (m.erase(k) == 1));
+            }
+            checkAgainst(sl, m);
+        }
+        ok();
+    }
+
+    printf("Monotonic inserts fill whole blocks: "); {
+        BSKIPLIST<int, int> sl;
+        size_t before = heapBytes();
+        for (int i = 0; i < 16000; ++i)
+            assert(sl.insert(i, i));
+        /* 1000 nodes of 16 elements: no half empty blocks */
+        assert(heapBytes() - before < 1000 * (sizeof(std::pair<int, int>) * 16 + 96));
+        for (int i = 0; i < 16000; ++i)
+            assert(sl.rank(i) == (size_t)i + 1);
+        ok();
+    }
+
+    printf("String keys with prefixes: "); {
+        BSKIPLIST<std::string, int> sl;
+        std::map<std::string, int> m;
+        std::mt19937_64 gen(3);
+        /* Shared 8+ byte prefixes, short keys and NUL bytes all fall back to
+         * the full comparison. */
+        std::vector<std::string> keys = {"", "a", "ab", std::string("ab\0", 3), std::string("ab\0\0", 4),
+                                         "abcdefgh", "abcdefghi", "abcdefgh\xff", "\xff\xfe"};
+        for (int i = 0; i < 3000; ++i)
+            keys.push_back("user:000" + randomKey(gen, gen() % 4));
+        for (int i = 0; i < 3000; ++i)
+            keys.push_back(randomKey(gen, 1 + gen() % 12));
+        for (size_t i = 0; i < keys.size(); ++i)
+            assert(sl.insert(keys[i], i) == m.emplace(keys[i], i).second);
+        checkAgainst(sl, m);
+        for (size_t i = 0; i < keys.size(); i += 2)
+            assert(sl.erase(keys[i]) == (m.erase(keys[i]) == 1));
+        checkAgainst(sl, m);
+        assert(sl.find("user:000") == sl.end() || m.count("user:000"));
+        ok();
+    }
+
+    printf("SDS keys: "); {
+        BSKIPLIST<SDS, int, sdsLess> sl;
+        char buf[32];
+        for (int i = 999; i >= 0; --i)
+        {
+            snprintf(buf, sizeof(buf), "member:%04d", i);
+            assert(sl.insert(SDS(buf), i));
+        }
+        assert(!sl.insert(SDS("member:0500"), 0));
+        assert(sl.rank(SDS("member:0500")) == 501);
+        assert(sl.atRank(1)->second == 0 && sl.find(SDS("member:0999"))->second == 999);
+        assert(sl.find(SDS("member:1000")) == sl.end());
+        ok();
+    }
+
+    printf("Range and bounds against SKIPLIST: "); {
+        BSKIPLIST<int, int, std::less<int>, 8> bsl;
+        SKIPLIST<int, int> sl;
+        for (int i = 0; i < 500; ++i)
+        {
+            bsl.insert(i * 2, i);
+            sl.insert(i * 2, i);
+        }
+        assert(bsl.lower_bound(11)->first == 12 && bsl.upper_bound(12)->first == 14);
+        assert(bsl.upper_bound(998) == bsl.end());
+        for (int lo = -5; lo < 1005; lo += 37)
+            for (int span : {0, 1, 10, 200})
+                for (bool ex : {false, true})
+                {
+                    assert(bsl.range(lo, lo + span, ex, !ex) == sl.range(lo, lo + span, ex, !ex));
+                    assert(bsl.range(lo, lo + span, ex, ex, 3, 5) == sl.range(lo, lo + span, ex, ex, 3, 5));
+                    assert(bsl.revrange(lo, lo + span, ex, !ex) == sl.revrange(lo, lo + span, ex, !ex));
+                    assert(bsl.revrange(lo, lo + span, !ex, ex, 2, 4) == sl.revrange(lo, lo + span, !ex, ex, 2, 4));
+                }
+        for (long start : {0L, 5L, -10L, 498L})
+            for (long stop : {-1L, 0L, 20L, 1000L})
+                assert(bsl.rangeByRank(start, stop) == sl.rangeByRank(start, stop));
+        ok();
+    }
+
+    printf("Copy and move: "); {
+        BSKIPLIST<std::string, int> a;
+        for (int i = 0; i < 1000; ++i)
+            a.insert(std::to_string(i), i);
+        BSKIPLIST<std::string, int> b(a);
+        assert(b.size() == 1000 && b.find("999")->second == 999);
+        BSKIPLIST<std::string, int> c(std::move(b));
+        assert(c.size() == 1000 && b.empty());
+        b = c;
+        assert(b.size() == 1000 && b.rank("0") == 1);
+        c.clear();
+        assert(c.empty() && b.size() == 1000);
+        ok();
+    }
+
+    int exp = (argc > 1) ? atoi(argv[1]) : 5;
+    for (size_t n = 10000, e = 4; (int)e <= exp; n *= 10, ++e)
+    {
+        printf("Lookup latency and memory, %zu random 16 byte keys:\n", n);
+        std::mt19937_64 gen(4);
+        std::vector<std::string> keys(n);
+        for (auto &k : keys)
+            k = randomKey(gen, 16);
+        std::vector<std::string> probes(keys);
+        std::shuffle(probes.begin(), probes.end(), gen);
+
+        bench<SKIPLIST<std::string, long>>("SKIPLIST", keys, probes);
+        bench<BSKIPLIST<std::string, long, plainLess>>("BSKIPLIST, no prefix", keys, probes);
+        bench<BSKIPLIST<std::string, long>>("BSKIPLIST", keys, probes);
+        bench<BSKIPLIST<std::string, long, std::less<std::string>, 32>>("BSKIPLIST, block 32", keys, probes);
+    }
+
+    return 0;
+}
+#endif
@@ -0,0 +1,684 @@
+#ifndef BOMENG_REDIS_BSKIPLIST_H
+#define BOMENG_REDIS_BSKIPLIST_H
+
+#include "skiplist.h"
+#include "sds.h"
+#include <new>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <stdint.h>
+
+/* Order preserving 8 byte prefix of a key. When the prefixes of two keys
+ * differ they order the keys as Cmp does, when they are equal Cmp decides.
+ * Only defined for byte strings ordered as memcmp orders them: for any
+ * other (K, Cmp) prefixes are disabled. */
+template <typename K, typename Cmp>
+struct bskiplistKeyPrefix
+{
+    static constexpr bool enabled = false;
+    static uint64_t get(const K &) { return 0; }
+};
+
+/* First 8 bytes, big endian, zero padded */
+inline uint64_t bskiplistBytesPrefix(const char *p, size_t len)
+{
+    unsigned char buf[8] = {0};
+    memcpy(buf, p, len < 8 ? len : 8);
+    uint64_t v;
+    memcpy(&v, buf, 8);
+    return __builtin_bswap64(v);
+}
+
+template <>
+struct bskiplistKeyPrefix<std::string, std::less<std::string>>
+{
+    static constexpr bool enabled = true;
+    static uint64_t get(const std::string &s) { return bskiplistBytesPrefix(s.data(), s.size()); }
+};
+
+template <>
+struct bskiplistKeyPrefix<std::string, std::less<>> : bskiplistKeyPrefix<std::string, std::less<std::string>>
+{
+};
+
+template <>
+struct bskiplistKeyPrefix<bRedis::SDS, bRedis::sdsLess>
+{
+    static constexpr bool enabled = true;
+    static uint64_t get(const bRedis::SDS &s) { return bskiplistBytesPrefix(s.buf(), s.len()); }
+};
+
+/* Unrolled skiplist: every node holds a sorted block of up to BlockSize
+ * elements, so a search chases about BlockSize / 2 times fewer pointers
+ * than SKIPLIST and finishes with a scan inside one contiguous block.
+ * When Prefix is enabled each node also keeps the key prefixes in their
+ * own array, and most comparisons never dereference the key.
+ *
+ * Nodes are routed by their greatest key. Spans count elements, not
+ * nodes: level[i].span of x is the number of elements from the first
+ * element of x to the first element of level[i].forward (to the end of
+ * the list for the last node of a level), so rank and atRank are
+ * O(log n) as in SKIPLIST. */
+template <typename K, typename V, typename Cmp = std::less<K>, size_t BlockSize = 16,
+          typename Prefix = bskiplistKeyPrefix<K, Cmp>, typename Policy = skiplistLevelPolicy<>>
+class BSKIPLIST
+{
+    static_assert(BlockSize >= 2 && BlockSize <= 256, "invalid block size");
+
+private:
+    static constexpr bool usePrefix = Prefix::enabled;
+
+    struct skiplistNode
+    {
+        struct skiplistLevel
+        {
+            skiplistNode *forward;
+            unsigned int span;
+        };
+
+        unsigned int count = 0;
+        unsigned int height;
+        skiplistNode *backward = nullptr;
+        uint64_t prefix[usePrefix ? BlockSize : 1];
+        std::pair<K, V> data[BlockSize];
+        skiplistLevel level[];
+
+        skiplistNode(unsigned int h) : height(h) {}
+    };
+
+    static constexpr int maxLevel = Policy::maxLevel;
+
+public:
+    struct rangespec
+    {
+        K min, max;
+        bool minex = false, maxex = false;
+    };
+
+    class iterator : public std::iterator<std::bidirectional_iterator_tag, void *>
+    {
+    private:
+        skiplistNode *node_;
+        unsigned int index_;
+
+    public:
+        iterator(skiplistNode *node, unsigned int index = 0) : node_(node), index_(index) {}
+        iterator &operator++()
+        {
+            if (++index_ == node_->count)
+            {
+                node_ = node_->level[0].forward;
+                index_ = 0;
+            }
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator it(*this);
+            ++*this;
+            return it;
+        }
+        iterator &operator--()
+        {
+            if (index_ == 0)
+            {
+                node_ = node_->backward;
+                index_ = node_->count;
+            }
+            --index_;
+            return *this;
+        }
+        iterator operator--(int)
+        {
+            iterator it(*this);
+            --*this;
+            return it;
+        }
+
+        bool operator==(const iterator &other) const { return node_ == other.node_ && index_ == other.index_; }
+        bool operator!=(const iterator &other) const { return !(*this == other); }
+        std::pair<K, V> &operator*() const { return node_->data[index_]; }
+        std::pair<K, V> *operator->() const { return &(node_->data[index_]); }
+    };
+
+private:
+    skiplistNode *header_;
+    skiplistNode *tail_;
+    size_t length_;
+    size_t level_;
+
+private:
+    Policy policy_;
+
+private:
+    static skiplistNode *createNode(unsigned int height)
+    {
+        void *p = ::operator new(sizeof(skiplistNode) + height * sizeof(typename skiplistNode::skiplistLevel));
+        skiplistNode *x = new (p) skiplistNode(height);
+        for (unsigned int i = 0; i < height; ++i)
+            x->level[i] = {nullptr, 0};
+        return x;
+    }
+
+    static void freeNode(skiplistNode *x)
+    {
+        x->~skiplistNode();
+        ::operator delete(x);
+    }
+
+    static uint64_t _prefix(const K &key)
+    {
+        if constexpr (usePrefix)
+            return Prefix::get(key);
+        return 0;
+    }
+
+    /* Whether element j of x sorts before key, kp being the prefix of key */
+    static bool _entryLess(const skiplistNode *x, unsigned int j, const K &key, uint64_t kp)
+    {
+        if constexpr (usePrefix)
+            if (x->prefix[j] != kp)
+                return x->prefix[j] < kp;
+        return Cmp()(x->data[j].first, key);
+    }
+
+    /* Whether key sorts before element j of x */
+    static bool _keyLess(const K &key, uint64_t kp, const skiplistNode *x, unsigned int j)
+    {
+        if constexpr (usePrefix)
+            if (x->prefix[j] != kp)
+                return kp < x->prefix[j];
+        return Cmp()(key, x->data[j].first);
+    }
+
+    /* Index of the first element of x not less than key (strict: greater
+     * than key). The prefixes are scanned first, the keys are only looked
+     * at while the prefixes are equal. */
+    static unsigned int _indexOf(const skiplistNode *x, const K &key, uint64_t kp, bool strict = false)
+    {
+        unsigned int j = 0;
+        if constexpr (usePrefix)
+        {
+            while (j < x->count && x->prefix[j] < kp)
+                ++j;
+            while (j < x->count && x->prefix[j] == kp &&
+                   (strict ? !Cmp()(key, x->data[j].first) : Cmp()(x->data[j].first, key)))
+                ++j;
+        }
+        else
+        {
+            unsigned int hi = x->count;
+            while (j < hi)
+            {
+                unsigned int mid = (j + hi) / 2;
+                if (strict ? !Cmp()(key, x->data[mid].first) : Cmp()(x->data[mid].first, key))
+                    j = mid + 1;
+                else
+                    hi = mid;
+            }
+        }
+        return j;
+    }
+
+    /* Search path of key. update[i] is the last node of level i whose
+     * greatest key sorts before key (strict: does not sort after key), and
+     * rank[i] the number of elements before it. Return the node after
+     * update[0]: the first node that may hold key, nullptr past the end. */
+    skiplistNode *_descend(const K &key, uint64_t kp, skiplistNode **update, size_t *rank, bool strict = false) const
+    {
+        skiplistNode *x = header_;
+        size_t traversed = 0;
+        for (int i = level_ - 1; i >= 0; --i)
+        {
+            skiplistNode *y;
+            while ((y = x->level[i].forward) &&
+                   (strict ? !_keyLess(key, kp, y, y->count - 1) : _entryLess(y, y->count - 1, key, kp)))
+            {
+                traversed += x->level[i].span;
+                x = y;
+            }
+            update[i] = x;
+            rank[i] = traversed;
+        }
+        return x->level[0].forward;
+    }
+
+    /* Node and index of the first element not less than key (strict:
+     * greater than key), nullptr if there is none. *r is its 1-based rank,
+     * length_ + 1 when there is none. */
+    std::pair<skiplistNode *, unsigned int> _bound(const K &key, bool strict, size_t *r) const
+    {
+        skiplistNode *update[maxLevel];
+        size_t rank[maxLevel];
+        uint64_t kp = _prefix(key);
+        skiplistNode *x = _descend(key, kp, update, rank, strict);
+        if (!x)
+        {
+            *r = length_ + 1;
+            return {nullptr, 0};
+        }
+
+        unsigned int j = _indexOf(x, key, kp, strict);
+        *r = rank[0] + update[0]->level[0].span + j + 1;
+        return {x, j};
+    }
+
+    /* Node and index of the element at the 1-based rank */
+    std::pair<skiplistNode *, unsigned int> _atRank(size_t rank) const
+    {
+        if (rank == 0 || rank > length_)
+            return {nullptr, 0};
+
+        skiplistNode *x = header_;
+        size_t traversed = 0;
+        for (int i = level_ - 1; i >= 0; --i)
+        {
+            while (x->level[i].forward && traversed + x->level[i].span < rank)
+            {
+                traversed += x->level[i].span;
+                x = x->level[i].forward;
+            }
+        }
+        return {x, (unsigned int)(rank - traversed - 1)};
+    }
+
+    /* Link y after pred[0]. pred[i] is the last node of level i before the
+     * position, predRank[i] its element count before it, and rank the number
+     * of elements before y. Levels above level_ are added, with header_ as
+     * pred. The element count of the list does not change. */
+    void _linkNode(skiplistNode *y, skiplistNode **pred, size_t *predRank, size_t rank)
+    {
+        if (y->height > level_)
+        {
+            for (size_t i = level_; i < y->height; ++i)
+            {
+                pred[i] = header_;
+                predRank[i] = 0;
+                header_->level[i].span = length_;
+            }
+            level_ = y->height;
+        }
+
+        for (unsigned int i = 0; i < y->height; ++i)
+        {
+            y->level[i].forward = pred[i]->level[i].forward;
+            pred[i]->level[i].forward = y;
+            y->level[i].span = pred[i]->level[i].span - (rank - predRank[i]);
+            pred[i]->level[i].span = rank - predRank[i];
+        }
+
+        y->backward = pred[0];
+        if (y->level[0].forward)
+            y->level[0].forward->backward = y;
+        else
+            tail_ = y;
+    }
+
+    /* Unlink x, which holds no element, pred[i] being its predecessor on
+     * level i. */
+    void _unlinkNode(skiplistNode *x, skiplistNode **pred)
+    {
+        for (unsigned int i = 0; i < x->height; ++i)
+        {
+            pred[i]->level[i].forward = x->level[i].forward;
+            pred[i]->level[i].span += x->level[i].span;
+        }
+
+        if (x->level[0].forward)
+            x->level[0].forward->backward = x->backward;
+        else
+            tail_ = x->backward;
+
+        while (level_ > 1 && header_->level[level_ - 1].forward == nullptr)
+            --level_;
+    }
+
+    /* Move elements [from, from + n) of x to position to of y */
+    static void _moveElements(skiplistNode *x, unsigned int from, skiplistNode *y, unsigned int to, unsigned int n)
+    {
+        std::move(x->data + from, x->data + from + n, y->data + to);
+        if constexpr (usePrefix)
+            memcpy(y->prefix + to, x->prefix + from, n * sizeof(uint64_t));
+    }
+
+    /* Remove element j of x, update being the search path that led to x */
+    void _removeAt(skiplistNode *x, unsigned int j, skiplistNode **update)
+    {
+        std::move(x->data + j + 1, x->data + x->count, x->data + j);
+        if constexpr (usePrefix)
+            memmove(x->prefix + j, x->prefix + j + 1, (x->count - j - 1) * sizeof(uint64_t));
+        /* Release what the vacated slot still owns */
+        x->data[--x->count] = std::pair<K, V>();
+
+        for (size_t i = 0; i < level_; ++i)
+            (i < x->height ? x : update[i])->level[i].span--;
+        --length_;
+
+        if (x->count == 0)
+        {
+            _unlinkNode(x, update);
+            freeNode(x);
+            return;
+        }
+
+        /* Merge with the next node while both are at most half full, so that
+         * erasures do not leave long runs of nearly empty blocks. */
+        skiplistNode *n = x->level[0].forward;
+        if (n && x->count + n->count <= BlockSize / 2)
+        {
+            skiplistNode *pred[maxLevel];
+            for (unsigned int i = 0; i < n->height; ++i)
+                pred[i] = (i < x->height) ? x : update[i];
+
+            _moveElements(n, 0, x, x->count, n->count);
+            x->count += n->count;
+            n->count = 0;
+            _unlinkNode(n, pred);
+            freeNode(n);
+        }
+    }
+
+public:
+    BSKIPLIST() : length_(0), level_(1)
+    {
+        header_ = createNode(maxLevel);
+        tail_ = header_;
+    }
+
+    BSKIPLIST(const BSKIPLIST &sl) : BSKIPLIST()
+    {
+        for (skiplistNode *x = sl.header_->level[0].forward; x; x = x->level[0].forward)
+            for (unsigned int j = 0; j < x->count; ++j)
+                insert(x->data[j].first, x->data[j].second);
+    }
+
+    BSKIPLIST(BSKIPLIST &&sl) : BSKIPLIST()
+    {
+        std::swap(header_, sl.header_);
+        std::swap(tail_, sl.tail_);
+        std::swap(length_, sl.length_);
+        std::swap(level_, sl.level_);
+    }
+
+    BSKIPLIST &operator=(const BSKIPLIST &sl)
+    {
+        if (this != &sl)
+        {
+            BSKIPLIST tmp(sl);
+            *this = std::move(tmp);
+        }
+        return *this;
+    }
+
+    BSKIPLIST &operator=(BSKIPLIST &&sl)
+    {
+        if (this != &sl)
+        {
+            std::swap(header_, sl.header_);
+            std::swap(tail_, sl.tail_);
+            std::swap(length_, sl.length_);
+            std::swap(level_, sl.level_);
+        }
+        return *this;
+    }
+
+    ~BSKIPLIST()
+    {
+        clear();
+        freeNode(header_);
+    }
+
+public:
+    size_t size() const { return length_; }
+    bool empty() const { return length_ == 0; }
+
+    iterator begin() { return iterator(header_->level[0].forward); }
+    iterator end() { return iterator(nullptr); }
+
+public:
+    bool insert(K key, V val)
+    {
+        skiplistNode *update[maxLevel];
+        size_t rank[maxLevel];
+        uint64_t kp = _prefix(key);
+
+        skiplistNode *x = _descend(key, kp, update, rank);
+        unsigned int j;
+        size_t pos;
+        if (x)
+        {
+            j = _indexOf(x, key, kp);
+            if (!_keyLess(key, kp, x, j))
+                return false;
+            pos = rank[0] + update[0]->level[0].span;
+        }
+        else if (update[0] != header_)
+        {
+            /* Past the greatest key: goes at the end of the last node */
+            x = update[0];
+            j = x->count;
+            pos = rank[0];
+        }
+        else
+        {
+            x = createNode(policy_.randomLevel());
+            _linkNode(x, update, rank, 0);
+            j = 0;
+            pos = 0;
+        }
+
+        /* cover[i] is the node whose level i span counts the new element */
+        skiplistNode **cover = update;
+        skiplistNode *pred[maxLevel];
+        size_t predRank[maxLevel];
+        if (x->count == BlockSize)
+        {
+            /* Split. A full tail that grows at its end (monotonic keys) keeps
+             * its elements, so that sequential loads leave full blocks. */
+            unsigned int moved = (j == x->count && x == tail_) ? 0 : BlockSize / 2;
+            skiplistNode *y = createNode(policy_.randomLevel());
+            for (size_t i = 0; i < level_; ++i)
+            {
+                pred[i] = (i < x->height) ? x : update[i];
+                predRank[i] = (i < x->height) ? pos : rank[i];
+            }
+
+            _moveElements(x, x->count - moved, y, 0, moved);
+            for (unsigned int k = x->count - moved; k < x->count; ++k)
+                x->data[k] = std::pair<K, V>();
+            x->count -= moved;
+            y->count = moved;
+            _linkNode(y, pred, predRank, pos + x->count);
+
+            cover = pred;
+            if (j > x->count || moved == 0)
+            {
+                j -= x->count;
+                x = y;
+            }
+        }
+
+        std::move_backward(x->data + j, x->data + x->count, x->data + x->count + 1);
+        x->data[j] = std::pair<K, V>(std::move(key), std::move(val));
+        if constexpr (usePrefix)
+        {
+            memmove(x->prefix + j + 1, x->prefix + j, (x->count - j) * sizeof(uint64_t));
+            x->prefix[j] = kp;
+        }
+        x->count++;
+
+        for (size_t i = 0; i < level_; ++i)
+            (i < x->height ? x : cover[i])->level[i].span++;
+        ++length_;
+
+        return true;
+    }
+
+    bool erase(const K &key)
+    {
+        skiplistNode *update[maxLevel];
+        size_t rank[maxLevel];
+        uint64_t kp = _prefix(key);
+
+        skiplistNode *x = _descend(key, kp, update, rank);
+        if (!x)
+            return false;
+        unsigned int j = _indexOf(x, key, kp);
+        if (_keyLess(key, kp, x, j))
+            return false;
+
+        _removeAt(x, j, update);
+        return true;
+    }
+
+    bool erase(iterator it)
+    {
+        return it != end() && erase(it->first);
+    }
+
+    void clear()
+    {
+        skiplistNode *x = header_->level[0].forward;
+        while (x)
+        {
+            skiplistNode *next = x->level[0].forward;
+            freeNode(x);
+            x = next;
+        }
+
+        for (int i = 0; i < maxLevel; ++i)
+            header_->level[i] = {nullptr, 0};
+        level_ = 1;
+        length_ = 0;
+        tail_ = header_;
+    }
+
+    iterator find(const K &key)
+    {
+        size_t r;
+        auto b = _bound(key, false, &r);
+        if (!b.first || _keyLess(key, _prefix(key), b.first, b.second))
+            return end();
+        return iterator(b.first, b.second);
+    }
+
+    /* First element whose key is not less than key, or end(). */
+    iterator lower_bound(const K &key)
+    {
+        size_t r;
+        auto b = _bound(key, false, &r);
+        return iterator(b.first, b.second);
+    }
+
+    /* First element whose key is greater than key, or end(). */
+    iterator upper_bound(const K &key)
+    {
+        size_t r;
+        auto b = _bound(key, true, &r);
+        return iterator(b.first, b.second);
+    }
+
+    /* Return the 1-based rank of key, or 0 when the key is not present. */
+    size_t rank(const K &key) const
+    {
+        size_t r;
+        auto b = _bound(key, false, &r);
+        if (!b.first || _keyLess(key, _prefix(key), b.first, b.second))
+            return 0;
+        return r;
+    }
+
+    /* Return the element at the given 1-based rank, or end(). */
+    iterator atRank(size_t rank)
+    {
+        auto p = _atRank(rank);
+        return iterator(p.first, p.second);
+    }
+
+    /* ZRANGE start stop: negative indexes count from the end, both ends
+     * are inclusive. */
+    std::vector<std::pair<K, V>> rangeByRank(long start, long stop) const
+    {
+        std::vector<std::pair<K, V>> result;
+        long len = length_;
+        if (start < 0)
+            start = len + start;
+        if (stop < 0)
+            stop = len + stop;
+        if (start < 0)
+            start = 0;
+        if (start > stop || start >= len)
+            return result;
+        if (stop >= len)
+            stop = len - 1;
+
+        auto p = _atRank(start + 1);
+        iterator it(p.first, p.second);
+        result.reserve(stop - start + 1);
+        for (long n = stop - start + 1; n > 0; --n, ++it)
+            result.push_back(*it);
+        return result;
+    }
+
+    /* ZRANGEBYSCORE: elements whose key lies in range, in order, skipping
+     * the first offset matches and returning at most limit (-1: no limit). */
+    std::vector<std::pair<K, V>> range(const rangespec &range, size_t offset = 0, long limit = -1) const
+    {
+        std::vector<std::pair<K, V>> result;
+        size_t r;
+        _bound(range.min, range.minex, &r);
+        auto p = _atRank(r + offset);
+
+        iterator it(p.first, p.second);
+        for (; it != iterator(nullptr) && limit != 0; ++it)
+        {
+            if (range.maxex ? !Cmp()(it->first, range.max) : Cmp()(range.max, it->first))
+                break;
+            result.push_back(*it);
+            if (limit > 0)
+                --limit;
+        }
+        return result;
+    }
+
+    std::vector<std::pair<K, V>> range(K min, K max, bool minex = false, bool maxex = false,
+                                       size_t offset = 0, long limit = -1) const
+    {
+        return range(rangespec{min, max, minex, maxex}, offset, limit);
+    }
+
+    /* ZREVRANGEBYSCORE: same as range() but from the greatest key down. */
+    std::vector<std::pair<K, V>> revrange(const rangespec &range, size_t offset = 0, long limit = -1) const
+    {
+        std::vector<std::pair<K, V>> result;
+        size_t r;
+        /* The last element in range is the one before the bound of max */
+        _bound(range.max, !range.maxex, &r);
+        if (r <= offset + 1)
+            return result;
+        r -= offset + 1;
+
+        auto p = _atRank(r);
+        iterator it(p.first, p.second);
+        for (; r > 0 && limit != 0; --r, --it)
+        {
+            if (range.minex ? !Cmp()(range.min, it->first) : Cmp()(it->first, range.min))
+                break;
+            result.push_back(*it);
+            if (limit > 0)
+                --limit;
+        }
+        return result;
+    }
+
+    std::vector<std::pair<K, V>> revrange(K min, K max, bool minex = false, bool maxex = false,
+                                          size_t offset = 0, long limit = -1) const
+    {
+        return revrange(rangespec{min, max, minex, maxex}, offset, limit);
+    }
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "cskiplist.h"
+
+#ifdef CSKIPLIST_TEST_MAIN
+#include "skiplist.h"
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/time.h>
+
+using namespace bRedis;
+
+long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+void ok(void) {
+    printf("OK\n");
+}
+
+/* SKIPLIST behind a single mutex, the baseline of the benchmark */
+struct lockedSkiplist {
+    std::mutex lock;
+    SKIPLIST<long, long> sl;
+
+    bool find(long key) {
+        std::lock_guard<std::mutex> lk(lock);
+        return sl.find(key) != sl.end();
+    }
+    bool insert(long key, long val) {
+        std::lock_guard<std::mutex> lk(lock);
+        return sl.insert(key, val);
+    }
+    bool erase(long key) {
+        std::lock_guard<std::mutex> lk(lock);
+        return sl.erase(key);
+    }
+};
+
+struct lockFreeSkiplist {
+    CSKIPLIST<long, long> sl;
+
+    bool find(long key) { return sl.contains(key); }
+    bool insert(long key, long val) { return sl.insert(key, val); }
+    bool erase(long key) { return sl.erase(key); }
+};
+
+/* Run ops operations split over nthreads threads, writePct percent of them
+ * being insert or erase (half each), and return the throughput in ops/usec. */
+template <typename List>
+double bench(List &list, int nthreads, int writePct, long keyspace, long ops) {
+    std::vector<std::thread> threads;
+    long long start = usec();
+    for (int t = 0; t < nthreads; ++t) {
+        threads.emplace_back([&list, t, nthreads, writePct, keyspace, ops]() {
+            uint64_t s = 88172645463325252ULL + t;
+            for (long i = 0; i < ops / nthreads; ++i) {
+                s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+                long key = s % keyspace;
+                int op = (s >> 32) % 100;
+                if (op >= writePct)
+                    list.find(key);
+                else if (op % 2)
+                    list.insert(key, key);
+                else
+                    list.erase(key);
+            }
+        });
+    }
+    for (auto &th : threads)
+        th.join();
+    long long elapsed = usec() - start;
+    return elapsed ? (double)ops / elapsed : 0;
+}
+
+int main(int argc, char **argv) {
+
+    printf("Basic insert/find/erase: "); {
+        CSKIPLIST<int, int> sl;
+        for (int i = 0; i < 1000; ++i)
+            assert(sl.insert((i * 7919) % 1000, i));
+        assert(!sl.insert(5, 0));
+        assert(sl.size() == 1000);
+        for (int i = 0; i < 1000; ++i)
+            assert(sl.contains(i));
+        auto [found, val] = sl.find(7919 % 1000);
+        assert(found && val == 1);
+        for (int i = 0; i < 1000; i += 2)
+            assert(sl.erase(i));
+        assert(!sl.erase(0));
+        for (int i = 0; i < 1000; ++i)
+            assert(sl.contains(i) == (i % 2 == 1));
+        assert(sl.size() == 500);
+        ok();
+    }
+
+    printf("Concurrent disjoint inserts and erases: "); {
+        CSKIPLIST<long, long> sl;
+        const int nthreads = 8, per = 20000;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nthreads; ++t)
+            threads.emplace_back([&sl, t]() {
+                for (long i = 0; i < per; ++i)
+                    assert(sl.insert(i * nthreads + t, t));
+                for (long i = 0; i < per; i += 2)
+                    assert(sl.erase(i * nthreads + t));
+            });
+        for (auto &th : threads)
+            th.join();
+        assert(sl.size() == nthreads * per / 2);
+        for (long k = 0; k < nthreads * per; ++k)
+            assert(sl.contains(k) == ((k / nthreads) % 2 == 1));
+        ok();
+    }
+
+    printf("Concurrent contended insert/erase: "); {
+        CSKIPLIST<long, long> sl;
+        const int nthreads = 8;
+        std::atomic<long> balance{0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nthreads; ++t)
+            threads.emplace_back([&sl, &balance, t]() {
+                uint64_t s = 0x9E3779B97F4A7C15ULL * (t + 1);
+                for (int i = 0; i < 50000; ++i) {
+                    s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+                    long key = s % 256;
+                    if (s & (1ULL << 40)) {
+                        if (sl.insert(key, key)) balance++;
+                    } else {
+                        if (sl.erase(key)) balance--;
+                    }
+                }
+            });
+        for (auto &th : threads)
+            th.join();
+        long n = 0;
+        for (long k = 0; k < 256; ++k)
+            n += sl.contains(k);
+        assert(n == balance && (size_t)n == sl.size());
+        EPOCH::reclaim();
+        printf("pending free %zu ", EPOCH::pending());
+        ok();
+    }
+
+    long ops = (argc > 1) ? atol(argv[1]) : 1 << 20;
+    printf("Scaling, ops/usec (lock-free vs mutex SKIPLIST), %ld operations:\n", ops); {
+        const long keyspace = 1 << 14;
+        for (int writePct : {5, 50}) {
+            lockFreeSkiplist lf;
+            lockedSkiplist locked;
+            for (long k = 0; k < keyspace; k += 2) {
+                lf.insert(k, k);
+                locked.insert(k, k);
+            }
+            for (int nthreads = 1; nthreads <= 64; nthreads *= 2) {
+                double a = bench(lf, nthreads, writePct, keyspace, ops);
+                double b = bench(locked, nthreads, writePct, keyspace, ops);
+                printf("  %2d%% writes, %2d threads: %8.3f vs %8.3f\n", writePct, nthreads, a, b);
+            }
+        }
+    }
+
+    return 0;
+}
+#endif
@@ -0,0 +1,292 @@
+#ifndef BOMENG_REDIS_CSKIPLIST_H
+#define BOMENG_REDIS_CSKIPLIST_H
+
+#include "epoch.h"
+#include <atomic>
+#include <new>
+#include <tuple>
+#include <random>
+#include <cstdlib>
+#include <stdint.h>
+#include <stdexcept>
+#include <functional>
+
+/* Lock-free skiplist (Herlihy, Shavit; Fraser). find/insert/erase may be
+ * called from any number of threads.
+ *
+ * The forward links are marked pointers: the low bit of next[i] set means
+ * the node is logically deleted at level i. A deletion marks the levels top
+ * down and is owned by whoever marks level 0. Marked nodes are unlinked by
+ * any traversal that meets them, and the node is handed to EPOCH once both
+ * its inserter and its deleter are done with it (see release()). */
+template <typename K, typename V, typename Cmp = std::less<K>>
+class CSKIPLIST
+{
+private:
+    /* Same constants as Redis ZSKIPLIST_MAXLEVEL / ZSKIPLIST_P (0.25) */
+    static constexpr int maxLevel = 32;
+
+    struct skiplistNode
+    {
+        K key;
+        V val;
+        /* Inserter and deleter each drop one reference when they are done */
+        std::atomic<int> refs;
+        int height;
+        std::atomic<uintptr_t> next[];
+
+        skiplistNode(K k, V v, int h) : key(std::move(k)), val(std::move(v)), refs(2), height(h) {}
+    };
+
+private:
+    skiplistNode *header_;
+    std::atomic<int> level_;
+    std::atomic<size_t> length_;
+
+private:
+    static skiplistNode *ptr(uintptr_t v) { return (skiplistNode *)(v & ~(uintptr_t)1); }
+    static bool marked(uintptr_t v) { return v & 1; }
+
+    static skiplistNode *createNode(K key, V val, int height)
+    {
+        void *p = malloc(sizeof(skiplistNode) + height * sizeof(std::atomic<uintptr_t>));
+        if (p == nullptr)
+            throw std::runtime_error("Failed to allocate memory");
+
+        skiplistNode *x = new (p) skiplistNode(std::move(key), std::move(val), height);
+        for (int i = 0; i < height; ++i)
+            new (&x->next[i]) std::atomic<uintptr_t>(0);
+        return x;
+    }
+
+    static void freeNode(void *p)
+    {
+        skiplistNode *x = (skiplistNode *)p;
+        x->~skiplistNode();
+        free(x);
+    }
+
+    /* Per-thread xorshift64*, so concurrent inserts never share RNG state.
+     * Two zero bits per extra level gives P = 0.25. */
+    static int randomLevel()
+    {
+        static thread_local uint64_t s = ((uint64_t)std::random_device()() << 32) | std::random_device()() | 1;
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        uint64_t r = s * 2685821657736338717ULL;
+
+        int level = 1 + __builtin_ctzll(r | (1ULL << 62)) / 2;
+        return (level < maxLevel) ? level : maxLevel;
+    }
+
+    /* Fill preds/succs with the neighbours of key at every level, unlinking
+     * the marked nodes met on the way. With unlinkAll, keep walking through
+     * nodes equal to key, so that a deleted node is unlinked even when an
+     * equal key was inserted in front of it. Return whether an unmarked node
+     * with key is linked at level 0. Must be called inside an EPOCH guard. */
+    bool _find(const K &key, skiplistNode **preds, skiplistNode **succs, bool unlinkAll = false)
+    {
+    retry:
+        int top = level_.load();
+        for (int i = maxLevel - 1; i >= top; --i)
+        {
+            preds[i] = header_;
+            succs[i] = ptr(header_->next[i].load());
+        }
+
+        skiplistNode *pred = header_;
+        for (int i = top - 1; i >= 0; --i)
+        {
+            skiplistNode *curr = ptr(pred->next[i].load());
+            while (curr)
+            {
+                uintptr_t succ = curr->next[i].load();
+                if (marked(succ))
+                {
+                    uintptr_t expected = (uintptr_t)curr;
+                    if (!pred->next[i].compare_exchange_strong(expected, succ & ~(uintptr_t)1))
+                        goto retry;
+                    curr = ptr(succ);
+                    continue;
+                }
+
+                if (Cmp()(curr->key, key) || (unlinkAll && !Cmp()(key, curr->key)))
+                {
+                    pred = curr;
+                    curr = ptr(succ);
+                }
+                else
+                    break;
+            }
+            preds[i] = pred;
+            succs[i] = curr;
+        }
+
+        return succs[0] && !Cmp()(key, succs[0]->key);
+    }
+
+    void release(skiplistNode *x)
+    {
+        if (x->refs.fetch_sub(1) == 1)
+            bRedis::EPOCH::retire(x, freeNode);
+    }
+
+public:
+    CSKIPLIST() : level_(1), length_(0)
+    {
+        header_ = createNode(K(), V(), maxLevel);
+        /* The header is never deleted */
+        header_->refs.store(1);
+    }
+
+    CSKIPLIST(const CSKIPLIST &) = delete;
+    CSKIPLIST &operator=(const CSKIPLIST &) = delete;
+
+    /* No other thread may use the list while it is destroyed. */
+    ~CSKIPLIST()
+    {
+        skiplistNode *x = header_;
+        while (x)
+        {
+            skiplistNode *next = ptr(x->next[0].load());
+            freeNode(x);
+            x = next;
+        }
+    }
+
+public:
+    /* Approximate while other threads are modifying the list */
+    size_t size() const { return length_.load(); }
+    bool empty() const { return length_.load() == 0; }
+
+public:
+    /* Wait-free lookup: marked nodes are skipped, never unlinked. */
+    std::tuple<bool, V> find(K key) const
+    {
+        bRedis::EPOCH::guard g;
+        skiplistNode *pred = header_, *curr = nullptr;
+
+        for (int i = level_.load() - 1; i >= 0; --i)
+        {
+            curr = ptr(pred->next[i].load(std::memory_order_acquire));
+            while (curr)
+            {
+                uintptr_t succ = curr->next[i].load(std::memory_order_acquire);
+                if (marked(succ))
+                    curr = ptr(succ);
+                else if (Cmp()(curr->key, key))
+                {
+                    pred = curr;
+                    curr = ptr(succ);
+                }
+                else
+                    break;
+            }
+        }
+
+        if (curr && !Cmp()(key, curr->key) && !marked(curr->next[0].load()))
+            return {true, curr->val};
+        return {false, V()};
+    }
+
+    bool contains(K key) const
+    {
+        return std::get<0>(find(std::move(key)));
+    }
+
+    bool insert(K key, V val)
+    {
+        bRedis::EPOCH::guard g;
+        skiplistNode *preds[maxLevel], *succs[maxLevel];
+        skiplistNode *x = nullptr;
+
+        int height = randomLevel();
+        int top = level_.load();
+        while (top < height && !level_.compare_exchange_weak(top, height))
+            ;
+
+        /* Link level 0: this is where the element becomes visible */
+        while (true)
+        {
+            if (_find(x ? x->key : key, preds, succs))
+            {
+                if (x)
+                    freeNode(x);
+                return false;
+            }
+
+            if (!x)
+                x = createNode(std::move(key), std::move(val), height);
+            for (int i = 0; i < height; ++i)
+                x->next[i].store((uintptr_t)succs[i], std::memory_order_relaxed);
+
+            uintptr_t expected = (uintptr_t)succs[0];
+            if (preds[0]->next[0].compare_exchange_strong(expected, (uintptr_t)x))
+                break;
+        }
+        length_.fetch_add(1);
+
+        /* Link the upper levels, giving up as soon as the node is deleted */
+        for (int i = 1; i < height; ++i)
+        {
+            while (true)
+            {
+                uintptr_t cur = x->next[i].load();
+                if (marked(cur))
+                    goto done;
+                if (cur != (uintptr_t)succs[i] && !x->next[i].compare_exchange_strong(cur, (uintptr_t)succs[i]))
+                    goto done;
+
+                uintptr_t expected = (uintptr_t)succs[i];
+                if (preds[i]->next[i].compare_exchange_strong(expected, (uintptr_t)x))
+                    break;
+
+                if (!_find(x->key, preds, succs) || succs[0] != x)
+                    goto done;
+            }
+        }
+
+    done:
+        /* A level linked after the deleter's final search would keep the
+         * node reachable, so unlink it again before letting go. */
+        if (marked(x->next[0].load()))
+            _find(x->key, preds, succs, true);
+        release(x);
+        return true;
+    }
+
+    bool erase(K key)
+    {
+        bRedis::EPOCH::guard g;
+        skiplistNode *preds[maxLevel], *succs[maxLevel];
+
+        if (!_find(key, preds, succs))
+            return false;
+
+        skiplistNode *x = succs[0];
+        for (int i = x->height - 1; i >= 1; --i)
+        {
+            uintptr_t succ = x->next[i].load();
+            while (!marked(succ) && !x->next[i].compare_exchange_weak(succ, succ | 1))
+                ;
+        }
+
+        /* Marking level 0 decides which deleter owns the node */
+        uintptr_t succ = x->next[0].load();
+        while (true)
+        {
+            if (marked(succ))
+                return false;
+            if (x->next[0].compare_exchange_strong(succ, succ | 1))
+                break;
+        }
+        length_.fetch_sub(1);
+
+        _find(key, preds, succs, true);
+        release(x);
+        return true;
+    }
+};
+
+#endif
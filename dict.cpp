@@ -1,21 +1,392 @@
 #include "dict.h"
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <malloc.h>
 
-class Entry : public DICTentry<int, int>{
-public:
-    unsigned int hashFunction() override {
-        return 0;
+using namespace bRedis;
+
+/* Bytes in use by malloc, chunk headers included. Read from the allocator
+ * rather than by wrapping operator new, which would change the layout
+ * being measured. */
+size_t heapBytes(void)
+{
+    return mallinfo2().uordblks;
+}
+
+void ok(void)
+{
+    printf("OK\n");
+}
+
+/* Fill a table with n keys, then look up n present and n missing keys.
+ * Print entries per GB (entries, key buffers and buckets) and lookups per
+ * second. */
+template <typename D, typename F>
+void footprint(const char *name, long n, F key)
+{
+    size_t before = heapBytes();
+    D *d = new D();
+    for (long i = 0; i < n; ++i)
+        d->add(key(i), i);
+    while (d->rehash(100))
+        ;
+    double bytes = heapBytes() - before;
+
+    std::vector<decltype(key(0))> probes;
+    probes.reserve(2 * n);
+    for (long i = 0; i < n; ++i)
+        probes.push_back(key((i * 7919) % n));
+    for (long i = 0; i < n; ++i)
+        probes.push_back(key(n + i));
+
+    long found = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (auto &k : probes)
+        found += d->find(k) != nullptr;
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    assert(found == n);
+
+    printf("  %-26s %5.1fM entries/GB  %5.1f bytes/entry  %6.1fM lookups/s\n", name,
+           (1 << 30) / (bytes / n) / 1e6, bytes / n, 2 * n / sec / 1e6);
+    delete d;
+}
+
+/* Insert n keys one at a time and report the latency percentiles of add().
+ * With blocking set, every resize is rehashed to completion right away,
+ * which is what a non incremental table does. */
+void latency(long n, bool blocking)
+{
+    /* 1ns buckets up to 1ms, slower adds are only counted in max */
+    const size_t buckets = 1 << 20;
+    std::vector<uint32_t> hist(buckets);
+    long long max = 0;
+
+    DICT<long, long> d;
+    auto begin = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; ++i)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        d.add(i * 0x9E3779B97F4A7C15L, i);
+        if (blocking)
+            while (d.rehash(1 << 20))
+                ;
+        auto t1 = std::chrono::steady_clock::now();
+
+        long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+        if (ns > max)
+            max = ns;
+        hist[(size_t)ns < buckets ? ns : buckets - 1]++;
     }
+    long long total = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+
+    auto percentile = [&](double p) {
+        long long target = (long long)(n * p), seen = 0;
+        for (size_t i = 0; i < buckets; ++i)
+            if ((seen += hist[i]) > target)
+                return (long long)i;
+        return max;
+    };
+    printf("  %-11s n=%ld: p50 %lldns  p99 %lldns  p999 %lldns  max %lldus  total %lldms\n",
+           blocking ? "blocking" : "incremental", n, percentile(0.5), percentile(0.99),
+           percentile(0.999), max / 1000, total);
+}
+
+int main(int argc, char **argv)
+{
+    printf("Add/find/replace/remove against unordered_map: "); {
+        DICT<long, long> d;
+        std::unordered_map<long, long> m;
+        srand(1);
+        for (int i = 0; i < 200000; ++i)
+        {
+            long k = rand() % 50000;
+            switch (rand() % 4)
+            {
+            case 0:
+                assert(d.add(k, i) == m.emplace(k, i).second);
+                break;
+            case 1:
+                assert(d.replace(k, i) == (m.count(k) == 0));
+                m[k] = i;
+                break;
+            case 2:
+                assert(d.remove(k) == (m.erase(k) == 1));
+                break;
+            case 3:
+            {
+                auto *e = d.find(k);
+                auto it = m.find(k);
+                assert((e == nullptr) == (it == m.end()));
+                assert(!e || e->val == it->second);
+                break;
+            }
+            }
+            assert(d.size() == m.size());
+        }
+        for (auto &kv : m)
+            assert(std::get<0>(d.fetchValue(kv.first)) && std::get<1>(d.fetchValue(kv.first)) == kv.second);
+        ok();
+    }
+
+    printf("Incremental growth: "); {
+        DICT<std::string, int> d;
+        bool sawRehashing = false;
+        for (int i = 0; i < 100000; ++i)
+        {
+            assert(d.add("key:" + std::to_string(i), i));
+            sawRehashing |= d.isRehashing();
+            /* Lookups must see the keys in both tables */
+            assert(d.find("key:" + std::to_string(i / 2))->val == i / 2);
+        }
+        assert(sawRehashing && d.size() == 100000);
+        assert(!d.add("key:5", 0) && d.find("key:100000") == nullptr);
+        ok();
+    }
+
+    printf("rehashMilliseconds, resize and clear: "); {
+        DICT<long, long> d;
+        for (long i = 0; i < 1 << 16; ++i)
+            d.add(i, i);
+        assert(d.slots() == 1 << 16);
+
+        /* The next add starts a rehash to 2^17 buckets */
+        d.add(-1, -1);
+        assert(d.isRehashing());
+        while (d.isRehashing())
+            d.rehashMilliseconds(1);
+        assert(d.slots() == 1 << 17 && d.size() == (1 << 16) + 1);
+
+        for (long i = 0; i < 1 << 16; ++i)
+            assert(d.remove(i));
+        assert(d.resize() && d.isRehashing());
+        d.rehashMilliseconds(100);
+        assert(!d.isRehashing() && d.slots() == DICT_HT_INITIAL_SIZE && d.find(-1));
 
-    Entry()
-        : DICTentry(0, 0)
-    {}
-};
+        /* Resizing disabled, for tables of every type: only grow past the
+         * forced ratio */
+        dictDisableResize();
+        DICT<SDS, long> other;
+        for (long i = 0; i < 20; ++i)
+        {
+            d.add(i, i);
+            other.add(SDS((long long)i), i);
+        }
+        assert(d.slots() == DICT_HT_INITIAL_SIZE && other.slots() == DICT_HT_INITIAL_SIZE);
+        for (long i = 20; i < 40; ++i)
+            d.add(i, i);
+        assert(d.slots() > DICT_HT_INITIAL_SIZE);
+        dictEnableResize();
 
-int main(){
+        d.clear();
+        assert(d.size() == 0 && d.slots() == 0 && !d.find(1));
+        assert(d.add(1, 1) && d.find(1));
+        ok();
+    }
+
+    printf("SDS keys: "); {
+        DICT<SDS, long> d;
+        for (long i = 0; i < 10000; ++i)
+            assert(d.add(SDS((long long)i), i));
+        assert(!d.add(SDS("42"), 0) && d.find(SDS("42"))->val == 42);
+        assert(d.remove(SDS("9999")) && !d.find(SDS("9999")));
+        ok();
+    }
+
+    printf("Embedded SDS keys in slabs: "); {
+        typedef DICT<SDS, std::string, dictHash<SDS>, dictKeyEqual<SDS>, true, dictSlabAlloc> D;
+        D d;
+        std::unordered_map<std::string, std::string> m;
+        srand(2);
+        for (int i = 0; i < 100000; ++i)
+        {
+            /* Keys from 1 to 400 bytes: the largest ones bypass the slabs */
+            std::string k = std::to_string(rand() % 5000);
+            k.append(std::stoi(k) % 13 == 0 ? 300 + std::stoi(k) % 100 : std::stoi(k) % 30, 'x');
+            SDS key(k.data(), k.size());
+            if (rand() % 3)
+            {
+                assert(d.replace(key, std::to_string(i)) == (m.count(k) == 0));
+                m[k] = std::to_string(i);
+            }
+            else
+                assert(d.remove(key) == (m.erase(k) == 1));
+        }
+        assert(d.size() == m.size());
+        for (auto &kv : m)
+        {
+            auto *e = d.find(SDS(kv.first.data(), kv.first.size()));
+            assert(e && e->val == kv.second && e->key.len == kv.first.size());
+            assert(memcmp(e->key.buf, kv.first.data(), e->key.len) == 0 && e->key.buf[e->key.len] == '\0');
+        }
+        size_t n = 0;
+        for (auto &e : d)
+            n += m.count(std::string(e.key.buf, e.key.len));
+        assert(n == m.size());
+        ok();
+    }
+
+    printf("Scan across grow and shrink: "); {
+        DICT<long, long> d;
+        for (long i = 0; i < 1000; ++i)
+            d.add(i, i);
+        std::vector<int> seen(3000);
+        unsigned long cursor = 0;
+        int calls = 0;
+        bool sawRehashing = false;
+        do
+        {
+            cursor = d.scan(cursor, [&seen](DICT<long, long>::Entry *e) { seen[e->key]++; });
+            sawRehashing |= d.isRehashing();
+            /* Grow to 2000 keys, then remove them and shrink */
+            if (++calls < 1000)
+                d.add(1000 + calls, 0);
+            else if (calls < 2000)
+                d.remove(calls);
+            else if (calls == 2000)
+                d.resize();
+        } while (cursor != 0);
+        /* Keys 0..999 were present for the whole scan */
+        assert(sawRehashing);
+        for (long i = 0; i < 1000; ++i)
+            assert(seen[i] >= 1);
+        ok();
+    }
+
+    printf("Scan removing entries and reallocating buckets: "); {
+        typedef DICT<std::string, long, dictHash<std::string>, dictKeyEqual<std::string>, true> D;
+        D d;
+        for (long i = 0; i < 10000; ++i)
+            d.add(std::to_string(i), i);
+        size_t moved = 0;
+        unsigned long cursor = 0;
+        do
+        {
+            cursor = d.scan(
+                cursor,
+                [&d](D::Entry *e) {
+                    if (e->val % 2)
+                        d.remove(e->key);
+                },
+                [&moved](D::Entry **bucket) {
+                    /* Move each entry to a fresh allocation */
+                    for (D::Entry **ref = bucket; *ref; ref = &(*ref)->next)
+                    {
+                        D::Entry *old = *ref, *copy = new D::Entry(old->key, old->val);
+                        copy->hash = old->hash;
+                        copy->next = old->next;
+                        *ref = copy;
+                        delete old;
+                        moved++;
+                    }
+                });
+        } while (cursor != 0);
+        assert(moved >= 10000 && d.size() == 5000);
+        for (long i = 0; i < 10000; ++i)
+            assert((d.find(std::to_string(i)) != nullptr) == (i % 2 == 0));
+        ok();
+    }
+
+    printf("Unsafe and safe iterators: "); {
+        DICT<long, long> d;
+        for (long i = 0; i < 6000; ++i)
+            d.add(i, i);
+        assert(d.isRehashing());
+
+        /* Unsafe: every entry once, from both tables */
+        std::vector<int> seen(6000);
+        for (auto &e : d)
+        {
+            seen[e.key]++;
+            e.val = -e.val;
+        }
+        for (long i = 0; i < 6000; ++i)
+            assert(seen[i] == 1);
+        const DICT<long, long> &cd = d;
+        long count = 0;
+        for (auto it = cd.begin(); it != cd.end(); ++it)
+            count += it->val == -it->key;
+        assert(count == 6000);
+
+        /* Safe: remove during the traversal, rehashing paused */
+        assert(d.isRehashing());
+        long removed = 0;
+        for (auto it = d.safeBegin(); it != d.end(); ++it)
+        {
+            size_t slots = d.slots();
+            if (it->key % 3 == 0)
+                removed += d.remove(it->key);
+            assert(d.find(1) && d.slots() == slots && d.isRehashing());
+        }
+        assert(removed == 2000 && d.size() == 6000 - 2000);
+
+        /* Leaving early releases the DICT, rehashing resumes */
+        for (auto it = d.safeBegin(); it != d.end(); ++it)
+            if (it->key == 1)
+                break;
+        while (d.isRehashing())
+            d.find(1);
+
+        /* Explicit rehashing is paused too: every entry exactly once */
+        DICT<long, long> e;
+        for (long i = 0; i < 1000; ++i)
+            e.add(i, i);
+        while (e.isRehashing())
+            e.find(0);
+        std::vector<int> visits(1000);
+        long visited = 0;
+        for (auto it = e.safeBegin(); it != e.end(); ++it, ++visited)
+        {
+            visits[it->key]++;
+            if (visited == 500)
+            {
+                assert(e.expand(4096) && e.rehashMilliseconds(100) == 0 && e.rehash(100) && e.isRehashing());
+            }
+        }
+        assert(visited == 1000);
+        for (long i = 0; i < 1000; ++i)
+            assert(visits[i] == 1);
+        assert(e.rehashMilliseconds(100) > 0);
+
+        /* clear() keeps the iterator counted */
+        {
+            auto it = e.safeBegin();
+            ++it;
+            e.clear();
+        }
+        for (long i = 0; i < 100000; ++i)
+            e.add(i, i);
+        while (e.isRehashing())
+            e.find(0);
+        assert(e.size() == 100000 && e.slots() >= 100000);
+        ok();
+    }
 
-    Entry e;
+    long n = (argc > 1) ? atol(argv[1]) : 1000000;
+    printf("Footprint and lookups, %ld keys (half the lookups miss):\n", n);
+    auto intKey = [](long i) { return i; };
+    auto strKey = [](long i) { return "key:" + std::to_string(i); };
+    auto sdsKey = [](long i) { return SDS((long long)i); };
+    footprint<DICT<long, long>>("long", n, intKey);
+    footprint<DICT<long, long, dictHash<long>, dictKeyEqual<long>, true>>("long, cached hash", n, intKey);
+    footprint<DICT<std::string, long>>("std::string", n, strKey);
+    footprint<DICT<std::string, long, dictHash<std::string>, dictKeyEqual<std::string>, true>>(
+        "std::string, cached hash", n, strKey);
+    footprint<DICT<SDS, long>>("SDS", n, sdsKey);
+    footprint<DICT<SDS, long, dictHash<SDS>, dictKeyEqual<SDS>, true>>("SDS, cached hash", n, sdsKey);
+    footprint<DICT<SDS, long, dictHash<SDS>, dictKeyEqual<SDS>, false, dictSlabAlloc>>("SDS, embedded in slabs", n,
+                                                                                      sdsKey);
+    footprint<DICT<SDS, long, dictHash<SDS>, dictKeyEqual<SDS>, true, dictSlabAlloc>>(
+        "SDS, embedded, cached hash", n, sdsKey);
 
-    DICT<Entry> dic;
+    printf("Insert latency while growing to %ld entries:\n", n);
+    latency(n, false);
+    latency(n, true);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -2,47 +2,367 @@
 #define BOMENG_REDIS_DICT_H
 
 #include <functional>
+#include <cassert>
+#include <type_traits>
+#include <stdexcept>
+#include <climits>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <tuple>
+#include <utility>
+#include <string>
+#include <stdint.h>
+#include "sds.h"
 
-template <typename K, typename V, typename cmp = std::less<K>>
-struct DICTentry
+/* Every hash table starts with this number of buckets */
+#define DICT_HT_INITIAL_SIZE 4
+/* Even with resizing disabled (a child process is saving), a table whose
+ * elements/buckets ratio goes over this is expanded. */
+#define DICT_FORCE_RESIZE_RATIO 5
+/* Sample size of fairRandomKey() */
+#define DICT_GETFAIR_NUM_ENTRIES 15
+
+/* Cleared while a child process shares the memory of the parent, as Redis
+ * dict_can_resize: one switch for every table, whatever its types, which
+ * is then only expanded past DICT_FORCE_RESIZE_RATIO. */
+inline bool dictCanResize = true;
+
+inline void dictEnableResize() { dictCanResize = true; }
+inline void dictDisableResize() { dictCanResize = false; }
+
+/* MurmurHash2, by Austin Appleby. Used to hash binary keys such as SDS.
+ * Note - This code makes a few assumptions about how your machine behaves -
+ * 1. The 4 byte blocks are read in the byte order of the machine
+ * 2. sizeof(int) == 4 */
+inline unsigned int dictGenHashFunction(const void *key, int len)
+{
+    const uint32_t seed = 5381;
+    const uint32_t m = 0x5bd1e995;
+    const int r = 24;
+
+    /* Initialize the hash to a 'random' value */
+    uint32_t h = seed ^ len;
+
+    /* Mix 4 bytes at a time into the hash */
+    const unsigned char *data = (const unsigned char *)key;
+
+    while (len >= 4)
+    {
+        /* The key may be unaligned */
+        uint32_t k;
+        memcpy(&k, data, sizeof(k));
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h *= m;
+        h ^= k;
+
+        data += 4;
+        len -= 4;
+    }
+
+    /* Handle the last few bytes of the input array  */
+    switch (len)
+    {
+    case 3: h ^= data[2] << 16; [[fallthrough]];
+    case 2: h ^= data[1] << 8; [[fallthrough]];
+    case 1: h ^= data[0]; h *= m;
+    };
+
+    /* Do a few final mixes of the hash to ensure the last few
+     * bytes are well-incorporated. */
+    h ^= h >> 13;
+    h *= m;
+    h ^= h >> 15;
+
+    return (unsigned int)h;
+}
+
+/* Thomas Wang's 32 bit Mix Function */
+inline unsigned int dictIntHashFunction(unsigned int key)
+{
+    key += ~(key << 15);
+    key ^= (key >> 10);
+    key += (key << 3);
+    key ^= (key >> 6);
+    key += ~(key << 11);
+    key ^= (key >> 16);
+    return key;
+}
+
+/* Default hasher of DICT keys: the Redis hash functions for integers,
+ * strings and SDS, std::hash for anything else. */
+template <typename K, typename = void>
+struct dictHash
+{
+    unsigned int operator()(const K &key) const { return (unsigned int)std::hash<K>()(key); }
+};
+
+template <typename K>
+struct dictHash<K, typename std::enable_if<std::is_integral<K>::value>::type>
+{
+    unsigned int operator()(K key) const
+    {
+        uint64_t v = (uint64_t)key;
+        return dictIntHashFunction((unsigned int)(v ^ (v >> 32)));
+    }
+};
+
+template <>
+struct dictHash<std::string>
+{
+    unsigned int operator()(const std::string &key) const { return dictGenHashFunction(key.data(), key.size()); }
+};
+
+/* An SDS key stored inside its entry: the length, then the bytes and a
+ * terminating NUL as in an SDS buffer. Immutable, so no free count. */
+struct DICTembKey
+{
+    uint32_t len;
+    char buf[];
+};
+
+/* SDS keys, looked up by SDS, stored as SDS or embedded (dictSlabAlloc) */
+template <>
+struct dictHash<bRedis::SDS>
+{
+    unsigned int operator()(const bRedis::SDS &key) const { return dictGenHashFunction(key.buf(), key.len()); }
+    unsigned int operator()(const DICTembKey &key) const { return dictGenHashFunction(key.buf, key.len); }
+};
+
+/* Default key equality: operator==, SDS::cmp for SDS */
+template <typename K>
+struct dictKeyEqual : std::equal_to<K>
+{
+};
+
+template <>
+struct dictKeyEqual<bRedis::SDS>
+{
+    bool operator()(const bRedis::SDS &a, const bRedis::SDS &b) const { return a.len() == b.len() && a.cmp(b) == 0; }
+    bool operator()(const bRedis::SDS &a, const DICTembKey &b) const
+    {
+        return a.len() == b.len && memcmp(a.buf(), b.buf, b.len) == 0;
+    }
+};
+
+/* Hash of the key, kept in the entry when the DICT caches hashes */
+template <bool CacheHash>
+struct DICTentryHash
+{
+    unsigned int hash;
+};
+
+template <>
+struct DICTentryHash<false>
+{
+};
+
+/* A chained entry. Plain struct: hashing and comparing keys is the job of
+ * the DICT policies, so entries carry no vptr. */
+template <typename K, typename V, bool CacheHash = false>
+struct DICTentry : DICTentryHash<CacheHash>
 {
-public:
-    typedef K key_type;
-    typedef V val_type;
-    typedef cmp cmp_type;
-public:
     K key;
     V val;
     DICTentry *next;
 
+    DICTentry(K k, V v)
+        : key(std::move(k)), val(std::move(v)), next(nullptr)
+    {}
+};
+
+/* Where a DICT gets its entries and bucket arrays from, and the layout of
+ * its entries. Another policy can pool them, or defer the frees while
+ * lock-free readers may still be looking (ShardedDICT). */
+struct dictAlloc
+{
+    template <typename K, typename V, bool CacheHash>
+    using entry = DICTentry<K, V, CacheHash>;
+
+    template <typename E, typename... Args>
+    E *newEntry(Args &&...args) { return new E(std::forward<Args>(args)...); }
+
+    template <typename E>
+    void deleteEntry(E *e) { delete e; }
+
+    /* Zero filled */
+    void *newTable(size_t n, size_t size) { return calloc(n, size); }
+    void deleteTable(void *p) { free(p); }
+};
+
+/* Entry of dictSlabAlloc: one block holds the links, the value and the
+ * key bytes. Keys are looked up as SDS. */
+template <typename V, bool CacheHash = false>
+struct DICTembEntry : DICTentryHash<CacheHash>
+{
+    DICTembEntry *next;
+    V val;
+    DICTembKey key;
+
+    DICTembEntry(const bRedis::SDS &k, V v) : next(nullptr), val(std::move(v))
+    {
+        key.len = k.len();
+        memcpy(key.buf, k.buf(), k.len());
+        key.buf[k.len()] = '\0';
+    }
+
+    /* key is the last member, so its bytes start within sizeof(DICTembEntry):
+     * at most the tail padding is allocated twice */
+    static size_t allocSize(size_t keylen) { return sizeof(DICTembEntry) + keylen + 1; }
+    static size_t allocSize(const bRedis::SDS &k) { return allocSize(k.len()); }
+    size_t allocSize() const { return allocSize(key.len); }
+};
+
+/* Small blocks are carved from slabs of this size at most */
+#define DICT_SLAB_SIZE (64 * 1024)
+/* Blocks above this size come from malloc */
+#define DICT_SLAB_MAX_BLOCK 256
+
+/* Entries with the SDS key embedded (DICTembEntry), carved from slabs
+ * owned by the DICT. An insert copies the key once into a block of the
+ * 8 byte size class of its entry: no malloc per entry and no separate SDS
+ * buffer, and a lookup reads the key in the cache line of the entry.
+ *
+ * Each size class has a free list and a current slab. Slabs start at 1KB
+ * and double up to DICT_SLAB_SIZE, so small DICTs stay small. Freed blocks
+ * are reused by the next insert of the same class. Slabs are only released
+ * with the DICT. */
+class dictSlabAlloc
+{
 public:
-    virtual unsigned int hashFunction() = 0;
+    template <typename K, typename V, bool CacheHash>
+    using entry = DICTembEntry<V, CacheHash>;
+
+private:
+    static constexpr size_t classes = DICT_SLAB_MAX_BLOCK / 8;
+
+    struct freeBlock
+    {
+        freeBlock *next;
+    };
+
+    struct sizeClass
+    {
+        freeBlock *freelist = nullptr;
+        char *cur = nullptr;
+        char *end = nullptr;
+        size_t slabSize = 1024;
+    };
+
+    sizeClass classes_[classes];
+    std::vector<void *> slabs_;
+
+private:
+    void *_alloc(size_t size)
+    {
+        if (size > DICT_SLAB_MAX_BLOCK)
+        {
+            void *p = malloc(size);
+            if (p == nullptr)
+                throw std::runtime_error("Failed to allocate memory");
+            return p;
+        }
+
+        size = (size + 7) & ~(size_t)7;
+        sizeClass &c = classes_[size / 8 - 1];
+        if (c.freelist)
+        {
+            void *p = c.freelist;
+            c.freelist = c.freelist->next;
+            return p;
+        }
+        if (c.cur + size > c.end)
+        {
+            char *slab = (char *)malloc(c.slabSize);
+            if (slab == nullptr)
+                throw std::runtime_error("Failed to allocate memory");
+            slabs_.push_back(slab);
+            c.cur = slab;
+            c.end = slab + c.slabSize;
+            if (c.slabSize < DICT_SLAB_SIZE)
+                c.slabSize *= 2;
+        }
+        void *p = c.cur;
+        c.cur += size;
+        return p;
+    }
+
+    void _free(void *p, size_t size)
+    {
+        if (size > DICT_SLAB_MAX_BLOCK)
+        {
+            free(p);
+            return;
+        }
+        size = (size + 7) & ~(size_t)7;
+        sizeClass &c = classes_[size / 8 - 1];
+        freeBlock *b = (freeBlock *)p;
+        b->next = c.freelist;
+        c.freelist = b;
+    }
 
 public:
-    DICTentry(K k, V v)
-        : key(key), val(v), next(nullptr)
-    {}
-    virtual ~DICTentry(){ next=nullptr; }
-    DICTentry(const DICTentry & entry)
-        : key(entry.key), val(entry.val), next(nullptr)
-    {}
-    DICTentry& operator=(const DICTentry & entry)
+    dictSlabAlloc() = default;
+    dictSlabAlloc(const dictSlabAlloc &) = delete;
+    dictSlabAlloc &operator=(const dictSlabAlloc &) = delete;
+
+    ~dictSlabAlloc()
+    {
+        for (void *slab : slabs_)
+            free(slab);
+    }
+
+    template <typename E, typename V>
+    E *newEntry(const bRedis::SDS &key, V &&val)
+    {
+        return new (_alloc(E::allocSize(key))) E(key, std::forward<V>(val));
+    }
+
+    template <typename E>
+    void deleteEntry(E *e)
     {
-        key = entry.key;
-        val = entry.val;
-        next = nullptr;
+        size_t size = e->allocSize();
+        e->~E();
+        _free(e, size);
     }
-    DICTentry(DICTentry && entry) = delete;
-    DICTentry& operator=(DICTentry && entry) = delete;
+
+    void *newTable(size_t n, size_t size) { return calloc(n, size); }
+    void deleteTable(void *p) { free(p); }
 };
 
-template <typename Entry>
+/* Hash table with separate chaining, as the Redis dict.
+ *
+ * Keys are hashed by Hash and compared by KeyEqual, both stateless function
+ * objects resolved at compile time. With CacheHash set, every entry keeps
+ * the hash of its key: rehashing no longer calls Hash, and lookups compare
+ * keys only when the cached hashes match. Worth it for keys that are slow
+ * to hash or compare (strings), at 4 or 8 bytes per entry.
+ *
+ * Alloc provides the entries and bucket arrays, and the entry layout:
+ * dictAlloc news every DICTentry, dictSlabAlloc embeds SDS keys in
+ * entries carved from slabs.
+ *
+ * A DICT has two tables. Growing or shrinking allocates ht[1] and then moves
+ * the buckets of ht[0] over a few at a time: every add, find, replace and
+ * remove moves one bucket, and rehashMilliseconds() lets an idle caller
+ * move more. No single call ever rehashes the whole table. While rehashing,
+ * lookups visit both tables and new entries go to ht[1]. */
+template <typename K, typename V, typename Hash = dictHash<K>, typename KeyEqual = dictKeyEqual<K>,
+          bool CacheHash = false, typename Alloc = dictAlloc>
 class DICT
 {
-    static_assert(std::is_base_of<DICTentry<typename Entry::key_type, 
-                                            typename Entry::val_type, 
-                                            typename Entry::cmp_type>, 
-                                  Entry>::value, "Entry must be derived from DICTentry");
+public:
+    typedef typename Alloc::template entry<K, V, CacheHash> Entry;
+    typedef K key_type;
+    typedef KeyEqual key_equal;
+
 private:
     struct DICTht{
         Entry **table;
@@ -52,26 +372,815 @@ private:
     };
 
 public:
+    /* State shared by iterator and const_iterator, as in Redis dictIterator.
+     *
+     * A safe iterator pauses rehashing while it is alive, rehash() and
+     * rehashMilliseconds() included. The DICT can be used meanwhile, and
+     * the current entry can be removed. Entries added during the traversal
+     * may or may not be returned. clear() frees the entries the iterator
+     * points to: after it, the iterator may only be destroyed.
+     *
+     * An unsafe iterator adds no work to the traversal. Nothing may be
+     * called on the DICT while it is alive, not even find(), which can
+     * move a bucket. A fingerprint of both tables is taken at the start,
+     * and it is asserted unchanged when the traversal ends or the iterator
+     * is destroyed.
+     *
+     * Iterators release the DICT when they are destroyed, so they can be
+     * moved but not copied. */
     class iteratorP{
+    protected:
+        DICT *d;
         long index;
         int table, safe;
         Entry *entry, *nextEntry;
         long long fingerprint;
+
+        iteratorP() : d(nullptr), index(-1), table(0), safe(0), entry(nullptr), nextEntry(nullptr), fingerprint(0) {}
+
+        iteratorP(DICT *dict, bool isSafe)
+            : d(dict), index(-1), table(0), safe(isSafe), entry(nullptr), nextEntry(nullptr), fingerprint(0)
+        {
+            if (safe)
+                d->iterators++;
+            else
+                fingerprint = d->_fingerprint();
+            _next();
+        }
+
+        iteratorP(iteratorP &&other) noexcept
+            : d(other.d), index(other.index), table(other.table), safe(other.safe), entry(other.entry),
+              nextEntry(other.nextEntry), fingerprint(other.fingerprint)
+        {
+            other.d = nullptr;
+            other.entry = nullptr;
+        }
+
+        iteratorP &operator=(iteratorP &&other) noexcept
+        {
+            if (this != &other)
+            {
+                _release();
+                d = other.d;
+                index = other.index;
+                table = other.table;
+                safe = other.safe;
+                entry = other.entry;
+                nextEntry = other.nextEntry;
+                fingerprint = other.fingerprint;
+                other.d = nullptr;
+                other.entry = nullptr;
+            }
+            return *this;
+        }
+
+        ~iteratorP() { _release(); }
+
+        void _release()
+        {
+            if (d == nullptr)
+                return;
+            if (safe)
+                d->iterators--;
+            else
+                assert(fingerprint == d->_fingerprint() && "DICT modified during unsafe iteration");
+            d = nullptr;
+        }
+
+        /* Move to the next entry, reading its successor first so that the
+         * entry itself can be removed. Release the DICT at the end. */
+        void _next()
+        {
+            while (true)
+            {
+                if (entry == nullptr)
+                {
+                    DICTht *ht = &d->ht[table];
+                    index++;
+                    if (index >= (long)ht->size)
+                    {
+                        if (d->isRehashing() && table == 0)
+                        {
+                            table++;
+                            index = 0;
+                            ht = &d->ht[1];
+                        }
+                        else
+                            break;
+                    }
+                    entry = ht->table[index];
+                }
+                else
+                    entry = nextEntry;
+
+                if (entry)
+                {
+                    nextEntry = entry->next;
+                    return;
+                }
+            }
+            _release();
+        }
+
+    public:
+        bool operator==(const iteratorP &other) const { return entry == other.entry; }
+        bool operator!=(const iteratorP &other) const { return entry != other.entry; }
     };
 
     class iterator : public iteratorP
     {
+        friend class DICT;
+        iterator() = default;
+        iterator(DICT *dict, bool isSafe) : iteratorP(dict, isSafe) {}
+
+    public:
+        iterator &operator++()
+        {
+            this->_next();
+            return *this;
+        }
+        Entry &operator*() const { return *this->entry; }
+        Entry *operator->() const { return this->entry; }
     };
 
     class const_iterator : public iteratorP
     {
+        friend class DICT;
+        const_iterator() = default;
+        const_iterator(DICT *dict, bool isSafe) : iteratorP(dict, isSafe) {}
+
+    public:
+        const_iterator &operator++()
+        {
+            this->_next();
+            return *this;
+        }
+        const Entry &operator*() const { return *this->entry; }
+        const Entry *operator->() const { return this->entry; }
     };
-    
 
 private:
     DICTht ht[2];
     long rehashidx;
     int iterators;
+    Alloc alloc_;
+
+private:
+    /* Store of a field findOptimistic() loads while this DICT changes:
+     * release, so that a reader loading a table or an entry also sees the
+     * buckets and the key stored in it before */
+    template <typename T>
+    static void _publish(T &field, T value)
+    {
+        __atomic_store_n(&field, value, __ATOMIC_RELEASE);
+    }
+
+    static void _publishTable(DICTht &t, const DICTht &n)
+    {
+        _publish(t.size, n.size);
+        _publish(t.sizemask, n.sizemask);
+        _publish(t.table, n.table);
+        t.used = n.used;
+    }
+
+    static void _reset(DICTht &t)
+    {
+        _publishTable(t, DICTht{nullptr, 0, 0, 0});
+    }
+
+    static unsigned int _hashKey(const K &key)
+    {
+        return Hash()(key);
+    }
+
+    static unsigned int _hashEntry(const Entry *he)
+    {
+        if constexpr (CacheHash)
+            return he->hash;
+        return Hash()(he->key);
+    }
+
+    /* Whether he holds key, whose hash is h */
+    static bool _match(const Entry *he, const K &key, unsigned int h)
+    {
+        if constexpr (CacheHash)
+            if (he->hash != h)
+                return false;
+        return KeyEqual()(key, he->key);
+    }
+
+    static unsigned long _nextPower(unsigned long size)
+    {
+        unsigned long i = DICT_HT_INITIAL_SIZE;
+        if (size >= LONG_MAX)
+            return LONG_MAX + 1LU;
+        while (i < size)
+            i *= 2;
+        return i;
+    }
+
+    /* Move one bucket, unless an iterator relies on the current layout */
+    void _rehashStep()
+    {
+        if (iterators == 0)
+            rehash(1);
+    }
+
+    void _expandIfNeeded()
+    {
+        if (isRehashing())
+            return;
+
+        if (ht[0].size == 0)
+        {
+            expand(DICT_HT_INITIAL_SIZE);
+            return;
+        }
+
+        /* Grow once there are as many elements as buckets */
+        if (ht[0].used >= ht[0].size &&
+            (dictCanResize || ht[0].used / ht[0].size > DICT_FORCE_RESIZE_RATIO))
+            expand(ht[0].used * 2);
+    }
+
+    /* Return the entry with key and the hash of key */
+    Entry *_find(const K &key, unsigned int h) const
+    {
+        for (int table = 0; table <= 1; ++table)
+        {
+            if (ht[table].size == 0)
+                break;
+            Entry *he = ht[table].table[h & ht[table].sizemask];
+            while (he)
+            {
+                if (_match(he, key, h))
+                    return he;
+                he = he->next;
+            }
+            if (!isRehashing())
+                break;
+        }
+        return nullptr;
+    }
+
+    /* xorshift64*, one state per thread */
+    static uint64_t _random()
+    {
+        static thread_local uint64_t s = 0;
+        if (s == 0)
+            s = ((uint64_t)(uintptr_t)&s * 0x9E3779B97F4A7C15ULL) | 1;
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 2685821657736338717ULL;
+    }
+
+    /* Mix the bucket arrays, sizes and element counts of both tables, as
+     * Redis dictFingerprint() does */
+    long long _fingerprint() const
+    {
+        uint64_t integers[6] = {(uint64_t)(uintptr_t)ht[0].table, ht[0].size, ht[0].used,
+                                (uint64_t)(uintptr_t)ht[1].table, ht[1].size, ht[1].used};
+        uint64_t hash = 0;
+        for (uint64_t i : integers)
+        {
+            hash += i;
+            /* Thomas Wang's 64 bit integer hash */
+            hash = (~hash) + (hash << 21);
+            hash = hash ^ (hash >> 24);
+            hash = (hash + (hash << 3)) + (hash << 8);
+            hash = hash ^ (hash >> 14);
+            hash = (hash + (hash << 2)) + (hash << 4);
+            hash = hash ^ (hash >> 28);
+            hash = hash + (hash << 31);
+        }
+        return (long long)hash;
+    }
+
+    /* Reverse the bits of v, so that scan() can increment a cursor from its
+     * high bits */
+    static unsigned long _rev(unsigned long v)
+    {
+        unsigned long s = CHAR_BIT * sizeof(v);
+        unsigned long mask = ~0UL;
+        while ((s >>= 1) > 0)
+        {
+            mask ^= (mask << s);
+            v = ((v >> s) & mask) | ((v << s) & ~mask);
+        }
+        return v;
+    }
+
+    /* Pass bucket idx of t to bucketfn, then each of its entries to fn */
+    template <typename Fn, typename BucketFn>
+    static void _scanBucket(DICTht &t, unsigned long idx, Fn &fn, BucketFn &bucketfn)
+    {
+        bucketfn(&t.table[idx]);
+        Entry *he = t.table[idx];
+        while (he)
+        {
+            Entry *next = he->next;
+            fn(he);
+            he = next;
+        }
+    }
+
+    /* Free every entry of t and the bucket array */
+    void _clearTable(DICTht &t)
+    {
+        for (unsigned long i = 0; i < t.size && t.used > 0; ++i)
+        {
+            Entry *he = t.table[i];
+            while (he)
+            {
+                Entry *next = he->next;
+                alloc_.deleteEntry(he);
+                t.used--;
+                he = next;
+            }
+        }
+        alloc_.deleteTable(t.table);
+        _reset(t);
+    }
+
+public:
+    DICT() : rehashidx(-1), iterators(0)
+    {
+        _reset(ht[0]);
+        _reset(ht[1]);
+    }
+
+    DICT(const DICT &) = delete;
+    DICT &operator=(const DICT &) = delete;
+
+    ~DICT()
+    {
+        _clearTable(ht[0]);
+        _clearTable(ht[1]);
+    }
+
+public:
+    size_t size() const { return ht[0].used + ht[1].used; }
+    size_t slots() const { return ht[0].size + ht[1].size; }
+    bool isRehashing() const { return rehashidx != -1; }
+
+public:
+    /* Create or grow the table to the next power of two >= size. While
+     * rehashing, or with size smaller than the number of elements, nothing
+     * is done and false is returned. */
+    bool expand(unsigned long size)
+    {
+        if (isRehashing() || ht[0].used > size)
+            return false;
+
+        unsigned long realsize = _nextPower(size);
+        if (realsize == ht[0].size)
+            return false;
+
+        DICTht n;
+        n.size = realsize;
+        n.sizemask = realsize - 1;
+        n.table = (Entry **)alloc_.newTable(realsize, sizeof(Entry *));
+        if (n.table == nullptr)
+            throw std::runtime_error("Failed to allocate memory");
+        n.used = 0;
+
+        /* First initialization: no rehashing needed */
+        if (ht[0].table == nullptr)
+        {
+            _publishTable(ht[0], n);
+            return true;
+        }
+
+        _publishTable(ht[1], n);
+        _publish(rehashidx, 0L);
+        return true;
+    }
+
+    /* Shrink the table to the smallest power of two holding every element
+     * with a ratio elements/buckets near 1. */
+    bool resize()
+    {
+        if (!dictCanResize || isRehashing())
+            return false;
+
+        unsigned long minimal = ht[0].used;
+        if (minimal < DICT_HT_INITIAL_SIZE)
+            minimal = DICT_HT_INITIAL_SIZE;
+        return expand(minimal);
+    }
+
+    /* Move up to n buckets from ht[0] to ht[1]. At most n * 10 empty buckets
+     * are visited, so a sparse table does not block the caller either.
+     * Return whether buckets remain to be moved. Nothing is moved while a
+     * safe iterator is alive. */
+    bool rehash(int n)
+    {
+        int emptyVisits = n * 10;
+        if (!isRehashing())
+            return false;
+        if (iterators > 0)
+            return true;
+
+        while (n-- && ht[0].used != 0)
+        {
+            while (ht[0].table[rehashidx] == nullptr)
+            {
+                _publish(rehashidx, rehashidx + 1);
+                if (--emptyVisits == 0)
+                    return true;
+            }
+
+            Entry *de = ht[0].table[rehashidx];
+            while (de)
+            {
+                Entry *nextde = de->next;
+                unsigned long h = _hashEntry(de) & ht[1].sizemask;
+                _publish(de->next, ht[1].table[h]);
+                _publish(ht[1].table[h], de);
+                ht[0].used--;
+                ht[1].used++;
+                de = nextde;
+            }
+            _publish(ht[0].table[rehashidx], (Entry *)nullptr);
+            _publish(rehashidx, rehashidx + 1);
+        }
+
+        if (ht[0].used == 0)
+        {
+            alloc_.deleteTable(ht[0].table);
+            _publishTable(ht[0], ht[1]);
+            _reset(ht[1]);
+            _publish(rehashidx, -1L);
+            return false;
+        }
+        return true;
+    }
+
+    /* Rehash in steps of 100 buckets for about ms milliseconds. Return the
+     * number of buckets moved, 0 while a safe iterator is alive. */
+    long long rehashMilliseconds(int ms)
+    {
+        if (iterators > 0)
+            return 0;
+
+        auto start = std::chrono::steady_clock::now();
+        auto budget = std::chrono::milliseconds(ms);
+        long long rehashes = 0;
+
+        while (rehash(100))
+        {
+            rehashes += 100;
+            if (std::chrono::steady_clock::now() - start > budget)
+                break;
+        }
+        return rehashes;
+    }
+
+    /* Unsafe iteration, see iteratorP */
+    iterator begin() { return iterator(this, false); }
+    iterator end() { return iterator(); }
+    const_iterator begin() const { return const_iterator(const_cast<DICT *>(this), false); }
+    const_iterator end() const { return const_iterator(); }
+
+    /* Safe iteration: compare with end() */
+    iterator safeBegin() { return iterator(this, true); }
+
+    /* Visit the buckets of the table from cursor v and return the next
+     * cursor, or 0 once the whole table has been visited. Start with 0.
+     *
+     * The cursor is incremented from its high bits (reverse binary). A
+     * table of 2^n buckets is a prefix split of one of 2^(n+1) buckets:
+     * bucket i there is buckets i and i + 2^n here. The cursor always
+     * steps through the buckets in an order that is the same whatever the
+     * table size. So every element present from the first call to the last
+     * one is returned at least once, even if the table grows or shrinks in
+     * between. Elements may be returned more than once after a shrink.
+     *
+     * While rehashing, the bucket v of the smaller table is visited, then
+     * every bucket of the larger table that expands it.
+     *
+     * bucketfn receives a pointer to the head of each bucket before its
+     * entries, so that it can reallocate the entries (defragmentation).
+     * fn receives each entry. It may remove that entry, but must not add
+     * keys. Rehashing is paused meanwhile. */
+    template <typename Fn, typename BucketFn>
+    unsigned long scan(unsigned long v, Fn fn, BucketFn bucketfn)
+    {
+        if (size() == 0)
+            return 0;
+
+        iterators++;
+        if (!isRehashing())
+        {
+            unsigned long m0 = ht[0].sizemask;
+            _scanBucket(ht[0], v & m0, fn, bucketfn);
+
+            /* Set the unmasked bits so the reversed cursor carries past
+             * them */
+            v |= ~m0;
+            v = _rev(v);
+            v++;
+            v = _rev(v);
+        }
+        else
+        {
+            DICTht *t0 = &ht[0], *t1 = &ht[1];
+            if (t0->size > t1->size)
+                std::swap(t0, t1);
+            unsigned long m0 = t0->sizemask, m1 = t1->sizemask;
+
+            _scanBucket(*t0, v & m0, fn, bucketfn);
+            /* The buckets of the larger table that expand v & m0 */
+            do
+            {
+                _scanBucket(*t1, v & m1, fn, bucketfn);
+                v |= ~m1;
+                v = _rev(v);
+                v++;
+                v = _rev(v);
+            } while (v & (m0 ^ m1));
+        }
+        iterators--;
+        return v;
+    }
+
+    template <typename Fn>
+    unsigned long scan(unsigned long v, Fn fn)
+    {
+        return scan(v, fn, [](Entry **) {});
+    }
+
+    /* Return a random entry, or nullptr if the DICT is empty. A random
+     * non empty bucket is picked, then a random entry of its chain, so
+     * entries in short chains are more likely to be returned. */
+    Entry *randomKey()
+    {
+        if (size() == 0)
+            return nullptr;
+        if (isRehashing())
+            _rehashStep();
+
+        Entry *he;
+        if (isRehashing())
+        {
+            /* The buckets of ht[0] below rehashidx are empty */
+            unsigned long span = ht[0].size + ht[1].size - rehashidx;
+            do
+            {
+                unsigned long h = rehashidx + _random() % span;
+                he = (h >= ht[0].size) ? ht[1].table[h - ht[0].size] : ht[0].table[h];
+            } while (he == nullptr);
+        }
+        else
+        {
+            do
+                he = ht[0].table[_random() & ht[0].sizemask];
+            while (he == nullptr);
+        }
+
+        unsigned long listlen = 0;
+        for (Entry *e = he; e; e = e->next)
+            listlen++;
+        for (unsigned long i = _random() % listlen; i > 0; --i)
+            he = he->next;
+        return he;
+    }
+
+    /* Store up to count entries into des, taken from runs of contiguous
+     * buckets starting at a random bucket, and return how many were
+     * stored. Much faster than count calls to randomKey(), but the entries
+     * are neither distinct nor uniformly distributed: good enough to sample
+     * candidates for eviction. At most count * 10 buckets are visited. */
+    unsigned long getSomeKeys(Entry **des, unsigned long count)
+    {
+        if (size() < count)
+            count = size();
+        if (count == 0)
+            return 0;
+
+        unsigned long maxsteps = count * 10;
+        for (unsigned long j = 0; j < count && isRehashing(); ++j)
+            _rehashStep();
+
+        int tables = isRehashing() ? 2 : 1;
+        unsigned long maxsizemask = ht[0].sizemask;
+        if (tables > 1 && maxsizemask < ht[1].sizemask)
+            maxsizemask = ht[1].sizemask;
+
+        unsigned long i = _random() & maxsizemask;
+        unsigned long emptylen = 0;
+        unsigned long stored = 0;
+        while (stored < count && maxsteps--)
+        {
+            for (int j = 0; j < tables; ++j)
+            {
+                /* The buckets of ht[0] below rehashidx are empty: skip to
+                 * rehashidx, unless ht[1] still has buckets at i */
+                if (tables == 2 && j == 0 && i < (unsigned long)rehashidx)
+                {
+                    if (i >= ht[1].size)
+                        i = rehashidx;
+                    else
+                        continue;
+                }
+                if (i >= ht[j].size)
+                    continue;
+
+                Entry *he = ht[j].table[i];
+                if (he == nullptr)
+                {
+                    /* Jump elsewhere after a long run of empty buckets */
+                    emptylen++;
+                    if (emptylen >= 5 && emptylen > count)
+                    {
+                        i = _random() & maxsizemask;
+                        emptylen = 0;
+                    }
+                    continue;
+                }
+
+                emptylen = 0;
+                while (he)
+                {
+                    *des++ = he;
+                    he = he->next;
+                    if (++stored == count)
+                        return stored;
+                }
+            }
+            i = (i + 1) & maxsizemask;
+        }
+        return stored;
+    }
+
+    /* Like randomKey(), but a random pick among a sample of contiguous
+     * buckets: an entry in a long chain is about as likely to be returned
+     * as one in a short chain. */
+    Entry *fairRandomKey()
+    {
+        Entry *entries[DICT_GETFAIR_NUM_ENTRIES];
+        unsigned long count = getSomeKeys(entries, DICT_GETFAIR_NUM_ENTRIES);
+        /* getSomeKeys() may find nothing in a sparse table */
+        if (count == 0)
+            return randomKey();
+        return entries[_random() % count];
+    }
+
+public:
+    /* Add key if it is not present. Return false if it is. */
+    bool add(K key, V val)
+    {
+        return addRaw(std::move(key), std::move(val)) != nullptr;
+    }
+
+    /* Add key and return its new entry, or nullptr if key is present */
+    Entry *addRaw(K key, V val)
+    {
+        if (isRehashing())
+            _rehashStep();
+        _expandIfNeeded();
+
+        unsigned int h = _hashKey(key);
+        if (_find(key, h))
+            return nullptr;
+
+        /* New entries go to the table being filled, so that ht[0] only
+         * ever shrinks while rehashing */
+        DICTht &t = isRehashing() ? ht[1] : ht[0];
+        Entry *entry = alloc_.template newEntry<Entry>(std::move(key), std::move(val));
+        if constexpr (CacheHash)
+            entry->hash = h;
+        unsigned long idx = h & t.sizemask;
+        entry->next = t.table[idx];
+        _publish(t.table[idx], entry);
+        t.used++;
+        return entry;
+    }
+
+    /* Add key, or overwrite its value if it is present. Return true if the
+     * key was added, false if the value was replaced. */
+    bool replace(K key, V val)
+    {
+        Entry *entry = find(key);
+        if (entry)
+        {
+            entry->val = std::move(val);
+            return false;
+        }
+        return add(std::move(key), std::move(val));
+    }
+
+    Entry *find(const K &key)
+    {
+        if (size() == 0)
+            return nullptr;
+        if (isRehashing())
+            _rehashStep();
+        return _find(key, _hashKey(key));
+    }
+
+    /* Lookup without a rehash step, which leaves the DICT untouched */
+    const Entry *find(const K &key) const
+    {
+        if (size() == 0)
+            return nullptr;
+        return _find(key, _hashKey(key));
+    }
+
+    /* Lookup for a reader racing with a writer, as ShardedDICT does. The
+     * writer publishes tables, masks, buckets and chains with release
+     * stores, loaded here with acquire, so an entry reached through a
+     * bucket has its key fully built. A reader could still pair the table
+     * of one state with the mask of another: every field is loaded once,
+     * and stable() is called after all of them are loaded and before any
+     * of them is used: it returns false if a writer may have run
+     * meanwhile. Entries and tables must outlive the call (EPOCH). Return
+     * whether the lookup was consistent, then the entry. */
+    template <typename Stable>
+    std::tuple<bool, const Entry *> findOptimistic(const K &key, Stable stable) const
+    {
+        Entry **table[2];
+        unsigned long size[2], mask[2];
+        long rehashing = __atomic_load_n(&rehashidx, __ATOMIC_ACQUIRE);
+        for (int t = 0; t <= 1; ++t)
+        {
+            table[t] = __atomic_load_n(&ht[t].table, __ATOMIC_ACQUIRE);
+            size[t] = __atomic_load_n(&ht[t].size, __ATOMIC_ACQUIRE);
+            mask[t] = __atomic_load_n(&ht[t].sizemask, __ATOMIC_ACQUIRE);
+        }
+        if (!stable())
+            return {false, nullptr};
+
+        unsigned int h = _hashKey(key);
+        for (int t = 0; t <= 1; ++t)
+        {
+            if (size[t] == 0)
+                break;
+            Entry *he = __atomic_load_n(&table[t][h & mask[t]], __ATOMIC_ACQUIRE);
+            while (he)
+            {
+                if (_match(he, key, h))
+                    return {true, he};
+                he = __atomic_load_n(&he->next, __ATOMIC_ACQUIRE);
+            }
+            if (rehashing == -1)
+                break;
+        }
+        return {true, nullptr};
+    }
+
+    std::tuple<bool, V> fetchValue(const K &key)
+    {
+        Entry *he = find(key);
+        if (he)
+            return {true, he->val};
+        return {false, V()};
+    }
+
+    bool remove(const K &key)
+    {
+        if (size() == 0)
+            return false;
+        if (isRehashing())
+            _rehashStep();
+
+        unsigned int h = _hashKey(key);
+        for (int table = 0; table <= 1; ++table)
+        {
+            if (ht[table].size == 0)
+                break;
+            unsigned long idx = h & ht[table].sizemask;
+            Entry *he = ht[table].table[idx], *prev = nullptr;
+            while (he)
+            {
+                if (_match(he, key, h))
+                {
+                    if (prev)
+                        _publish(prev->next, he->next);
+                    else
+                        _publish(ht[table].table[idx], he->next);
+                    alloc_.deleteEntry(he);
+                    ht[table].used--;
+                    return true;
+                }
+                prev = he;
+                he = he->next;
+            }
+            if (!isRehashing())
+                break;
+        }
+        return false;
+    }
+
+    /* Remove every entry and release both tables. Live safe iterators
+     * stay counted, and resume rehashing when they are destroyed. */
+    void clear()
+    {
+        _clearTable(ht[0]);
+        _clearTable(ht[1]);
+        _publish(rehashidx, -1L);
+    }
 };
 
 #endif
\ No newline at end of file
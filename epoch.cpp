@@ -0,0 +1,168 @@
+#include "epoch.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+#include <stdexcept>
+
+using namespace bRedis;
+
+namespace
+{
+    const int EPOCH_MAX_THREADS = 256;
+    /* Scan the limbo list once every that many retire() calls */
+    const int EPOCH_RECLAIM_INTERVAL = 64;
+
+    struct retired
+    {
+        void *p;
+        void (*deleter)(void *);
+        uint64_t epoch;
+    };
+
+    /* Announced epoch of one thread: (epoch << 1) | 1 while the thread is in
+     * a critical section, 0 otherwise. One cache line each. */
+    struct alignas(64) epochSlot
+    {
+        std::atomic<uint64_t> local{0};
+        std::atomic<bool> used{false};
+    };
+
+    std::atomic<uint64_t> globalEpoch{1};
+    std::atomic<size_t> pendingCount{0};
+    epochSlot slots[EPOCH_MAX_THREADS];
+
+    /* Objects left behind by threads that exited before they could be freed */
+    struct orphanList
+    {
+        std::mutex lock;
+        std::vector<retired> list;
+
+        ~orphanList()
+        {
+            for (auto &r : list)
+                r.deleter(r.p);
+        }
+    } orphans;
+
+    bool tryAdvance()
+    {
+        uint64_t e = globalEpoch.load();
+        for (int i = 0; i < EPOCH_MAX_THREADS; ++i)
+        {
+            if (!slots[i].used.load(std::memory_order_acquire))
+                continue;
+            uint64_t v = slots[i].local.load();
+            if ((v & 1) && (v >> 1) != e)
+                return false;
+        }
+        return globalEpoch.compare_exchange_strong(e, e + 1);
+    }
+
+    /* Free the prefix of list retired at least two epochs ago. Entries are
+     * appended in epoch order. */
+    void freeExpired(std::vector<retired> &list)
+    {
+        uint64_t e = globalEpoch.load();
+        size_t n = 0;
+        while (n < list.size() && list[n].epoch + 2 <= e)
+        {
+            list[n].deleter(list[n].p);
+            n++;
+        }
+        if (n)
+        {
+            list.erase(list.begin(), list.begin() + n);
+            pendingCount.fetch_sub(n);
+        }
+    }
+
+    struct threadState
+    {
+        int slot = -1;
+        int nesting = 0;
+        int retires = 0;
+        std::vector<retired> limbo;
+
+        threadState()
+        {
+            for (int i = 0; i < EPOCH_MAX_THREADS; ++i)
+            {
+                bool expected = false;
+                if (!slots[i].used.load() && slots[i].used.compare_exchange_strong(expected, true))
+                {
+                    slot = i;
+                    return;
+                }
+            }
+            throw std::runtime_error("Too many threads using EPOCH");
+        }
+
+        ~threadState()
+        {
+            slots[slot].local.store(0);
+            slots[slot].used.store(false, std::memory_order_release);
+            if (limbo.empty())
+                return;
+
+            std::lock_guard<std::mutex> lk(orphans.lock);
+            orphans.list.insert(orphans.list.end(), limbo.begin(), limbo.end());
+        }
+    };
+
+    threadState &state()
+    {
+        static thread_local threadState ts;
+        return ts;
+    }
+
+    void reclaimLocal(threadState &ts)
+    {
+        tryAdvance();
+        freeExpired(ts.limbo);
+
+        std::unique_lock<std::mutex> lk(orphans.lock, std::try_to_lock);
+        if (lk.owns_lock())
+            freeExpired(orphans.list);
+    }
+}
+
+void EPOCH::enter()
+{
+    threadState &ts = state();
+    if (ts.nesting++ == 0)
+        slots[ts.slot].local.store((globalEpoch.load() << 1) | 1);
+}
+
+void EPOCH::exit()
+{
+    threadState &ts = state();
+    if (--ts.nesting == 0)
+        slots[ts.slot].local.store(0, std::memory_order_release);
+}
+
+void EPOCH::retire(void *p, void (*deleter)(void *))
+{
+    threadState &ts = state();
+    ts.limbo.push_back({p, deleter, globalEpoch.load()});
+    pendingCount.fetch_add(1);
+
+    if (++ts.retires >= EPOCH_RECLAIM_INTERVAL)
+    {
+        ts.retires = 0;
+        reclaimLocal(ts);
+    }
+}
+
+size_t EPOCH::pending()
+{
+    return pendingCount.load();
+}
+
+void EPOCH::reclaim()
+{
+    threadState &ts = state();
+    /* Two advances are enough for everything retired before this call */
+    for (int i = 0; i < 3; ++i)
+        reclaimLocal(ts);
+}
@@ -0,0 +1,47 @@
+#ifndef BOMENG_REDIS_EPOCH_H
+#define BOMENG_REDIS_EPOCH_H
+
+#include <cstddef>
+
+namespace bRedis
+{
+
+    /* Epoch based memory reclamation for the lock-free structures.
+     *
+     * A thread enters a critical section (guard) before touching shared
+     * nodes. A node that has been unlinked is handed to retire() and is only
+     * freed once every thread that was inside a critical section at that
+     * time has left it, i.e. after the global epoch advanced twice. */
+    class EPOCH
+    {
+    public:
+        class guard
+        {
+        public:
+            guard() { EPOCH::enter(); }
+            ~guard() { EPOCH::exit(); }
+            guard(const guard &) = delete;
+            guard &operator=(const guard &) = delete;
+        };
+
+    public:
+        static void enter();
+        static void exit();
+        static void retire(void *p, void (*deleter)(void *));
+
+        /* Number of retired objects not freed yet, over all threads. */
+        static size_t pending();
+
+        /* Try to advance the epoch and free what the calling thread retired
+         * and can be freed, and the objects left by exited threads unless
+         * another thread is freeing them. Called from a thread that is not
+         * inside a critical section, with no other thread in one, this frees
+         * everything the calling thread retired so far. Objects retired by
+         * other live threads stay in their lists until those threads call
+         * retire() or reclaim(), or exit. */
+        static void reclaim();
+    };
+
+} // namespace bRedis
+
+#endif
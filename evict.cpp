@@ -0,0 +1,205 @@
+#include "evict.h"
+
+#ifdef EVICT_TEST_MAIN
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace bRedis;
+
+void ok(void)
+{
+    printf("OK\n");
+}
+
+/* Live access times, to rank an evicted key among the keys still present */
+struct fenwick
+{
+    std::vector<long> t;
+
+    explicit fenwick(size_t n) : t(n + 1) {}
+    void add(size_t i, long v)
+    {
+        for (++i; i < t.size(); i += i & -i)
+            t[i] += v;
+    }
+    /* Number of times < i */
+    long prefix(size_t i) const
+    {
+        long s = 0;
+        for (; i > 0; i -= i & -i)
+            s += t[i];
+        return s;
+    }
+};
+
+typedef DICT<long, long> keyspace;
+
+/* A cache of n keys, whose values are their last access time. Insert ops
+ * new keys, each one evicting a key through evict(d), which returns the
+ * evicted key. Print evictions per second, the latency of an eviction,
+ * and how old the evicted keys were: the mean rank of their access time
+ * among the keys present, 0% for the least recently used, 50% for a
+ * random pick. */
+template <typename Evict>
+void bench(const char *name, long n, long ops, Evict evict)
+{
+    keyspace d;
+    fenwick live(n + ops);
+    std::mt19937_64 gen(1);
+    /* Shuffled initial access times */
+    std::vector<long> times(n);
+    for (long i = 0; i < n; ++i)
+        times[i] = i;
+    std::shuffle(times.begin(), times.end(), gen);
+    times.resize(n + ops);
+    for (long i = 0; i < n; ++i)
+    {
+        d.add(i, times[i]);
+        live.add(times[i], 1);
+    }
+
+    const size_t buckets = 1 << 17;
+    std::vector<uint32_t> hist(buckets);
+    long long max = 0, total = 0;
+    double rankSum = 0;
+    for (long clock = n; clock < n + ops; ++clock)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        long key = evict(d);
+        auto t1 = std::chrono::steady_clock::now();
+        long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+        total += ns;
+        max = ns > max ? ns : max;
+        hist[(size_t)ns < buckets ? ns : buckets - 1]++;
+
+        rankSum += (double)live.prefix(times[key]) / d.size();
+        live.add(times[key], -1);
+        times[clock] = clock;
+        d.add(clock, clock);
+        live.add(clock, 1);
+    }
+
+    long long target = (long long)(ops * 0.99), seen = 0, p99 = 0;
+    for (size_t i = 0; i < buckets; ++i)
+        if ((seen += hist[i]) > target)
+        {
+            p99 = i;
+            break;
+        }
+    printf("  %-18s %6.2fM evictions/s  p99 %5lldns  max %5lldus  evicted rank %5.2f%%\n", name,
+           ops / (total / 1e9) / 1e6, p99, max / 1000, 100 * rankSum / ops);
+}
+
+int main(int argc, char **argv)
+{
+    /* Values are access times: the oldest is the idlest */
+    auto idle = [](const keyspace::Entry &e) { return (unsigned long long)(LLONG_MAX - e.val); };
+
+    printf("randomKey, fairRandomKey and getSomeKeys: "); {
+        keyspace d;
+        assert(!d.randomKey() && !d.fairRandomKey());
+        keyspace::Entry *des[32];
+        assert(d.getSomeKeys(des, 32) == 0);
+
+        for (long i = 0; i < 6000; ++i)
+            d.add(i, i);
+        bool sawRehashing = false;
+        std::vector<int> hits(6000);
+        for (int i = 0; i < 200000; ++i)
+        {
+            sawRehashing |= d.isRehashing();
+            keyspace::Entry *e = (i % 2) ? d.randomKey() : d.fairRandomKey();
+            assert(e && d.find(e->key) == e);
+            hits[e->key]++;
+            unsigned long count = d.getSomeKeys(des, 32);
+            assert(count > 0 && count <= 32);
+            for (unsigned long j = 0; j < count; ++j)
+                assert(d.find(des[j]->key) == des[j]);
+        }
+        assert(sawRehashing);
+        int missed = 0;
+        for (int h : hits)
+            missed += h == 0;
+        assert(missed < 60);
+
+        /* Fewer entries than asked */
+        keyspace small;
+        small.add(1, 1);
+        small.add(2, 2);
+        assert(small.getSomeKeys(des, 32) == 2 && des[0]->key != des[1]->key);
+        ok();
+    }
+
+    printf("Eviction pool: "); {
+        keyspace d;
+        for (long i = 0; i < 10000; ++i)
+            d.add(i, i);
+        EVICTIONPOOL<keyspace> pool;
+        std::vector<bool> evicted(10000);
+        for (int i = 0; i < 1000; ++i)
+        {
+            auto [found, key] = pool.evict(d, idle);
+            assert(found && !evicted[key] && !d.find(key));
+            evicted[key] = true;
+        }
+        assert(d.size() == 9000 && pool.size() <= EVPOOL_SIZE);
+        /* Most evicted keys are among the oldest 20%, against 200 of 1000
+         * for random picks */
+        int old = 0;
+        for (int i = 0; i < 2000; ++i)
+            old += evicted[i];
+        assert(old > 600);
+
+        /* Stale candidates are skipped */
+        pool.populate(d, 64, idle);
+        for (long i = 0; i < 10000; ++i)
+            if (i % 100)
+                d.remove(i);
+        while (d.size() > 0)
+        {
+            auto [found, key] = pool.evict(d, idle);
+            assert(found && key % 100 == 0);
+        }
+        assert(!std::get<0>(pool.evict(d, idle)));
+        ok();
+    }
+
+    long n = (argc > 1) ? atol(argv[1]) : 1000000;
+    long ops = n / 2;
+    printf("Evicting %ld keys from a cache of %ld:\n", ops, n);
+    bench("random", n, ops, [](keyspace &d) {
+        long key = d.randomKey()->key;
+        d.remove(key);
+        return key;
+    });
+    bench("best of 5 samples", n, ops, [](keyspace &d) {
+        keyspace::Entry *des[EVICT_DEFAULT_SAMPLES];
+        unsigned long count = d.getSomeKeys(des, EVICT_DEFAULT_SAMPLES);
+        keyspace::Entry *best = des[0];
+        for (unsigned long j = 1; j < count; ++j)
+            if (des[j]->val < best->val)
+                best = des[j];
+        long key = best->key;
+        d.remove(key);
+        return key;
+    });
+    for (unsigned long samples : {5, 10})
+    {
+        EVICTIONPOOL<keyspace> pool;
+        char name[32];
+        snprintf(name, sizeof(name), "pool, %lu samples", samples);
+        bench(name, n, ops, [&](keyspace &d) {
+            auto [found, key] = pool.evict(d, idle, samples);
+            assert(found);
+            return key;
+        });
+    }
+
+    return 0;
+}
+#endif
@@ -0,0 +1,110 @@
+#ifndef BOMENG_REDIS_EVICT_H
+#define BOMENG_REDIS_EVICT_H
+
+#include "dict.h"
+#include <tuple>
+#include <utility>
+
+/* Candidates kept across evictions */
+#define EVPOOL_SIZE 16
+/* Entries sampled per populate(), as Redis maxmemory-samples */
+#define EVICT_DEFAULT_SAMPLES 5
+
+/* Approximated LRU/LFU eviction over a DICT, as in Redis evict.c.
+ *
+ * Finding the idlest key exactly would need an ordered index on every
+ * access. Instead each eviction samples a few entries with getSomeKeys(),
+ * scores them, and merges them into a small pool sorted by score that
+ * survives across evictions. The best candidate is evicted. Over many
+ * evictions the pool remembers good candidates that a single sample would
+ * miss, so the result comes close to true LRU at a constant cost per
+ * eviction: one getSomeKeys() over a few buckets and one remove().
+ *
+ * score(const Entry &) returns the idle score of an entry, the higher the
+ * sooner it is evicted: idle time for LRU, 255 - frequency for LFU. Keys
+ * are copied into the pool, so a candidate can have been removed or
+ * accessed since it was sampled. Removed ones are skipped, accessed ones
+ * are evicted on their old score, as Redis does. */
+template <typename D, size_t PoolSize = EVPOOL_SIZE>
+class EVICTIONPOOL
+{
+public:
+    typedef typename D::key_type K;
+    typedef typename D::Entry Entry;
+
+private:
+    struct candidate
+    {
+        unsigned long long idle;
+        K key;
+    };
+
+    /* Ascending by idle, the best candidate last */
+    candidate pool_[PoolSize];
+    size_t used_;
+
+public:
+    EVICTIONPOOL() : used_(0) {}
+
+    size_t size() const { return used_; }
+    void clear() { used_ = 0; }
+
+    /* Sample up to samples entries of d and insert those idler than the
+     * worst candidate of a full pool */
+    template <typename Score>
+    void populate(D &d, unsigned long samples, Score score)
+    {
+        Entry *entries[64];
+        if (samples > 64)
+            samples = 64;
+        unsigned long count = d.getSomeKeys(entries, samples);
+
+        for (unsigned long j = 0; j < count; ++j)
+        {
+            unsigned long long idle = score(*entries[j]);
+
+            size_t k = 0;
+            while (k < used_ && pool_[k].idle < idle)
+                k++;
+            if (k == 0 && used_ == PoolSize)
+                continue;
+
+            if (used_ < PoolSize)
+            {
+                /* Free slot at the right: shift [k, used_) right */
+                for (size_t i = used_; i > k; --i)
+                    pool_[i] = std::move(pool_[i - 1]);
+                used_++;
+            }
+            else
+            {
+                /* Full: drop the worst candidate at the left */
+                k--;
+                for (size_t i = 0; i < k; ++i)
+                    pool_[i] = std::move(pool_[i + 1]);
+            }
+            pool_[k].idle = idle;
+            pool_[k].key = entries[j]->key;
+        }
+    }
+
+    /* Remove the best candidate still in d. Return whether a key was
+     * evicted, and the key. */
+    template <typename Score>
+    std::tuple<bool, K> evict(D &d, Score score, unsigned long samples = EVICT_DEFAULT_SAMPLES)
+    {
+        while (d.size() > 0)
+        {
+            populate(d, samples, score);
+            while (used_ > 0)
+            {
+                candidate &best = pool_[--used_];
+                if (d.remove(best.key))
+                    return {true, std::move(best.key)};
+            }
+        }
+        return {false, K()};
+    }
+};
+
+#endif
@@ -0,0 +1,200 @@
+#include "expire.h"
+
+#ifdef EXPIRE_TEST_MAIN
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace bRedis;
+
+void ok(void)
+{
+    printf("OK\n");
+}
+
+/* Time set by hand */
+struct testClock
+{
+    static long long t;
+    static long long now() { return t; }
+};
+long long testClock::t = 1000;
+
+/* Stopped at 0 while the keys are loaded, real milliseconds after */
+struct benchClock
+{
+    static long long base;
+    static long long now() { return base ? expireClock::now() - base : 0; }
+};
+long long benchClock::base = 0;
+
+typedef EXPIREDICT<long, long, dictHash<long>, dictKeyEqual<long>, benchClock> benchDict;
+
+/* Load n keys expiring at random within window ms, then for window ms and
+ * a bit more, GET random keys of a hot set of 1% of the keyspace. If
+ * active, run activeExpireCycle() every 100ms (Redis hz 10) and
+ * activeExpireFastCycle() every 10ms in between. Print the
+ * expired keys still in memory, how many keys the cycles removed per
+ * second, and the latency of the GETs, a cycle counting towards the GET
+ * it delayed. */
+void bench(const char *name, long n, long long window, bool active)
+{
+    std::vector<long long> deadlines(n);
+    {
+        benchDict d;
+        std::mt19937_64 gen(1);
+        benchClock::base = 0;
+        for (long i = 0; i < n; ++i)
+        {
+            deadlines[i] = 1 + gen() % window;
+            d.add(i, i);
+            d.expireAt(i, deadlines[i]);
+        }
+        std::vector<long long> sorted(deadlines);
+        std::sort(sorted.begin(), sorted.end());
+        benchClock::base = expireClock::now();
+
+        const size_t buckets = 1 << 20;
+        std::vector<uint32_t> hist(buckets);
+        long long max = 0, ops = 0, cycleUs = 0;
+        size_t cycleRemoved = 0, peakStale = 0;
+        long long nextCycle = 10, nextReport = 1000;
+        long hot = n / 100 > 0 ? n / 100 : 1;
+
+        printf("  %s:\n", name);
+        while (benchClock::now() < window + 1000)
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            long long now = benchClock::now();
+            if (active && now >= nextCycle)
+            {
+                if (nextCycle % 100 == 0)
+                    cycleRemoved += d.activeExpireCycle();
+                else
+                    cycleRemoved += d.activeExpireFastCycle();
+                cycleUs += std::chrono::duration_cast<std::chrono::microseconds>(
+                               std::chrono::steady_clock::now() - t0)
+                               .count();
+                nextCycle += 10;
+            }
+            long key = gen() % hot;
+            auto [found, val] = d.fetchValue(key);
+            /* The GET reads the clock between now and now again */
+            assert(found ? deadlines[key] > now && val == key : deadlines[key] <= benchClock::now());
+            auto t1 = std::chrono::steady_clock::now();
+
+            long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+            max = ns > max ? ns : max;
+            hist[(size_t)ns < buckets ? ns : buckets - 1]++;
+            ops++;
+
+            if (now >= nextReport)
+            {
+                size_t live = sorted.end() - std::upper_bound(sorted.begin(), sorted.end(), now);
+                size_t stale = d.size() - live;
+                peakStale = stale > peakStale ? stale : peakStale;
+                if (nextReport % 2000 == 0 || now >= window)
+                    printf("    %6.1fs: %9zu keys, %9zu expired still in memory, stale estimate %5.1f%%\n",
+                           now / 1000.0, d.size(), stale, d.stalePerc());
+                nextReport += 1000;
+            }
+        }
+
+        long long p[3] = {0, 0, 0}, seen = 0;
+        double q[3] = {0.99, 0.999, 0.9999};
+        for (size_t i = 0, k = 0; i < buckets && k < 3; ++i)
+        {
+            seen += hist[i];
+            while (k < 3 && seen > ops * q[k])
+                p[k++] = i;
+        }
+        printf("    GET p99 %lldns  p99.9 %lldns  p99.99 %lldns  max %lldus  %.2fM ops/s\n", p[0], p[1], p[2],
+               max / 1000, ops / ((window + 1000) / 1000.0) / 1e6);
+        if (active)
+            printf("    cycles removed %.0f keys/s in %.1f%% of the time, peak backlog %zu keys\n",
+                   cycleRemoved / ((window + 1000) / 1000.0), cycleUs / ((window + 1000) * 10.0), peakStale);
+        else
+            printf("    peak backlog %zu keys\n", peakStale);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    typedef EXPIREDICT<std::string, long, dictHash<std::string>, dictKeyEqual<std::string>, testClock> testDict;
+
+    printf("Deadlines, lazy expiry: "); {
+        testDict d;
+        assert(d.add("a", 1) && d.add("b", 2) && d.add("c", 3));
+        assert(d.ttl("a") == -1 && d.ttl("x") == -2 && !d.expire("x", 10));
+        assert(d.expire("a", 100) && d.expireAt("b", 1200) && d.volatileSize() == 2);
+        assert(d.ttl("a") == 100 && d.ttl("b") == 200);
+        assert(d.persist("b") && !d.persist("b") && d.ttl("b") == -1);
+
+        testClock::t += 99;
+        assert(std::get<1>(d.fetchValue("a")) == 1);
+        testClock::t += 1;
+        assert(d.size() == 3 && !d.find("a") && d.size() == 2 && d.expired() == 1);
+        assert(d.volatileSize() == 0 && !d.remove("a"));
+
+        /* SET clears the deadline, a past deadline removes at once */
+        assert(d.expire("b", 10) && !d.replace("b", 20) && d.ttl("b") == -1);
+        assert(d.expire("c", 0) && !d.find("c") && d.size() == 1 && d.expired() == 2);
+        /* An expired key can be added again */
+        assert(d.add("a", 10) && d.expire("a", 5));
+        testClock::t += 5;
+        assert(d.add("a", 11) && d.ttl("a") == -1 && std::get<1>(d.fetchValue("a")) == 11);
+        ok();
+    }
+
+    printf("Active expire cycle: "); {
+        testDict d;
+        for (long i = 0; i < 100000; ++i)
+        {
+            d.add(std::to_string(i), i);
+            if (i % 2)
+                d.expire(std::to_string(i), 1 + i % 1000);
+        }
+        /* Nothing expired: one batch and done */
+        assert(d.activeExpireCycle() == 0 && d.volatileSize() == 50000);
+
+        testClock::t += 1000;
+        size_t removed = 0;
+        while (d.volatileSize() > 0)
+            removed += d.activeExpireCycle();
+        assert(removed == 50000 && d.size() == 50000 && d.expired() == 50000);
+        for (long i = 0; i < 100000; i += 2)
+            assert(std::get<1>(d.fetchValue(std::to_string(i))) == i);
+
+        /* Half expired: the cycle goes on until a batch finds few, and the
+         * fast cycle runs while the estimate is high */
+        for (long i = 0; i < 100000; i += 2)
+            d.expire(std::to_string(i), i < 50000 ? 1 : 1000000);
+        testClock::t += 1;
+        assert(d.activeExpireFastCycle() == 0);
+        removed = d.activeExpireCycle(1000000);
+        assert(removed > 20000 && removed <= 25000 && d.stalePerc() > 0);
+        while (d.stalePerc() >= EXPIRE_ACCEPTABLE_STALE)
+            removed += d.activeExpireFastCycle();
+        assert(d.activeExpireFastCycle() == 0);
+
+        /* Everything expires, the tables shrink on the way */
+        testClock::t += 1000000;
+        while (d.volatileSize() > 0)
+            d.activeExpireCycle();
+        assert(d.size() == 0 && d.expired() == 100000);
+        ok();
+    }
+
+    long n = (argc > 1) ? atol(argv[1]) : 10000000;
+    long long window = 10000;
+    printf("%ld keys expiring at random within %llds, GETs on 1%% of them:\n", n, window / 1000);
+    bench("lazy expiry only", n, window, false);
+    bench("lazy expiry and active cycles", n, window, true);
+
+    return 0;
+}
+#endif
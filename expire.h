@@ -0,0 +1,257 @@
+#ifndef BOMENG_REDIS_EXPIRE_H
+#define BOMENG_REDIS_EXPIRE_H
+
+#include "dict.h"
+#include <chrono>
+#include <tuple>
+#include <utility>
+
+/* Keys sampled per loop of the active expire cycle */
+#define EXPIRE_KEYS_PER_LOOP 20
+/* The cycle goes on while more than this percentage of the sampled keys
+ * are expired */
+#define EXPIRE_ACCEPTABLE_STALE 10
+/* CPU time of a cycle, as Redis ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC with
+ * hz 10: 25% of the 100ms between two cycles */
+#define EXPIRE_SLOW_CYCLE_US 25000
+#define EXPIRE_FAST_CYCLE_US 1000
+/* With every sampled key expired, a cycle may run that many times over
+ * its budget */
+#define EXPIRE_MAX_BUDGET_SCALE 2
+
+/* Milliseconds, the unit of deadlines */
+struct expireClock
+{
+    static long long now()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+};
+
+/* A DICT whose keys can expire, as a Redis database: the keyspace, and a
+ * second DICT from each volatile key to its deadline in Clock::now()
+ * milliseconds.
+ *
+ * Expired keys are removed in two ways, as in Redis expire.c. Lazily:
+ * every access to a key first checks its deadline, so an expired key is
+ * never returned. Actively: keys never accessed again would stay in memory
+ * forever, so activeExpireCycle(), called periodically by the owner, scans
+ * the volatile keys with a cursor in batches of EXPIRE_KEYS_PER_LOOP and
+ * removes the expired ones. The cycle goes on while a batch finds more
+ * than EXPIRE_ACCEPTABLE_STALE percent expired keys, and stops when the
+ * time budget runs out. Little work is done when few keys are expired.
+ *
+ * A running estimate of the share of expired keys is kept. The budget
+ * grows with it, up to EXPIRE_MAX_BUDGET_SCALE times when every key
+ * sampled lately was expired, so that memory is reclaimed faster when
+ * keys expire faster than the cycles remove them. The fast cycle, meant
+ * to run more often with a small budget, does nothing while the estimate
+ * is below the acceptable share.
+ *
+ * size() counts the keys expired and not removed yet. */
+template <typename K, typename V, typename Hash = dictHash<K>, typename KeyEqual = dictKeyEqual<K>,
+          typename Clock = expireClock>
+class EXPIREDICT
+{
+public:
+    typedef DICT<K, V, Hash, KeyEqual> keyspace;
+    typedef DICT<K, long long, Hash, KeyEqual> expires;
+    typedef typename keyspace::Entry Entry;
+
+private:
+    keyspace dict_;
+    expires expires_;
+    unsigned long cursor_;
+    double stalePerc_;
+    size_t expired_;
+
+private:
+    /* Remove key if it is expired, and return whether it was */
+    bool _expireIfNeeded(const K &key)
+    {
+        if (expires_.size() == 0)
+            return false;
+        auto *de = expires_.find(key);
+        if (de == nullptr || de->val > Clock::now())
+            return false;
+        dict_.remove(key);
+        expires_.remove(key);
+        expired_++;
+        return true;
+    }
+
+    /* Shrink tables left sparse by mass expiry, as Redis htNeedsResize() */
+    template <typename D>
+    static void _shrinkIfNeeded(D &d)
+    {
+        size_t slots = d.slots();
+        if (slots > DICT_HT_INITIAL_SIZE && d.size() * 100 / slots < 10)
+            d.resize();
+    }
+
+public:
+    EXPIREDICT() : cursor_(0), stalePerc_(0), expired_(0) {}
+
+    EXPIREDICT(const EXPIREDICT &) = delete;
+    EXPIREDICT &operator=(const EXPIREDICT &) = delete;
+
+public:
+    size_t size() const { return dict_.size(); }
+    size_t volatileSize() const { return expires_.size(); }
+    /* Keys removed because they expired, lazily or actively */
+    size_t expired() const { return expired_; }
+    /* Running estimate of the percentage of expired volatile keys */
+    double stalePerc() const { return stalePerc_; }
+
+public:
+    /* Add key without a deadline. Return false if it is present. */
+    bool add(K key, V val)
+    {
+        _expireIfNeeded(key);
+        return dict_.add(std::move(key), std::move(val));
+    }
+
+    /* Add key or overwrite its value. As Redis SET, any deadline is
+     * cleared. Return true if the key was added. */
+    bool replace(K key, V val)
+    {
+        if (!_expireIfNeeded(key) && expires_.size() > 0)
+            expires_.remove(key);
+        return dict_.replace(std::move(key), std::move(val));
+    }
+
+    Entry *find(const K &key)
+    {
+        _expireIfNeeded(key);
+        return dict_.find(key);
+    }
+
+    std::tuple<bool, V> fetchValue(const K &key)
+    {
+        Entry *he = find(key);
+        if (he)
+            return {true, he->val};
+        return {false, V()};
+    }
+
+    bool remove(const K &key)
+    {
+        if (_expireIfNeeded(key))
+            return false;
+        if (!dict_.remove(key))
+            return false;
+        if (expires_.size() > 0)
+            expires_.remove(key);
+        return true;
+    }
+
+    /* Set the deadline of key, in Clock::now() milliseconds. A deadline in
+     * the past removes the key at once. Return false if key is missing. */
+    bool expireAt(const K &key, long long when)
+    {
+        if (find(key) == nullptr)
+            return false;
+        if (when <= Clock::now())
+        {
+            dict_.remove(key);
+            if (expires_.size() > 0)
+                expires_.remove(key);
+            expired_++;
+            return true;
+        }
+        expires_.replace(key, when);
+        return true;
+    }
+
+    bool expire(const K &key, long long ms)
+    {
+        return expireAt(key, Clock::now() + ms);
+    }
+
+    /* Clear the deadline of key. Return false if key is missing or has no
+     * deadline. */
+    bool persist(const K &key)
+    {
+        if (find(key) == nullptr)
+            return false;
+        return expires_.remove(key);
+    }
+
+    /* Milliseconds left to key, -1 if it has no deadline, -2 if it is
+     * missing, as Redis PTTL */
+    long long ttl(const K &key)
+    {
+        if (find(key) == nullptr)
+            return -2;
+        auto *de = expires_.find(key);
+        if (de == nullptr)
+            return -1;
+        long long left = de->val - Clock::now();
+        return left > 0 ? left : 0;
+    }
+
+public:
+    /* Remove expired keys for up to budgetUs microseconds, scaled up by
+     * the estimate of expired keys. Return the number of keys removed. */
+    size_t activeExpireCycle(long long budgetUs = EXPIRE_SLOW_CYCLE_US)
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto budget = std::chrono::microseconds(
+            (long long)(budgetUs * (1 + (EXPIRE_MAX_BUDGET_SCALE - 1) * stalePerc_ / 100)));
+        long long now = Clock::now();
+        size_t removed = 0;
+        unsigned long sampled, found;
+        int iteration = 0;
+
+        do
+        {
+            if (expires_.size() == 0)
+            {
+                stalePerc_ = 0;
+                break;
+            }
+
+            sampled = found = 0;
+            /* Bound the empty buckets visited, for sparse tables */
+            unsigned long buckets = EXPIRE_KEYS_PER_LOOP * 20;
+            while (sampled < EXPIRE_KEYS_PER_LOOP && buckets-- > 0)
+            {
+                cursor_ = expires_.scan(cursor_, [&](typename expires::Entry *de) {
+                    sampled++;
+                    if (de->val <= now)
+                    {
+                        found++;
+                        dict_.remove(de->key);
+                        expires_.remove(de->key);
+                    }
+                });
+                if (cursor_ == 0)
+                    break;
+            }
+            removed += found;
+            if (sampled)
+                stalePerc_ = 0.95 * stalePerc_ + 0.05 * (100.0 * found / sampled);
+
+            /* Reading the clock costs more than a loop: check it every 16 */
+            if ((++iteration & 15) == 0 && std::chrono::steady_clock::now() - start > budget)
+                break;
+        } while (sampled == 0 || found * 100 > sampled * EXPIRE_ACCEPTABLE_STALE);
+
+        expired_ += removed;
+        _shrinkIfNeeded(dict_);
+        _shrinkIfNeeded(expires_);
+        return removed;
+    }
+
+    /* Short cycle, skipped while few keys are estimated expired */
+    size_t activeExpireFastCycle()
+    {
+        if (stalePerc_ < EXPIRE_ACCEPTABLE_STALE)
+            return 0;
+        return activeExpireCycle(EXPIRE_FAST_CYCLE_US);
+    }
+};
+
+#endif
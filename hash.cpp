@@ -0,0 +1,370 @@
+#include "hash.h"
+
+using namespace bRedis;
+
+namespace
+{
+    SDS entryToSDS(const ZIPLIST::entry &e)
+    {
+        return e.sval ? SDS(e.sval, e.slen) : SDS(e.lval);
+    }
+}
+
+void HASH::convert()
+{
+    if (encoding_ == HASH_ENCODING_DICT)
+        return;
+
+    std::unique_ptr<hashDict> dict(new hashDict);
+    dict->expand(len());
+    for (size_t p = packed_.first(); p; p = packed_.next(packed_.next(p)))
+        dict->add(entryToSDS(packed_.get(p)), entryToSDS(packed_.get(packed_.next(p))));
+
+    packed_ = ZIPLIST();
+    dict_ = std::move(dict);
+    encoding_ = HASH_ENCODING_DICT;
+}
+
+/* Offset of the field, 0 if it is not present. The value follows it. */
+size_t HASH::packedFind(const SDS &field) const
+{
+    return packed_.find(field.buf(), field.len(), packed_.first(), 1);
+}
+
+HASH::HASH(size_t maxPackedEntries, size_t maxPackedValue)
+    : encoding_(HASH_ENCODING_PACKED),
+      maxPackedEntries_(maxPackedEntries),
+      maxPackedValue_(maxPackedValue)
+{
+}
+
+HASH::HASH(const HASH &h)
+    : encoding_(h.encoding_),
+      maxPackedEntries_(h.maxPackedEntries_),
+      maxPackedValue_(h.maxPackedValue_),
+      packed_(h.packed_)
+{
+    if (h.dict_)
+    {
+        dict_.reset(new hashDict);
+        dict_->expand(h.dict_->size());
+        for (auto &e : *h.dict_)
+            dict_->add(e.key, e.val);
+    }
+}
+
+HASH &HASH::operator=(const HASH &h)
+{
+    if (&h == this)
+        return *this;
+
+    HASH t(h);
+    *this = std::move(t);
+    return *this;
+}
+
+HASH::HASH(HASH &&h)
+    : encoding_(h.encoding_),
+      maxPackedEntries_(h.maxPackedEntries_),
+      maxPackedValue_(h.maxPackedValue_),
+      packed_(std::move(h.packed_)),
+      dict_(std::move(h.dict_))
+{
+    h.encoding_ = HASH_ENCODING_PACKED;
+    h.packed_ = ZIPLIST();
+}
+
+HASH &HASH::operator=(HASH &&h)
+{
+    if (&h == this)
+        return *this;
+
+    encoding_ = h.encoding_;
+    maxPackedEntries_ = h.maxPackedEntries_;
+    maxPackedValue_ = h.maxPackedValue_;
+    packed_ = std::move(h.packed_);
+    dict_ = std::move(h.dict_);
+
+    h.encoding_ = HASH_ENCODING_PACKED;
+    h.packed_ = ZIPLIST();
+
+    return *this;
+}
+
+HASH::~HASH()
+{
+}
+
+bool HASH::set(const SDS &field, const SDS &value)
+{
+    if (encoding_ == HASH_ENCODING_PACKED)
+    {
+        if (field.len() > maxPackedValue_ || value.len() > maxPackedValue_)
+            convert();
+        else
+        {
+            size_t p = packedFind(field);
+            if (p)
+            {
+                packed_.replace(packed_.next(p), value.buf(), value.len());
+                return false;
+            }
+            if (len() + 1 <= maxPackedEntries_)
+            {
+                packed_.append(field.buf(), field.len());
+                packed_.append(value.buf(), value.len());
+                return true;
+            }
+            convert();
+        }
+    }
+
+    return dict_->replace(field, value);
+}
+
+std::tuple<bool, SDS> HASH::get(const SDS &field) const
+{
+    if (encoding_ == HASH_ENCODING_PACKED)
+    {
+        size_t p = packedFind(field);
+        if (p == 0)
+            return {false, SDS()};
+        return {true, entryToSDS(packed_.get(packed_.next(p)))};
+    }
+
+    const hashDict &dict = *dict_;
+    auto *de = dict.find(field);
+    if (de == nullptr)
+        return {false, SDS()};
+    return {true, de->val};
+}
+
+bool HASH::exists(const SDS &field) const
+{
+    if (encoding_ == HASH_ENCODING_PACKED)
+        return packedFind(field) != 0;
+
+    const hashDict &dict = *dict_;
+    return dict.find(field) != nullptr;
+}
+
+bool HASH::remove(const SDS &field)
+{
+    if (encoding_ == HASH_ENCODING_PACKED)
+    {
+        size_t p = packedFind(field);
+        if (p == 0)
+            return false;
+        packed_.remove(packed_.remove(p));
+        return true;
+    }
+
+    return dict_->remove(field);
+}
+
+std::vector<std::pair<SDS, SDS>> HASH::getAll() const
+{
+    std::vector<std::pair<SDS, SDS>> result;
+    result.reserve(len());
+
+    if (encoding_ == HASH_ENCODING_PACKED)
+    {
+        for (size_t p = packed_.first(); p; p = packed_.next(packed_.next(p)))
+            result.emplace_back(entryToSDS(packed_.get(p)), entryToSDS(packed_.get(packed_.next(p))));
+        return result;
+    }
+
+    for (auto &e : *dict_)
+        result.emplace_back(e.key, e.val);
+    return result;
+}
+
+size_t HASH::len() const
+{
+    return encoding_ == HASH_ENCODING_PACKED ? packed_.len() / 2 : dict_->size();
+}
+
+uint32_t HASH::encoding() const
+{
+    return encoding_;
+}
+
+#ifdef HASH_TEST_MAIN
+#include <string>
+#include <unordered_map>
+#include <random>
+#include <chrono>
+#include <cassert>
+#include <cstdio>
+#include <malloc.h>
+
+size_t heapBytes(void)
+{
+    return mallinfo2().uordblks;
+}
+
+void ok(void)
+{
+    printf("OK\n");
+}
+
+std::string str(const SDS &s)
+{
+    return std::string(s.buf(), s.len());
+}
+
+void check(const HASH &h, const std::unordered_map<std::string, std::string> &model)
+{
+    assert(h.len() == model.size());
+    auto all = h.getAll();
+    assert(all.size() == model.size());
+    for (auto &kv : all)
+    {
+        auto it = model.find(str(kv.first));
+        assert(it != model.end() && it->second == str(kv.second));
+        auto [found, value] = h.get(kv.first);
+        assert(found && str(value) == it->second && h.exists(kv.first));
+    }
+}
+
+void randomTest(size_t maxPackedEntries, size_t maxPackedValue, uint32_t encoding)
+{
+    printf("Random set/remove (max packed entries %zu, value %zu): ", maxPackedEntries, maxPackedValue);
+    std::mt19937_64 gen(maxPackedEntries);
+    HASH h(maxPackedEntries, maxPackedValue);
+    std::unordered_map<std::string, std::string> model;
+    for (int i = 0; i < 20000; ++i)
+    {
+        /* Fields and values that look like integers are stored as integers */
+        std::string field = gen() % 2 ? std::to_string(gen() % 300) : "f" + std::to_string(gen() % 300);
+        SDS f(field.data(), field.size());
+        switch (gen() % 4)
+        {
+        case 0:
+        case 1:
+        {
+            std::string value = gen() % 3 ? std::to_string((long long)gen() % 100000)
+                                           : std::string(gen() % 20, 'v') + "0";
+            bool added = model.find(field) == model.end();
+            assert(h.set(f, SDS(value.data(), value.size())) == added);
+            model[field] = value;
+            break;
+        }
+        case 2:
+            assert(h.remove(f) == (model.erase(field) == 1));
+            break;
+        case 3:
+            assert(h.exists(f) == (model.find(field) != model.end()));
+            break;
+        }
+        if (i % 1000 == 0)
+            check(h, model);
+    }
+    check(h, model);
+    assert(h.encoding() == encoding);
+    HASH copy(h);
+    check(copy, model);
+    ok();
+}
+
+struct benchResult
+{
+    double bytes;
+    double setNs;
+    double getNs;
+    size_t packed;
+};
+
+/* n objects of 5 to 20 fields like a user profile. Return the bytes per
+ * object and the time of an HSET and an HGET. */
+benchResult bench(long n, size_t maxPackedEntries)
+{
+    static const char *names[] = {"name", "email", "created_at", "last_login", "country", "city", "plan",
+                                  "visits", "score", "referrer", "language", "timezone", "status", "age",
+                                  "followers", "following", "avatar", "verified", "theme", "device"};
+    char buf[64];
+    std::mt19937_64 gen(1);
+    std::vector<HASH> objects;
+    objects.reserve(n);
+    size_t fields = 0;
+
+    size_t before = heapBytes();
+    auto t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; ++i)
+    {
+        objects.emplace_back(maxPackedEntries);
+        HASH &h = objects.back();
+        size_t nf = 5 + i % 16;
+        for (size_t j = 0; j < nf; ++j)
+        {
+            size_t len = (j % 3 == 0) ? snprintf(buf, sizeof(buf), "%lld", (long long)(gen() % 1000000))
+                                      : snprintf(buf, sizeof(buf), "%s-%ld", names[(j * 7) % 20], i);
+            h.set(SDS(names[j]), SDS(buf, len));
+        }
+        fields += nf;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double bytes = heapBytes() - before;
+
+    long lookups = 5000000;
+    std::vector<SDS> keys(names, names + 20);
+    size_t found = 0;
+    auto t2 = std::chrono::steady_clock::now();
+    for (long i = 0; i < lookups; ++i)
+    {
+        const HASH &h = objects[gen() % n];
+        found += std::get<0>(h.get(keys[gen() % 20]));
+    }
+    auto t3 = std::chrono::steady_clock::now();
+    assert(found > 0 && found < (size_t)lookups);
+
+    size_t packed = 0;
+    for (auto &h : objects)
+        packed += h.encoding() == HASH_ENCODING_PACKED;
+
+    auto ns = [](std::chrono::steady_clock::duration d) {
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    };
+    return {bytes / n, ns(t1 - t0) / fields, ns(t3 - t2) / lookups, packed};
+}
+
+int main(int argc, char **argv)
+{
+    /* 600 distinct fields, values up to 21 bytes */
+    randomTest(HASH_MAX_PACKED_ENTRIES, HASH_MAX_PACKED_VALUE, HASH_ENCODING_DICT);
+    randomTest(1000, HASH_MAX_PACKED_VALUE, HASH_ENCODING_PACKED);
+    randomTest(1000, 10, HASH_ENCODING_DICT);
+    randomTest(0, HASH_MAX_PACKED_VALUE, HASH_ENCODING_DICT);
+
+    printf("Convert on growth: "); {
+        HASH h(4, 8);
+        for (int i = 0; i < 4; ++i)
+            assert(h.set(SDS((long long)i), "v"));
+        assert(!h.set("3", "w") && h.encoding() == HASH_ENCODING_PACKED);
+        assert(h.set("4", "v") && h.encoding() == HASH_ENCODING_DICT);
+        assert(str(std::get<1>(h.get("3"))) == "w" && h.len() == 5);
+
+        HASH h2(4, 8);
+        h2.set("a", "v");
+        assert(!h2.set("a", "a long value") && h2.encoding() == HASH_ENCODING_DICT);
+        assert(str(std::get<1>(h2.get("a"))) == "a long value" && h2.len() == 1);
+
+        HASH h3(std::move(h2));
+        assert(h3.len() == 1 && h2.len() == 0 && h2.encoding() == HASH_ENCODING_PACKED);
+        h2 = h;
+        assert(h2.len() == 5 && h2.encoding() == HASH_ENCODING_DICT);
+        ok();
+    }
+
+    long n = (argc > 1) ? atol(argv[1]) : 2000000;
+    printf("%ld objects of 5 to 20 fields:\n", n);
+    for (size_t max : {(size_t)HASH_MAX_PACKED_ENTRIES, (size_t)0})
+    {
+        benchResult r = bench(n, max);
+        printf("    %-26s %7.1f bytes/object  %5.1f%% packed  HSET %6.1f ns  HGET %6.1f ns\n",
+               max ? "packed up to 128 entries" : "always DICT", r.bytes, 100.0 * r.packed / n, r.setNs, r.getNs);
+    }
+
+    return 0;
+}
+#endif
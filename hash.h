@@ -0,0 +1,68 @@
+#ifndef BOMENG_REDIS_HASH_H
+#define BOMENG_REDIS_HASH_H
+
+#include "sds.h"
+#include "dict.h"
+#include "ziplist.h"
+#include <stdint.h>
+#include <tuple>
+#include <vector>
+#include <memory>
+
+/* Encodings of a hash. Small hashes are kept as a ZIPLIST of alternating
+ * fields and values and converted to a DICT once they grow past the
+ * configured limits, as Redis hash-max-listpack-entries and
+ * hash-max-listpack-value. */
+#define HASH_ENCODING_PACKED 0
+#define HASH_ENCODING_DICT 1
+
+#define HASH_MAX_PACKED_ENTRIES 128
+#define HASH_MAX_PACKED_VALUE 64
+
+namespace bRedis
+{
+
+    class HASH
+    {
+    private:
+        typedef DICT<SDS, SDS> hashDict;
+
+    private:
+        uint32_t encoding_;
+        size_t maxPackedEntries_;
+        size_t maxPackedValue_;
+        ZIPLIST packed_;
+        std::unique_ptr<hashDict> dict_;
+
+    private:
+        void convert();
+        size_t packedFind(const SDS &field) const;
+
+    public:
+        HASH(size_t maxPackedEntries = HASH_MAX_PACKED_ENTRIES, size_t maxPackedValue = HASH_MAX_PACKED_VALUE);
+
+        HASH(const HASH &h);
+        HASH &operator=(const HASH &h);
+        HASH(HASH &&h);
+        HASH &operator=(HASH &&h);
+
+        ~HASH();
+
+    public:
+        /* HSET of one field: return true if the field was added, false if
+         * its value was overwritten */
+        bool set(const SDS &field, const SDS &value);
+        std::tuple<bool, SDS> get(const SDS &field) const;
+        bool exists(const SDS &field) const;
+        bool remove(const SDS &field);
+        /* HGETALL: insertion order while packed, table order after */
+        std::vector<std::pair<SDS, SDS>> getAll() const;
+
+    public:
+        size_t len() const;
+        uint32_t encoding() const;
+    };
+
+} // namespace bRedis
+
+#endif
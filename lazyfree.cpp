@@ -0,0 +1,317 @@
+#include "lazyfree.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <system_error>
+#include <condition_variable>
+
+using namespace bRedis;
+
+namespace
+{
+    struct job
+    {
+        void *p;
+        void (*deleter)(void *);
+        job *next;
+    };
+
+    enum
+    {
+        LAZYFREE_IDLE,
+        LAZYFREE_RUNNING,
+        LAZYFREE_STOPPED
+    };
+
+    /* Producers push with a CAS, the thread takes the whole list at once
+     * with an exchange, so nodes are never popped one by one (no ABA). */
+    std::atomic<job *> head{nullptr};
+    std::atomic<size_t> pendingCount{0};
+    std::atomic<size_t> freedCount{0};
+
+    /* Only used to sleep and wake up: set by the thread before it checks
+     * the queue one last time, read by producers after they push */
+    std::atomic<bool> sleeping{false};
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::condition_variable drained;
+    bool stopping = false;
+
+    std::mutex startLock;
+    std::atomic<int> state{LAZYFREE_IDLE};
+    std::thread worker;
+
+    void freeList(job *list)
+    {
+        while (list)
+        {
+            job *next = list->next;
+            list->deleter(list->p);
+            delete list;
+            list = next;
+            pendingCount.fetch_sub(1);
+            freedCount.fetch_add(1);
+        }
+    }
+
+    void run()
+    {
+        while (true)
+        {
+            job *list = head.exchange(nullptr);
+            if (list)
+            {
+                freeList(list);
+                if (pendingCount.load() == 0)
+                {
+                    std::lock_guard<std::mutex> lk(lock);
+                    drained.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lk(lock);
+            sleeping.store(true);
+            wakeup.wait(lk, [] { return head.load() != nullptr || stopping; });
+            sleeping.store(false);
+            if (stopping && head.load() == nullptr)
+                return;
+        }
+    }
+
+    /* Start the thread on first use. Return false if it is stopped or
+     * cannot be started. */
+    bool start()
+    {
+        int s = state.load();
+        if (s != LAZYFREE_IDLE)
+            return s == LAZYFREE_RUNNING;
+
+        std::lock_guard<std::mutex> lk(startLock);
+        if (state.load() == LAZYFREE_IDLE)
+        {
+            try
+            {
+                worker = std::thread(run);
+                state.store(LAZYFREE_RUNNING);
+            }
+            catch (const std::system_error &)
+            {
+                state.store(LAZYFREE_STOPPED);
+            }
+        }
+        return state.load() == LAZYFREE_RUNNING;
+    }
+
+    /* Join the thread at exit, after it freed what is queued */
+    struct stopAtExit
+    {
+        ~stopAtExit() { LAZYFREE::shutdown(); }
+    } stopper;
+}
+
+void LAZYFREE::enqueue(void *p, void (*deleter)(void *))
+{
+    if (!start())
+    {
+        deleter(p);
+        return;
+    }
+
+    job *j = new job{p, deleter, head.load()};
+    pendingCount.fetch_add(1);
+    while (!head.compare_exchange_weak(j->next, j))
+        ;
+
+    /* shutdown() may have taken the queue for the last time between
+     * start() and the push: nobody else will free it */
+    if (state.load() == LAZYFREE_STOPPED)
+    {
+        freeList(head.exchange(nullptr));
+        return;
+    }
+
+    if (sleeping.load())
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        wakeup.notify_one();
+    }
+}
+
+size_t LAZYFREE::pending()
+{
+    return pendingCount.load();
+}
+
+size_t LAZYFREE::freed()
+{
+    return freedCount.load();
+}
+
+void LAZYFREE::drain()
+{
+    if (state.load() != LAZYFREE_RUNNING)
+        return;
+    std::unique_lock<std::mutex> lk(lock);
+    drained.wait(lk, [] { return pendingCount.load() == 0; });
+}
+
+void LAZYFREE::shutdown()
+{
+    std::lock_guard<std::mutex> slk(startLock);
+    if (state.exchange(LAZYFREE_STOPPED) == LAZYFREE_RUNNING)
+    {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            stopping = true;
+            wakeup.notify_one();
+        }
+        worker.join();
+    }
+    /* Objects queued by a producer that raced with the stop */
+    freeList(head.exchange(nullptr));
+}
+
+#ifdef LAZYFREE_TEST_MAIN
+#include <chrono>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+long long msec(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+
+void ok(void) {
+    printf("OK\n");
+}
+
+/* Counts its destructions, and the thread that ran the last one */
+struct tracked {
+    static std::atomic<int> destroyed;
+    static std::atomic<bool> onMain;
+    static std::thread::id mainThread;
+    ~tracked() {
+        destroyed++;
+        onMain = std::this_thread::get_id() == mainThread;
+    }
+};
+std::atomic<int> tracked::destroyed{0};
+std::atomic<bool> tracked::onMain{false};
+std::thread::id tracked::mainThread;
+
+/* Time delete against release() on the main thread, and how long the
+ * background thread takes to catch up */
+template <typename T, typename Fill>
+void bench(const char *name, Fill fill) {
+    T *a = new T(), *b = new T();
+    fill(*a);
+    fill(*b);
+
+    auto t0 = std::chrono::steady_clock::now();
+    delete a;
+    long long sync = msec(t0);
+
+    t0 = std::chrono::steady_clock::now();
+    LAZYFREE::release(b);
+    long long async = msec(t0);
+    LAZYFREE::drain();
+    long long background = msec(t0);
+    printf("  %-34s delete %5lldms  release %3lldms  (freed in background after %lldms)\n", name, sync,
+           async, background);
+}
+
+int main(int argc, char **argv) {
+    tracked::mainThread = std::this_thread::get_id();
+
+    printf("Cheap objects are freed on the spot: "); {
+        LAZYFREE::release(new tracked());
+        assert(tracked::destroyed == 1 && tracked::onMain);
+        LAZYFREE::release(new SDS("short"));
+        auto *d = new DICT<long, long>();
+        for (long i = 0; i < LAZYFREE_THRESHOLD; ++i)
+            d->add(i, i);
+        LAZYFREE::release(d);
+        assert(LAZYFREE::freed() == 0 && LAZYFREE::pending() == 0);
+        ok();
+    }
+
+    printf("Large objects are freed in the background: "); {
+        auto *d = new DICT<long, long>();
+        for (long i = 0; i < 1000; ++i)
+            d->add(i, i);
+        LAZYFREE::release(d);
+        auto *sl = new SKIPLIST<long, long>();
+        for (long i = 0; i < 1000; ++i)
+            sl->insert(i, i);
+        LAZYFREE::release(sl);
+        auto *is = new INTSET();
+        for (long i = 0; i < 100000; ++i)
+            is->add(i);
+        LAZYFREE::release(is);
+        auto *s = new SDS();
+        s->growzero(1 << 20);
+        LAZYFREE::release(s);
+        LAZYFREE::releaseAsync(new tracked());
+        LAZYFREE::drain();
+        assert(LAZYFREE::freed() == 5 && LAZYFREE::pending() == 0);
+        assert(tracked::destroyed == 2 && !tracked::onMain);
+        ok();
+    }
+
+    printf("Concurrent producers: "); {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t)
+            threads.emplace_back([]() {
+                for (int i = 0; i < 10000; ++i)
+                    LAZYFREE::releaseAsync(new tracked());
+            });
+        for (auto &th : threads)
+            th.join();
+        LAZYFREE::drain();
+        assert(tracked::destroyed == 40002 && LAZYFREE::pending() == 0);
+        ok();
+    }
+
+    long n = (argc > 1) ? atol(argv[1]) : 10000000;
+    printf("Freeing %ld element collections:\n", n);
+    bench<DICT<long, long>>("DICT<long, long>", [n](DICT<long, long> &d) {
+        for (long i = 0; i < n; ++i)
+            d.add(i, i);
+    });
+    bench<DICT<SDS, long>>("DICT<SDS, long>", [n](DICT<SDS, long> &d) {
+        for (long i = 0; i < n / 2; ++i)
+            d.add(SDS((long long)i), i);
+    });
+    bench<SKIPLIST<long, long>>("SKIPLIST<long, long>", [n](SKIPLIST<long, long> &sl) {
+        for (long i = 0; i < n / 2; ++i)
+            sl.insert(i, i);
+    });
+
+    printf("Producers racing with shutdown: "); {
+        int before = tracked::destroyed;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t)
+            threads.emplace_back([]() {
+                for (int i = 0; i < 10000; ++i)
+                    LAZYFREE::releaseAsync(new tracked());
+            });
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        LAZYFREE::shutdown();
+        for (auto &th : threads)
+            th.join();
+        assert(tracked::destroyed == before + 40000 && LAZYFREE::pending() == 0);
+        ok();
+    }
+
+    printf("Synchronous after shutdown: "); {
+        LAZYFREE::shutdown();
+        int before = tracked::destroyed;
+        LAZYFREE::releaseAsync(new tracked());
+        assert(tracked::destroyed == before + 1 && tracked::onMain);
+        ok();
+    }
+
+    return 0;
+}
+#endif
@@ -0,0 +1,110 @@
+#ifndef BOMENG_REDIS_LAZYFREE_H
+#define BOMENG_REDIS_LAZYFREE_H
+
+#include "sds.h"
+#include "intset.h"
+#include "dict.h"
+#include "skiplist.h"
+#include "bskiplist.h"
+#include <cstddef>
+
+/* Objects that cost more than this to free go to the background thread,
+ * as Redis LAZYFREE_THRESHOLD */
+#define LAZYFREE_THRESHOLD 64
+/* Flat buffers (SDS, INTSET) cost one unit per that many bytes */
+#define LAZYFREE_BYTES_PER_EFFORT 4096
+
+namespace bRedis
+{
+
+    /* Cost of freeing an object: the number of allocations to release for
+     * collections, the size for flat buffers. Anything else costs 1. */
+    template <typename T>
+    size_t lazyfreeEffort(const T &)
+    {
+        return 1;
+    }
+
+    template <typename K, typename V, typename Hash, typename KeyEqual, bool CacheHash, typename Alloc>
+    size_t lazyfreeEffort(const DICT<K, V, Hash, KeyEqual, CacheHash, Alloc> &d)
+    {
+        return d.size();
+    }
+
+    template <typename K, typename V, typename Cmp, typename Policy>
+    size_t lazyfreeEffort(const SKIPLIST<K, V, Cmp, Policy> &sl)
+    {
+        return sl.size();
+    }
+
+    template <typename K, typename V, typename Cmp, size_t BlockSize, typename Prefix, typename Policy>
+    size_t lazyfreeEffort(const BSKIPLIST<K, V, Cmp, BlockSize, Prefix, Policy> &bsl)
+    {
+        return bsl.size() / BlockSize + 1;
+    }
+
+    inline size_t lazyfreeEffort(const INTSET &is)
+    {
+        return is.bloLen() / LAZYFREE_BYTES_PER_EFFORT + 1;
+    }
+
+    inline size_t lazyfreeEffort(const SDS &s)
+    {
+        return (s.len() + s.vail()) / LAZYFREE_BYTES_PER_EFFORT + 1;
+    }
+
+    /* UNLINK style freeing, as Redis lazyfree.c.
+     *
+     * Destroying a collection of millions of elements takes hundreds of
+     * milliseconds. release() hands such objects to a background thread
+     * through a lock-free queue and returns at once; cheap objects are
+     * deleted on the spot, since queueing them would cost more than
+     * freeing them. The thread is started by the first queued object and
+     * sleeps while the queue is empty.
+     *
+     * The objects must not be shared with other threads any more: the
+     * background thread runs their destructors. shutdown() stops the
+     * thread once the queue is empty. After it, or if the thread could
+     * not be started, everything is freed synchronously. */
+    class LAZYFREE
+    {
+    public:
+        /* Delete obj, in the background if lazyfreeEffort(*obj) is above
+         * LAZYFREE_THRESHOLD */
+        template <typename T>
+        static void release(T *obj)
+        {
+            if (obj == nullptr)
+                return;
+            if (lazyfreeEffort(*obj) > LAZYFREE_THRESHOLD)
+                releaseAsync(obj);
+            else
+                delete obj;
+        }
+
+        /* Delete obj in the background, whatever its size */
+        template <typename T>
+        static void releaseAsync(T *obj)
+        {
+            if (obj)
+                enqueue(obj, [](void *p) { delete (T *)p; });
+        }
+
+        static void enqueue(void *p, void (*deleter)(void *));
+
+        /* Objects queued and not freed yet */
+        static size_t pending();
+        /* Objects freed by the background thread so far */
+        static size_t freed();
+
+        /* Wait until the queue is empty */
+        static void drain();
+
+        /* Free what is queued, stop the thread, and free synchronously from
+         * then on */
+        static void shutdown();
+    };
+
+} // namespace bRedis
+
+#endif
@@ -0,0 +1,610 @@
+#include "object.h"
+#include <stdlib.h>
+#include <cstring>
+#include <cstddef>
+#include <climits>
+#include <new>
+#include <stdexcept>
+
+using namespace bRedis;
+
+namespace
+{
+    /* Parse s as a long long, as Redis string2ll: only what ll2string()
+     * would print back identically is accepted, so converting to INT and
+     * back never changes the string. */
+    bool string2ll(const char *s, size_t slen, long long *value)
+    {
+        const char *p = s;
+        size_t plen = 0;
+        bool negative = false;
+        unsigned long long v;
+
+        if (slen == 0 || slen >= OBJ_LLSTR_SIZE)
+            return false;
+        if (slen == 1 && p[0] == '0')
+        {
+            *value = 0;
+            return true;
+        }
+        if (p[0] == '-')
+        {
+            negative = true;
+            p++;
+            plen++;
+            if (plen == slen)
+                return false;
+        }
+        /* First digit 1-9: no leading zeros */
+        if (p[0] < '1' || p[0] > '9')
+            return false;
+        v = p[0] - '0';
+        p++;
+        plen++;
+
+        while (plen < slen && p[0] >= '0' && p[0] <= '9')
+        {
+            if (v > ULLONG_MAX / 10)
+                return false;
+            v *= 10;
+            if (v > ULLONG_MAX - (p[0] - '0'))
+                return false;
+            v += p[0] - '0';
+            p++;
+            plen++;
+        }
+        if (plen < slen)
+            return false;
+
+        if (negative)
+        {
+            if (v > ((unsigned long long)(-(LLONG_MIN + 1)) + 1))
+                return false;
+            *value = v == ((unsigned long long)(-(LLONG_MIN + 1)) + 1) ? LLONG_MIN : -(long long)v;
+        }
+        else
+        {
+            if (v > LLONG_MAX)
+                return false;
+            *value = v;
+        }
+        return true;
+    }
+
+    /* Write value in decimal and its nul to s, return the length. Two
+     * digits at a time, as Redis ll2string(). */
+    size_t ll2string(char *s, long long value)
+    {
+        static const char digits[201] =
+            "0001020304050607080910111213141516171819"
+            "2021222324252627282930313233343536373839"
+            "4041424344454647484950515253545556575859"
+            "6061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+        char tmp[OBJ_LLSTR_SIZE];
+        char *p = tmp + sizeof(tmp);
+        unsigned long long v = value < 0 ? 0ULL - (unsigned long long)value : value;
+
+        while (v >= 100)
+        {
+            int i = (v % 100) * 2;
+            v /= 100;
+            *--p = digits[i + 1];
+            *--p = digits[i];
+        }
+        if (v < 10)
+            *--p = '0' + v;
+        else
+        {
+            *--p = digits[v * 2 + 1];
+            *--p = digits[v * 2];
+        }
+        if (value < 0)
+            *--p = '-';
+
+        size_t len = tmp + sizeof(tmp) - p;
+        memcpy(s, p, len);
+        s[len] = '\0';
+        return len;
+    }
+
+    bool tryParse(const char *s, size_t len, long long *value)
+    {
+        return len < OBJ_LLSTR_SIZE && string2ll(s, len, value);
+    }
+}
+
+bool OBJECT::tagged(const robj *o)
+{
+    return (uintptr_t)o & 1;
+}
+
+long long OBJECT::untag(const robj *o)
+{
+    return (intptr_t)o >> 1;
+}
+
+OBJECT::robj *OBJECT::createInt(long long value)
+{
+    if (value >= OBJ_TAGGED_INT_MIN && value <= OBJ_TAGGED_INT_MAX)
+        return (robj *)(((uintptr_t)value << 1) | 1);
+
+    robj *o = (robj *)malloc(sizeof(robj));
+    if (o == nullptr)
+        throw std::runtime_error("Failed to allocate memory");
+    o->refcount = 1;
+    o->encoding = ENCODING_INT;
+    o->ival = value;
+    return o;
+}
+
+OBJECT::robj *OBJECT::createEmbstr(const char *s, size_t len)
+{
+    robj *o = (robj *)malloc(offsetof(robj, buf) + len + 1);
+    if (o == nullptr)
+        throw std::runtime_error("Failed to allocate memory");
+    o->refcount = 1;
+    o->encoding = ENCODING_EMBSTR;
+    o->len = len;
+    memcpy(o->buf, s, len);
+    o->buf[len] = '\0';
+    return o;
+}
+
+OBJECT::robj *OBJECT::createRaw(SDS &&s)
+{
+    robj *o = (robj *)malloc(sizeof(robj));
+    if (o == nullptr)
+        throw std::runtime_error("Failed to allocate memory");
+    o->refcount = 1;
+    o->encoding = ENCODING_RAW;
+    new (o->sds) SDS(std::move(s));
+    return o;
+}
+
+void OBJECT::incrRefCount(robj *o)
+{
+    if (!tagged(o) && o->refcount != OBJ_SHARED_REFCOUNT)
+        o->refcount++;
+}
+
+void OBJECT::decrRefCount(robj *o)
+{
+    if (o == nullptr || tagged(o) || o->refcount == OBJ_SHARED_REFCOUNT)
+        return;
+    if (--o->refcount > 0)
+        return;
+    if (o->encoding == ENCODING_RAW)
+        std::launder(reinterpret_cast<SDS *>(o->sds))->~SDS();
+    free(o);
+}
+
+SDS &OBJECT::raw()
+{
+    return *std::launder(reinterpret_cast<SDS *>(o_->sds));
+}
+
+const SDS &OBJECT::raw() const
+{
+    return *std::launder(reinterpret_cast<const SDS *>(o_->sds));
+}
+
+/* Make o_ a RAW object of our own, as Redis dbUnshareStringValue() */
+void OBJECT::unshareRaw()
+{
+    if (!tagged(o_) && o_->encoding == ENCODING_RAW && o_->refcount == 1)
+        return;
+    robj *o = createRaw(decoded());
+    decrRefCount(o_);
+    o_ = o;
+}
+
+OBJECT::OBJECT()
+    : o_(nullptr)
+{
+    static robj empty = []() {
+        robj o;
+        o.refcount = OBJ_SHARED_REFCOUNT;
+        o.encoding = ENCODING_EMBSTR;
+        o.len = 0;
+        o.buf[0] = '\0';
+        return o;
+    }();
+    o_ = &empty;
+}
+
+OBJECT::OBJECT(const void *s, size_t len)
+    : o_(nullptr)
+{
+    long long value;
+    if (tryParse((const char *)s, len, &value))
+        o_ = createInt(value);
+    else if (len <= OBJ_ENCODING_EMBSTR_SIZE_LIMIT)
+        o_ = createEmbstr((const char *)s, len);
+    else
+        o_ = createRaw(SDS(s, len));
+}
+
+OBJECT::OBJECT(const char *s)
+    : OBJECT(s, strlen(s))
+{
+}
+
+OBJECT::OBJECT(long long value)
+    : o_(createInt(value))
+{
+}
+
+OBJECT::OBJECT(SDS s)
+    : o_(nullptr)
+{
+    long long value;
+    if (tryParse(s.buf(), s.len(), &value))
+        o_ = createInt(value);
+    else if (s.len() <= OBJ_ENCODING_EMBSTR_SIZE_LIMIT)
+        o_ = createEmbstr(s.buf(), s.len());
+    else
+    {
+        /* Do not keep more than 10% of free space, as Redis
+         * trimStringObjectIfNeeded() */
+        if (s.vail() > s.len() / 10)
+            s.RemoveFreeSpace();
+        o_ = createRaw(std::move(s));
+    }
+}
+
+OBJECT::OBJECT(const OBJECT &o)
+    : o_(o.o_)
+{
+    incrRefCount(o_);
+}
+
+OBJECT &OBJECT::operator=(const OBJECT &o)
+{
+    incrRefCount(o.o_);
+    decrRefCount(o_);
+    o_ = o.o_;
+    return *this;
+}
+
+OBJECT::OBJECT(OBJECT &&o)
+    : o_(o.o_)
+{
+    o.o_ = OBJECT().o_;
+}
+
+OBJECT &OBJECT::operator=(OBJECT &&o)
+{
+    std::swap(o_, o.o_);
+    return *this;
+}
+
+OBJECT::~OBJECT()
+{
+    decrRefCount(o_);
+}
+
+OBJECT::encoding_t OBJECT::encoding() const
+{
+    return tagged(o_) ? ENCODING_INT : (encoding_t)o_->encoding;
+}
+
+int32_t OBJECT::refcount() const
+{
+    return tagged(o_) ? OBJ_SHARED_REFCOUNT : o_->refcount;
+}
+
+bool OBJECT::shared() const
+{
+    return refcount() == OBJ_SHARED_REFCOUNT;
+}
+
+size_t OBJECT::len() const
+{
+    if (tagged(o_))
+    {
+        char llbuf[OBJ_LLSTR_SIZE];
+        return ll2string(llbuf, untag(o_));
+    }
+    switch (o_->encoding)
+    {
+    case ENCODING_INT:
+    {
+        char llbuf[OBJ_LLSTR_SIZE];
+        return ll2string(llbuf, o_->ival);
+    }
+    case ENCODING_EMBSTR:
+        return o_->len;
+    default:
+        return raw().len();
+    }
+}
+
+const char *OBJECT::ptr(char (&llbuf)[OBJ_LLSTR_SIZE], size_t *len) const
+{
+    if (tagged(o_))
+    {
+        *len = ll2string(llbuf, untag(o_));
+        return llbuf;
+    }
+    switch (o_->encoding)
+    {
+    case ENCODING_INT:
+        *len = ll2string(llbuf, o_->ival);
+        return llbuf;
+    case ENCODING_EMBSTR:
+        *len = o_->len;
+        return o_->buf;
+    default:
+        *len = raw().len();
+        return raw().buf();
+    }
+}
+
+SDS OBJECT::decoded() const
+{
+    char llbuf[OBJ_LLSTR_SIZE];
+    size_t len;
+    const char *s = ptr(llbuf, &len);
+    return SDS(s, len);
+}
+
+std::tuple<bool, long long> OBJECT::toLongLong() const
+{
+    if (tagged(o_))
+        return {true, untag(o_)};
+    if (o_->encoding == ENCODING_INT)
+        return {true, o_->ival};
+
+    long long value;
+    char llbuf[OBJ_LLSTR_SIZE];
+    size_t len;
+    const char *s = ptr(llbuf, &len);
+    if (tryParse(s, len, &value))
+        return {true, value};
+    return {false, 0};
+}
+
+int OBJECT::cmp(const OBJECT &o) const
+{
+    char buf1[OBJ_LLSTR_SIZE], buf2[OBJ_LLSTR_SIZE];
+    size_t l1, l2;
+    const char *s1 = ptr(buf1, &l1), *s2 = o.ptr(buf2, &l2);
+    int cmp = memcmp(s1, s2, l1 < l2 ? l1 : l2);
+    if (cmp == 0)
+        return l1 < l2 ? -1 : (l1 > l2);
+    return cmp;
+}
+
+void OBJECT::append(const void *t, size_t len)
+{
+    unshareRaw();
+    raw().cat(t, len);
+}
+
+bool OBJECT::incrBy(long long incr)
+{
+    auto [isInt, value] = toLongLong();
+    if (!isInt)
+        return false;
+    if ((incr < 0 && value < 0 && incr < (LLONG_MIN - value)) ||
+        (incr > 0 && value > 0 && incr > (LLONG_MAX - value)))
+        return false;
+    value += incr;
+
+    /* Update in place an INT object of our own that stays out of the
+     * tagged range, as Redis incrDecrCommand() */
+    if (!tagged(o_) && o_->encoding == ENCODING_INT && o_->refcount == 1 &&
+        (value < OBJ_TAGGED_INT_MIN || value > OBJ_TAGGED_INT_MAX))
+    {
+        o_->ival = value;
+        return true;
+    }
+    robj *o = createInt(value);
+    decrRefCount(o_);
+    o_ = o;
+    return true;
+}
+
+#ifdef OBJECT_TEST_MAIN
+#include "dict.h"
+#include <string>
+#include <chrono>
+#include <cassert>
+#include <cstdio>
+#include <malloc.h>
+
+size_t heapBytes(void)
+{
+    return mallinfo2().uordblks;
+}
+
+void ok(void)
+{
+    printf("OK\n");
+}
+
+bool equals(const OBJECT &o, const char *s)
+{
+    char llbuf[OBJ_LLSTR_SIZE];
+    size_t len;
+    const char *p = o.ptr(llbuf, &len);
+    return len == strlen(s) && memcmp(p, s, len) == 0;
+}
+
+/* Fill a keyspace of n keys with values written by gen(i, buf), as SET
+ * would, then GET every key, copying the value to a reply buffer, then
+ * SET them all again. Print bytes per key (keys, values and buckets) and
+ * operations per second. */
+template <typename V, typename Gen>
+void bench(const char *name, const char *valueName, long n, Gen gen)
+{
+    typedef DICT<SDS, V> keyspace;
+    std::vector<SDS> keys;
+    keys.reserve(n);
+    for (long i = 0; i < n; ++i)
+        keys.emplace_back((long long)(i * 2654435761UL % 1000000007));
+
+    size_t before = heapBytes();
+    keyspace *d = new keyspace();
+    char buf[256], reply[256];
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; ++i)
+    {
+        size_t len = gen(i, buf);
+        d->replace(keys[i], V(buf, len));
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    size_t bytes = heapBytes() - before;
+
+    size_t total = 0;
+    for (long i = 0; i < n; ++i)
+    {
+        auto *he = d->find(keys[(i * 7919) % n]);
+        if constexpr (std::is_same<V, OBJECT>::value)
+        {
+            char llbuf[OBJ_LLSTR_SIZE];
+            size_t len;
+            const char *p = he->val.ptr(llbuf, &len);
+            memcpy(reply, p, len);
+            total += len + (reply[0] == 0);
+        }
+        else
+        {
+            memcpy(reply, he->val.buf(), he->val.len());
+            total += he->val.len() + (reply[0] == 0);
+        }
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    assert(total >= (size_t)n);
+
+    for (long i = 0; i < n; ++i)
+    {
+        long j = (i * 7919) % n;
+        size_t len = gen(j + 1, buf);
+        d->replace(keys[j], V(buf, len));
+    }
+    auto t3 = std::chrono::steady_clock::now();
+
+    auto mops = [n](std::chrono::steady_clock::duration d) {
+        return n / (std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / 1e3);
+    };
+    printf("  %-16s %-7s %6.1f bytes/key  SET(new) %5.2fM/s  GET %5.2fM/s  SET(overwrite) %5.2fM/s\n",
+           valueName, name, (double)bytes / n, mops(t1 - t0), mops(t2 - t1), mops(t3 - t2));
+    delete d;
+}
+
+template <typename Gen>
+void benchBoth(const char *valueName, long n, Gen gen)
+{
+    bench<SDS>("SDS", valueName, n, gen);
+    bench<OBJECT>("OBJECT", valueName, n, gen);
+}
+
+int main(int argc, char **argv)
+{
+    printf("Encodings chosen at creation: "); {
+        OBJECT empty;
+        assert(empty.encoding() == OBJECT::ENCODING_EMBSTR && empty.shared() && empty.len() == 0);
+        OBJECT small("1234"), big("-9223372036854775808"), str("hello");
+        assert(small.encoding() == OBJECT::ENCODING_INT && small.shared() && equals(small, "1234"));
+        assert(big.encoding() == OBJECT::ENCODING_INT && !big.shared() && big.refcount() == 1 &&
+               equals(big, "-9223372036854775808") && std::get<1>(big.toLongLong()) == LLONG_MIN);
+        assert(str.encoding() == OBJECT::ENCODING_EMBSTR && equals(str, "hello"));
+        /* Not printed back identically: kept as strings */
+        for (const char *s : {"01", "-0", " 1", "1 ", "+1", "-", "9223372036854775808", "1.5"})
+            assert(OBJECT(s).encoding() == OBJECT::ENCODING_EMBSTR && equals(OBJECT(s), s));
+        std::string s44(OBJ_ENCODING_EMBSTR_SIZE_LIMIT, 'x'), s45(OBJ_ENCODING_EMBSTR_SIZE_LIMIT + 1, 'x');
+        assert(OBJECT(s44.c_str()).encoding() == OBJECT::ENCODING_EMBSTR);
+        assert(OBJECT(s45.c_str()).encoding() == OBJECT::ENCODING_RAW && equals(OBJECT(s45.c_str()), s45.c_str()));
+        assert(OBJECT(SDS("42")).encoding() == OBJECT::ENCODING_INT);
+        assert(OBJECT(42LL).shared() && OBJECT(-42LL).encoding() == OBJECT::ENCODING_INT);
+        assert(std::get<1>(OBJECT("-17").toLongLong()) == -17 && !std::get<0>(OBJECT("x").toLongLong()));
+        assert(OBJECT("abc").cmp(OBJECT("abd")) < 0 && OBJECT("12").cmp(OBJECT("12")) == 0 &&
+               OBJECT("123").cmp(OBJECT("12")) > 0);
+
+        OBJECT lo(OBJ_TAGGED_INT_MIN), hi(OBJ_TAGGED_INT_MAX), past(OBJ_TAGGED_INT_MAX + 1);
+        assert(lo.shared() && hi.shared() && !past.shared() && past.encoding() == OBJECT::ENCODING_INT);
+        assert(std::get<1>(lo.toLongLong()) == OBJ_TAGGED_INT_MIN && equals(hi, "4611686018427387903") &&
+               equals(past, "4611686018427387904") && lo.len() == 20);
+
+        /* Tagged integers allocate nothing */
+        std::vector<OBJECT> v;
+        v.reserve(20000);
+        size_t before = heapBytes();
+        for (long long i = 0; i < 10000; ++i)
+        {
+            v.emplace_back(std::to_string(i * 1000003 - 5000000000LL).c_str());
+            v.emplace_back(v.back());
+        }
+        assert(heapBytes() == before);
+        ok();
+    }
+
+    printf("Conversions on mutation, copy on write: "); {
+        OBJECT a("10");
+        assert(a.incrBy(5) && a.shared() && equals(a, "15"));
+        assert(a.incrBy(100000) && a.shared() && equals(a, "100015"));
+        OBJECT b = a;
+        assert(b.incrBy(1) && equals(a, "100015") && equals(b, "100016"));
+        assert(!a.incrBy(LLONG_MAX) && equals(a, "100015"));
+
+        /* Out of the tagged range: an object, updated in place while not
+         * shared */
+        OBJECT m(OBJ_TAGGED_INT_MAX);
+        assert(m.incrBy(1) && !m.shared() && m.refcount() == 1 && m.incrBy(1) && equals(m, "4611686018427387905"));
+        OBJECT m2 = m;
+        assert(m.refcount() == 2 && m2.incrBy(1) && equals(m, "4611686018427387905") &&
+               equals(m2, "4611686018427387906"));
+        assert(m.refcount() == 1 && m2.refcount() == 1);
+        assert(m.incrBy(-2) && m.shared() && equals(m, "4611686018427387903"));
+
+        a.append("x", 1);
+        assert(a.encoding() == OBJECT::ENCODING_RAW && equals(a, "100015x") && !a.incrBy(1));
+        OBJECT c("12"), d("ab");
+        assert(c.incrBy(1) && c.encoding() == OBJECT::ENCODING_INT);
+        d.append("cd", 2);
+        assert(d.encoding() == OBJECT::ENCODING_RAW && equals(d, "abcd"));
+        OBJECT e = d;
+        e.append("e", 1);
+        assert(equals(d, "abcd") && equals(e, "abcde"));
+
+        /* A string holding an integer becomes INT */
+        OBJECT f(SDS("00"));
+        f.append("7", 1);
+        assert(!f.incrBy(1));
+        OBJECT g("9");
+        g.append("9", 1);
+        assert(g.encoding() == OBJECT::ENCODING_RAW && g.incrBy(1) && g.encoding() == OBJECT::ENCODING_INT &&
+               equals(g, "100"));
+
+        OBJECT h(std::move(e));
+        assert(equals(h, "abcde") && e.len() == 0);
+        e = std::move(h);
+        assert(equals(e, "abcde"));
+        ok();
+    }
+
+    long n = (argc > 1) ? atol(argv[1]) : 2000000;
+    printf("%ld keys:\n", n);
+    benchBoth("int 0-9999", n, [](long i, char *buf) {
+        return (size_t)snprintf(buf, 256, "%ld", (i * 48271) % 10000);
+    });
+    benchBoth("int 10^9", n, [](long i, char *buf) {
+        return (size_t)snprintf(buf, 256, "%ld", 1000000000 + i * 48271);
+    });
+    for (size_t len : {8, 16, 40, 100})
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%zu byte string", len);
+        benchBoth(name, n, [len](long i, char *buf) {
+            for (size_t j = 0; j < len; ++j)
+                buf[j] = 'a' + (i + j) % 26;
+            return len;
+        });
+    }
+
+    return 0;
+}
+#endif
@@ -0,0 +1,126 @@
+#ifndef BOMENG_REDIS_OBJECT_H
+#define BOMENG_REDIS_OBJECT_H
+
+#include "sds.h"
+#include <stdint.h>
+#include <tuple>
+#include <cstddef>
+
+/* Strings up to that length are embedded in their object, as Redis */
+#define OBJ_ENCODING_EMBSTR_SIZE_LIMIT 44
+/* Integers in that range are stored in the pointer of their OBJECT */
+#define OBJ_TAGGED_INT_MIN (-(1LL << 62))
+#define OBJ_TAGGED_INT_MAX ((1LL << 62) - 1)
+/* Refcount of shared objects, which are never freed */
+#define OBJ_SHARED_REFCOUNT INT32_MAX
+/* Room for a long long in decimal, with its sign and nul */
+#define OBJ_LLSTR_SIZE 21
+
+namespace bRedis
+{
+
+    /* A string value, in the most compact of three encodings, as Redis
+     * robj:
+     *
+     * INT     a decimal integer without leading zeros or spaces, with no
+     *         string allocated. Between OBJ_TAGGED_INT_MIN and
+     *         OBJ_TAGGED_INT_MAX it is stored in the object pointer itself,
+     *         shifted left with the low bit set, and allocates nothing at
+     *         all: such an OBJECT is shared. Other integers take an object
+     *         holding the value.
+     * EMBSTR  up to OBJ_ENCODING_EMBSTR_SIZE_LIMIT bytes, stored right
+     *         after the header of the object, in the same allocation.
+     * RAW     an SDS of its own.
+     *
+     * The encoding is chosen at creation. Mutations convert it: append()
+     * turns any encoding into RAW, incrBy() turns a string holding an
+     * integer into INT.
+     *
+     * Objects are reference counted: copying an OBJECT shares it, and a
+     * mutation first gives the OBJECT a private copy if it is shared (copy
+     * on write). Reference counts are not atomic: an object and its copies
+     * belong to one thread. */
+    class OBJECT
+    {
+    public:
+        enum encoding_t : uint8_t
+        {
+            ENCODING_INT,
+            ENCODING_EMBSTR,
+            ENCODING_RAW
+        };
+
+    private:
+        struct robj
+        {
+            int32_t refcount;
+            uint8_t encoding;
+            /* EMBSTR: length of the string */
+            uint8_t len;
+            /* INT out of the tagged range: the value. RAW: an SDS.
+             * EMBSTR: the string and its nul, running past the end of the
+             * struct. */
+            union
+            {
+                long long ival;
+                alignas(SDS) char sds[sizeof(SDS)];
+                char buf[1];
+            };
+        };
+
+    private:
+        /* An object, or a tagged integer when the low bit is set */
+        robj *o_;
+
+    private:
+        static bool tagged(const robj *o);
+        static long long untag(const robj *o);
+        static robj *createInt(long long value);
+        static robj *createEmbstr(const char *s, size_t len);
+        static robj *createRaw(SDS &&s);
+        static void incrRefCount(robj *o);
+        static void decrRefCount(robj *o);
+        SDS &raw();
+        const SDS &raw() const;
+        void unshareRaw();
+
+    public:
+        /* The empty string */
+        OBJECT();
+        OBJECT(const void *s, size_t len);
+        explicit OBJECT(const char *s);
+        explicit OBJECT(long long value);
+        explicit OBJECT(SDS s);
+
+        OBJECT(const OBJECT &o);
+        OBJECT &operator=(const OBJECT &o);
+        OBJECT(OBJECT &&o);
+        OBJECT &operator=(OBJECT &&o);
+
+        ~OBJECT();
+
+    public:
+        encoding_t encoding() const;
+        int32_t refcount() const;
+        bool shared() const;
+
+        /* Length of the string, of the decimal form for INT */
+        size_t len() const;
+        /* The string and its length, written to llbuf for INT */
+        const char *ptr(char (&llbuf)[OBJ_LLSTR_SIZE], size_t *len) const;
+        SDS decoded() const;
+        std::tuple<bool, long long> toLongLong() const;
+        /* Binary comparison of the strings, as SDS::cmp */
+        int cmp(const OBJECT &o) const;
+
+    public:
+        /* As Redis APPEND: the object becomes RAW */
+        void append(const void *t, size_t len);
+        /* As Redis INCRBY: return false if the string is not an integer or
+         * the result overflows. The object becomes INT. */
+        bool incrBy(long long incr);
+    };
+
+} // namespace bRedis
+
+#endif
@@ -0,0 +1,710 @@
+#include "quicklist.h"
+#include <stdlib.h>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+
+using namespace bRedis;
+
+namespace
+{
+    /* Byte limits of the negative fills */
+    const size_t optimizationLevel[] = {4096, 8192, 16384, 32768, 65536};
+
+    /* LZF: a sequence of literal runs and back references.
+     *
+     * 000LLLLL <L + 1 bytes>            literal run of 1 to 32 bytes
+     * LLLooooo oooooooo                 copy L + 2 bytes from o + 1 back
+     * 111ooooo LLLLLLLL oooooooo        copy L + 9 bytes from o + 1 back
+     *
+     * References reach 8KB back and copy 3 to 264 bytes. */
+    const size_t LZF_HLOG = 14;
+    const size_t LZF_MAX_OFF = 1 << 13;
+    const size_t LZF_MAX_REF = (1 << 8) + (1 << 3);
+    const size_t LZF_MAX_LIT = 1 << 5;
+
+    inline uint32_t _lzfHash(const unsigned char *p, size_t hlog)
+    {
+        uint32_t v = p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+        return (v * 2654435761u) >> (32 - hlog);
+    }
+
+    /* Compress in to out. Return the compressed size, or 0 if it does
+     * not fit in outLen. */
+    size_t _lzfCompress(const unsigned char *in, size_t inLen, unsigned char *out, size_t outLen)
+    {
+        /* Position + 1 of the last occurrence of each hashed 3 bytes. The
+         * table is kept across calls, and only as many slots as the input
+         * has bytes, up to 1 << LZF_HLOG, are used and cleared. */
+        thread_local uint32_t htab[1 << LZF_HLOG];
+        size_t hlog = 8;
+        while (hlog < LZF_HLOG && ((size_t)1 << hlog) < inLen)
+            hlog++;
+        memset(htab, 0, sizeof(uint32_t) << hlog);
+        size_t ip = 0, op = 0, lit = 0;
+
+        /* Room for the control byte of the current literal run */
+        if (outLen == 0)
+            return 0;
+        op++;
+
+        while (ip < inLen)
+        {
+            size_t ref = 0;
+            if (ip + 2 < inLen)
+            {
+                uint32_t h = _lzfHash(in + ip, hlog);
+                ref = htab[h];
+                htab[h] = ip + 1;
+            }
+
+            if (ref && ip - ref < LZF_MAX_OFF && in[ref - 1] == in[ip] && in[ref] == in[ip + 1] &&
+                in[ref + 1] == in[ip + 2])
+            {
+                ref--;
+                size_t off = ip - ref - 1;
+                size_t maxLen = inLen - ip < LZF_MAX_REF ? inLen - ip : LZF_MAX_REF;
+                size_t len = 3;
+                while (len < maxLen && in[ref + len] == in[ip + len])
+                    len++;
+
+                /* Close the literal run, or take back its control byte */
+                if (lit)
+                    out[op - lit - 1] = lit - 1;
+                else
+                    op--;
+                if (op + 3 + 1 > outLen)
+                    return 0;
+
+                size_t l = len - 2;
+                if (l < 7)
+                    out[op++] = (l << 5) | (off >> 8);
+                else
+                {
+                    out[op++] = (7 << 5) | (off >> 8);
+                    out[op++] = l - 7;
+                }
+                out[op++] = off & 0xff;
+
+                /* Hash the positions inside the match too */
+                for (size_t k = 1; k < len && ip + k + 2 < inLen; ++k)
+                    htab[_lzfHash(in + ip + k, hlog)] = ip + k + 1;
+                ip += len;
+                lit = 0;
+                op++;
+            }
+            else
+            {
+                if (op >= outLen)
+                    return 0;
+                out[op++] = in[ip++];
+                if (++lit == LZF_MAX_LIT)
+                {
+                    out[op - lit - 1] = lit - 1;
+                    lit = 0;
+                    op++;
+                }
+            }
+        }
+
+        if (lit)
+            out[op - lit - 1] = lit - 1;
+        else
+            op--;
+        return op <= outLen ? op : 0;
+    }
+
+    /* Decompress in to out, of exactly outLen bytes. Return false on
+     * corrupt input. */
+    bool _lzfDecompress(const unsigned char *in, size_t inLen, unsigned char *out, size_t outLen)
+    {
+        size_t ip = 0, op = 0;
+        while (ip < inLen)
+        {
+            size_t ctrl = in[ip++];
+            if (ctrl < LZF_MAX_LIT)
+            {
+                ctrl++;
+                if (op + ctrl > outLen || ip + ctrl > inLen)
+                    return false;
+                memcpy(out + op, in + ip, ctrl);
+                op += ctrl;
+                ip += ctrl;
+                continue;
+            }
+
+            size_t len = ctrl >> 5;
+            if (len == 7)
+            {
+                if (ip >= inLen)
+                    return false;
+                len += in[ip++];
+            }
+            len += 2;
+            if (ip >= inLen)
+                return false;
+            size_t back = ((ctrl & 0x1f) << 8) + in[ip++] + 1;
+            if (back > op || op + len > outLen)
+                return false;
+            /* The reference may overlap what it writes */
+            for (size_t i = 0; i < len; ++i, ++op)
+                out[op] = out[op - back];
+        }
+        return op == outLen;
+    }
+}
+
+QUICKLIST::quicklistNode *QUICKLIST::createNode()
+{
+    quicklistNode *node = new quicklistNode();
+    node->zl = new ZIPLIST();
+    node->bytes = node->zl->bytes();
+    return node;
+}
+
+void QUICKLIST::freeNode(quicklistNode *node)
+{
+    delete node->zl;
+    free(node->lzf);
+    delete node;
+}
+
+QUICKLIST::quicklistNode *QUICKLIST::copyNode(const quicklistNode *node)
+{
+    quicklistNode *copy = new quicklistNode(*node);
+    copy->prev = copy->next = nullptr;
+    if (node->zl)
+        copy->zl = new ZIPLIST(*node->zl);
+    else
+    {
+        copy->lzf = (unsigned char *)malloc(node->lzfBytes);
+        if (copy->lzf == nullptr)
+        {
+            delete copy;
+            throw std::runtime_error("Failed to allocate memory");
+        }
+        memcpy(copy->lzf, node->lzf, node->lzfBytes);
+    }
+    return copy;
+}
+
+/* Compress a plain node, unless it is small or does not compress */
+void QUICKLIST::compressNode(quicklistNode *node)
+{
+    if (node->zl == nullptr || node->bytes < QUICKLIST_MIN_COMPRESS_BYTES)
+        return;
+
+    size_t max = node->bytes - QUICKLIST_MIN_COMPRESS_IMPROVE;
+    unsigned char *lzf = (unsigned char *)malloc(max);
+    if (lzf == nullptr)
+        throw std::runtime_error("Failed to allocate memory");
+    size_t size = _lzfCompress(node->zl->data(), node->bytes, lzf, max);
+    if (size == 0)
+    {
+        free(lzf);
+        return;
+    }
+
+    /* Give back the unused end of the buffer */
+    unsigned char *shrunk = (unsigned char *)realloc(lzf, size);
+    node->lzf = shrunk ? shrunk : lzf;
+    node->lzfBytes = size;
+    delete node->zl;
+    node->zl = nullptr;
+}
+
+void QUICKLIST::decompressNode(quicklistNode *node)
+{
+    if (node->zl)
+        return;
+    node->zl = new ZIPLIST(plainCopy(node));
+    free(node->lzf);
+    node->lzf = nullptr;
+    node->lzfBytes = 0;
+}
+
+ZIPLIST QUICKLIST::plainCopy(const quicklistNode *node)
+{
+    if (node->zl)
+        return *node->zl;
+
+    std::vector<unsigned char> buf(node->bytes);
+    if (!_lzfDecompress(node->lzf, node->lzfBytes, buf.data(), buf.size()))
+        throw std::runtime_error("Corrupt QUICKLIST node");
+    return ZIPLIST(buf.data(), buf.size());
+}
+
+/* Whether a string of len bytes can be added to node without going over
+ * the fill limit. The estimate takes the largest entry header. */
+bool QUICKLIST::allowInsert(const quicklistNode *node, size_t len) const
+{
+    if (node == nullptr || node->zl == nullptr)
+        return false;
+
+    size_t newBytes = node->bytes + len + 5 + 5;
+    if (fill_ < 0)
+    {
+        size_t level = -fill_ - 1;
+        size_t limit = optimizationLevel[level < 5 ? level : 4];
+        return newBytes <= limit;
+    }
+    return node->count < (size_t)fill_ && newBytes <= QUICKLIST_SIZE_SAFETY_LIMIT;
+}
+
+void QUICKLIST::insertNode(quicklistNode *node, bool head)
+{
+    if (head)
+    {
+        node->next = head_;
+        if (head_)
+            head_->prev = node;
+        head_ = node;
+        if (tail_ == nullptr)
+            tail_ = node;
+    }
+    else
+    {
+        node->prev = tail_;
+        if (tail_)
+            tail_->next = node;
+        tail_ = node;
+        if (head_ == nullptr)
+            head_ = node;
+    }
+    count_++;
+}
+
+void QUICKLIST::unlinkNode(quicklistNode *node)
+{
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        head_ = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+    else
+        tail_ = node->prev;
+    count_--;
+    freeNode(node);
+}
+
+/* Keep the compress_ nodes at each end plain, and compress the nodes
+ * right after them, as Redis __quicklistCompress(). The interior was
+ * compressed before, and ends move by one node at a time. */
+void QUICKLIST::compressEnds()
+{
+    if (compress_ == 0)
+        return;
+
+    /* Every node is at an end */
+    if (count_ < compress_ * 2 + 1)
+    {
+        for (quicklistNode *node = head_; node; node = node->next)
+            decompressNode(node);
+        return;
+    }
+
+    quicklistNode *forward = head_, *reverse = tail_;
+    for (unsigned depth = 0; depth < compress_; ++depth)
+    {
+        decompressNode(forward);
+        decompressNode(reverse);
+        forward = forward->next;
+        reverse = reverse->prev;
+    }
+    compressNode(forward);
+    compressNode(reverse);
+}
+
+void QUICKLIST::push(const void *s, size_t len, bool head)
+{
+    quicklistNode *node = head ? head_ : tail_;
+    if (!allowInsert(node, len))
+    {
+        node = createNode();
+        insertNode(node, head);
+    }
+
+    if (head)
+        node->zl->prepend(s, len);
+    else
+        node->zl->append(s, len);
+    node->bytes = node->zl->bytes();
+    node->count++;
+    len_++;
+    if (node->count == 1)
+        compressEnds();
+}
+
+std::tuple<bool, SDS> QUICKLIST::pop(bool head)
+{
+    quicklistNode *node = head ? head_ : tail_;
+    if (node == nullptr)
+        return {false, SDS()};
+
+    /* Ends are plain, unless compress_ is 0 and nothing is compressed */
+    size_t p = head ? node->zl->first() : node->zl->last();
+    ZIPLIST::entry e = node->zl->get(p);
+    SDS value = e.sval ? SDS(e.sval, e.slen) : SDS(e.lval);
+
+    node->zl->remove(p);
+    node->bytes = node->zl->bytes();
+    node->count--;
+    len_--;
+    if (node->count == 0)
+    {
+        unlinkNode(node);
+        compressEnds();
+    }
+    return {true, std::move(value)};
+}
+
+QUICKLIST::QUICKLIST(int fill, unsigned compress)
+    : head_(nullptr), tail_(nullptr), count_(0), len_(0), fill_(fill == 0 ? QUICKLIST_FILL_DEFAULT : fill),
+      compress_(compress)
+{
+}
+
+QUICKLIST::QUICKLIST(const QUICKLIST &ql)
+    : head_(nullptr), tail_(nullptr), count_(0), len_(ql.len_), fill_(ql.fill_), compress_(ql.compress_)
+{
+    for (const quicklistNode *node = ql.head_; node; node = node->next)
+        insertNode(copyNode(node), false);
+}
+
+QUICKLIST &QUICKLIST::operator=(const QUICKLIST &ql)
+{
+    if (&ql == this)
+        return *this;
+
+    QUICKLIST t(ql);
+    *this = std::move(t);
+    return *this;
+}
+
+QUICKLIST::QUICKLIST(QUICKLIST &&ql)
+    : head_(ql.head_), tail_(ql.tail_), count_(ql.count_), len_(ql.len_), fill_(ql.fill_),
+      compress_(ql.compress_)
+{
+    ql.head_ = ql.tail_ = nullptr;
+    ql.count_ = ql.len_ = 0;
+}
+
+QUICKLIST &QUICKLIST::operator=(QUICKLIST &&ql)
+{
+    if (&ql == this)
+        return *this;
+
+    std::swap(head_, ql.head_);
+    std::swap(tail_, ql.tail_);
+    std::swap(count_, ql.count_);
+    std::swap(len_, ql.len_);
+    fill_ = ql.fill_;
+    compress_ = ql.compress_;
+    return *this;
+}
+
+QUICKLIST::~QUICKLIST()
+{
+    while (head_)
+    {
+        quicklistNode *next = head_->next;
+        freeNode(head_);
+        head_ = next;
+    }
+}
+
+void QUICKLIST::pushHead(const void *s, size_t len)
+{
+    push(s, len, true);
+}
+
+void QUICKLIST::pushTail(const void *s, size_t len)
+{
+    push(s, len, false);
+}
+
+std::tuple<bool, SDS> QUICKLIST::popHead()
+{
+    return pop(true);
+}
+
+std::tuple<bool, SDS> QUICKLIST::popTail()
+{
+    return pop(false);
+}
+
+std::tuple<bool, SDS> QUICKLIST::index(long index) const
+{
+    bool forward = index >= 0;
+    size_t i = forward ? index : -(index + 1);
+    if (i >= len_)
+        return {false, SDS()};
+
+    /* Skip whole nodes, then seek inside the node */
+    const quicklistNode *node = forward ? head_ : tail_;
+    while (i >= node->count)
+    {
+        i -= node->count;
+        node = forward ? node->next : node->prev;
+    }
+
+    ZIPLIST copy;
+    const ZIPLIST *zl = node->zl;
+    if (zl == nullptr)
+    {
+        copy = plainCopy(node);
+        zl = &copy;
+    }
+    ZIPLIST::entry e = zl->get(zl->seek(forward ? (long)i : -(long)i - 1));
+    return {true, e.sval ? SDS(e.sval, e.slen) : SDS(e.lval)};
+}
+
+size_t QUICKLIST::len() const
+{
+    return len_;
+}
+
+size_t QUICKLIST::nodes() const
+{
+    return count_;
+}
+
+size_t QUICKLIST::compressedNodes() const
+{
+    size_t n = 0;
+    for (const quicklistNode *node = head_; node; node = node->next)
+        n += node->zl == nullptr;
+    return n;
+}
+
+size_t QUICKLIST::bytes() const
+{
+    size_t n = 0;
+    for (const quicklistNode *node = head_; node; node = node->next)
+        n += node->zl ? node->bytes : node->lzfBytes;
+    return n;
+}
+
+#ifdef QUICKLIST_TEST_MAIN
+#include <string>
+#include <deque>
+#include <random>
+#include <chrono>
+#include <cassert>
+#include <cstdio>
+#include <malloc.h>
+
+size_t heapBytes(void)
+{
+    return mallinfo2().uordblks;
+}
+
+void ok(void)
+{
+    printf("OK\n");
+}
+
+std::string str(const SDS &s)
+{
+    return std::string(s.buf(), s.len());
+}
+
+/* Compare ql with the model through index(), forEach() and the pops of
+ * a copy */
+void check(const QUICKLIST &ql, const std::deque<std::string> &model)
+{
+    assert(ql.len() == model.size());
+    size_t i = 0;
+    ql.forEach([&](const ZIPLIST::entry &e) {
+        std::string s = e.sval ? std::string((const char *)e.sval, e.slen) : std::to_string(e.lval);
+        assert(s == model[i++]);
+    });
+    assert(i == model.size());
+    for (size_t j = 0; j < model.size(); j += 1 + model.size() / 50)
+    {
+        assert(str(std::get<1>(ql.index(j))) == model[j]);
+        assert(str(std::get<1>(ql.index(-(long)j - 1))) == model[model.size() - 1 - j]);
+    }
+    assert(!std::get<0>(ql.index(model.size())) && !std::get<0>(ql.index(-(long)model.size() - 1)));
+}
+
+/* Push n elements written by gen(i, buf) at the tail, then pop them all
+ * from the head. Print bytes per element and the push and pop rate. */
+template <typename Gen>
+void bench(const char *name, long n, int fill, unsigned compress, Gen gen)
+{
+    char buf[256];
+    size_t before = heapBytes();
+    QUICKLIST ql(fill, compress);
+    auto t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; ++i)
+        ql.pushTail(buf, gen(i, buf));
+    auto t1 = std::chrono::steady_clock::now();
+    double bytes = heapBytes() - before;
+    size_t nodes = ql.nodes(), compressed = ql.compressedNodes();
+
+    size_t sum = 0;
+    auto t2 = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; ++i)
+        sum += std::get<1>(ql.popHead()).len();
+    auto t3 = std::chrono::steady_clock::now();
+    assert(sum > 0 && ql.len() == 0 && ql.nodes() == 0);
+
+    auto mops = [n](std::chrono::steady_clock::duration d) {
+        return n / (std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / 1e3);
+    };
+    printf("    %-26s %6.2f bytes/element  %6zu nodes (%6zu compressed)  push %5.2fM/s  pop %5.2fM/s\n", name,
+           bytes / n, nodes, compressed, mops(t1 - t0), mops(t3 - t2));
+}
+
+template <typename Gen>
+void benchDeque(long n, Gen gen)
+{
+    char buf[256];
+    size_t before = heapBytes();
+    std::deque<SDS> dq;
+    auto t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; ++i)
+        dq.emplace_back(buf, gen(i, buf));
+    auto t1 = std::chrono::steady_clock::now();
+    double bytes = heapBytes() - before;
+
+    size_t sum = 0;
+    auto t2 = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; ++i)
+    {
+        SDS s = std::move(dq.front());
+        dq.pop_front();
+        sum += s.len();
+    }
+    auto t3 = std::chrono::steady_clock::now();
+    assert(sum > 0);
+
+    auto mops = [n](std::chrono::steady_clock::duration d) {
+        return n / (std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / 1e3);
+    };
+    printf("    %-26s %6.2f bytes/element  %35s push %5.2fM/s  pop %5.2fM/s\n", "std::deque<SDS>", bytes / n, "",
+           mops(t1 - t0), mops(t3 - t2));
+}
+
+int main(int argc, char **argv)
+{
+    printf("LZF round trip: "); {
+        std::mt19937_64 gen(1);
+        for (int t = 0; t < 200; ++t)
+        {
+            std::vector<unsigned char> in(gen() % 20000), out(in.size() + in.size() / 16 + 64), back(in.size());
+            /* Noise, a repeated block, and repeats from too far away */
+            for (size_t i = 0; i < in.size(); ++i)
+                in[i] = (t % 3 == 0) ? gen() : (t % 3 == 1) ? (i >= 50 ? in[i - 50] : gen()) : (i > 9000 ? in[i - 9000] : gen() % 4);
+            size_t size = _lzfCompress(in.data(), in.size(), out.data(), out.size());
+            assert(size > 0 || in.empty());
+            assert(_lzfDecompress(out.data(), size, back.data(), back.size()) && back == in);
+            if (t % 3 == 1 && in.size() > 100)
+                assert(size < in.size() / 4);
+            /* Too small an output buffer */
+            if (in.size() > 100)
+                assert(_lzfCompress(in.data(), in.size(), out.data(), t % 3 == 0 ? in.size() - 8 : 10) == 0);
+        }
+        ok();
+    }
+
+    for (unsigned compress : {0, 1, 2})
+    {
+        printf("Push and pop at both ends (compress %u): ", compress); {
+            QUICKLIST ql(16, compress);
+            std::deque<std::string> model;
+            std::mt19937_64 gen(compress);
+            for (int i = 0; i < 30000; ++i)
+            {
+                std::string s = gen() % 3 ? "value:" + std::to_string(gen() % 1000) + std::string(gen() % 40, 'x')
+                                          : std::to_string((long long)gen() % 100000);
+                switch (gen() % (i < 15000 ? 3 : 5))
+                {
+                case 0:
+                    ql.pushHead(s.data(), s.size());
+                    model.push_front(s);
+                    break;
+                case 1:
+                case 2:
+                    ql.pushTail(s.data(), s.size());
+                    model.push_back(s);
+                    break;
+                case 3:
+                {
+                    auto [found, v] = ql.popHead();
+                    assert(found == !model.empty());
+                    if (found)
+                    {
+                        assert(str(v) == model.front());
+                        model.pop_front();
+                    }
+                    break;
+                }
+                case 4:
+                {
+                    auto [found, v] = ql.popTail();
+                    assert(found == !model.empty());
+                    if (found)
+                    {
+                        assert(str(v) == model.back());
+                        model.pop_back();
+                    }
+                    break;
+                }
+                }
+                if (i % 5000 == 0)
+                    check(ql, model);
+            }
+            check(ql, model);
+            if (compress)
+                assert(ql.compressedNodes() > 0 && ql.compressedNodes() <= ql.nodes() - 2 * compress);
+            else
+                assert(ql.compressedNodes() == 0);
+
+            QUICKLIST copy(ql);
+            check(copy, model);
+            QUICKLIST moved(std::move(copy));
+            check(moved, model);
+            assert(copy.len() == 0 && !std::get<0>(copy.popHead()));
+            while (std::get<0>(ql.popTail()))
+                ;
+            assert(ql.len() == 0 && ql.nodes() == 0 && !std::get<0>(ql.index(0)));
+            ok();
+        }
+    }
+
+    printf("Byte fill limits: "); {
+        QUICKLIST ql(-1, 1);
+        std::string s(100, 'y');
+        for (int i = 0; i < 1000; ++i)
+            ql.pushTail(s.data(), s.size());
+        assert(ql.nodes() >= 1000 * 102 / 4096 && ql.nodes() <= 1000 * 102 / 4000 + 2);
+        /* 100 identical bytes compress well */
+        assert(ql.bytes() < 1000 * 102 / 10);
+        std::string big(10000, 'z');
+        ql.pushHead(big.data(), big.size());
+        assert(str(std::get<1>(ql.index(0))) == big && std::get<0>(ql.popHead()));
+        ok();
+    }
+
+    long n = (argc > 1) ? atol(argv[1]) : 10000000;
+    auto event = [](long i, char *buf) {
+        return (size_t)snprintf(buf, 256, "{\"id\":%ld,\"user\":\"user:%ld\",\"op\":\"%s\"}", i, i * 7919 % 100000,
+                                i % 3 ? "view" : "click");
+    };
+    auto integer = [](long i, char *buf) { return (size_t)snprintf(buf, 256, "%ld", 1000000 + i * 13); };
+
+    printf("Queue of %ld events like %s:\n", n, "{\"id\":1,\"user\":\"user:7919\",\"op\":\"view\"}");
+    bench("QUICKLIST", n, QUICKLIST_FILL_DEFAULT, 0, event);
+    bench("QUICKLIST, compress 1", n, QUICKLIST_FILL_DEFAULT, 1, event);
+    benchDeque(n, event);
+    printf("Queue of %ld integers:\n", n);
+    bench("QUICKLIST", n, QUICKLIST_FILL_DEFAULT, 0, integer);
+    bench("QUICKLIST, compress 1", n, QUICKLIST_FILL_DEFAULT, 1, integer);
+    benchDeque(n, integer);
+
+    return 0;
+}
+#endif
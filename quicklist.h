@@ -0,0 +1,127 @@
+#ifndef BOMENG_REDIS_QUICKLIST_H
+#define BOMENG_REDIS_QUICKLIST_H
+
+#include "sds.h"
+#include "ziplist.h"
+#include <stdint.h>
+#include <tuple>
+#include <cstddef>
+
+/* Node size, as Redis list-max-listpack-size: a positive fill caps the
+ * entries of a node, -1 to -5 cap its bytes at 4, 8, 16, 32 and 64KB */
+#define QUICKLIST_FILL_DEFAULT -2
+/* Nodes kept uncompressed at each end, as Redis list-compress-depth. 0
+ * compresses nothing. */
+#define QUICKLIST_NOCOMPRESS 0
+/* Even with a positive fill, a node does not grow past that many bytes */
+#define QUICKLIST_SIZE_SAFETY_LIMIT 8192
+/* Nodes smaller than that are not compressed */
+#define QUICKLIST_MIN_COMPRESS_BYTES 48
+/* A compressed node must save at least that many bytes */
+#define QUICKLIST_MIN_COMPRESS_IMPROVE 8
+
+namespace bRedis
+{
+
+    /* A list of strings as a doubly linked list of ZIPLIST nodes, as Redis
+     * quicklist.c.
+     *
+     * Each node packs many entries, so a list costs a few bytes per entry
+     * instead of a node per entry, and pushes and pops at either end touch
+     * a single node. Nodes are bounded by fill, so an insertion never moves
+     * more than one node of memory.
+     *
+     * Queues are mostly accessed at their ends. With compress set to N,
+     * the N nodes at each end stay plain and the interior nodes are kept
+     * LZF compressed: push and pop never decompress, and only a node moving
+     * in or out of the ends is compressed or decompressed. Reading an
+     * interior entry (index(), forEach()) decompresses a copy of its node
+     * and leaves the list untouched. */
+    class QUICKLIST
+    {
+    private:
+        struct quicklistNode
+        {
+            quicklistNode *prev;
+            quicklistNode *next;
+            /* Plain node, or nullptr when compressed */
+            ZIPLIST *zl;
+            /* Compressed node */
+            unsigned char *lzf;
+            uint32_t lzfBytes;
+            /* Size of the plain ZIPLIST */
+            uint32_t bytes;
+            uint32_t count;
+        };
+
+    private:
+        quicklistNode *head_;
+        quicklistNode *tail_;
+        size_t count_;
+        size_t len_;
+        int fill_;
+        unsigned compress_;
+
+    private:
+        static quicklistNode *createNode();
+        static void freeNode(quicklistNode *node);
+        static quicklistNode *copyNode(const quicklistNode *node);
+        static void compressNode(quicklistNode *node);
+        static void decompressNode(quicklistNode *node);
+        static ZIPLIST plainCopy(const quicklistNode *node);
+        bool allowInsert(const quicklistNode *node, size_t len) const;
+        void insertNode(quicklistNode *node, bool head);
+        void unlinkNode(quicklistNode *node);
+        void compressEnds();
+        void push(const void *s, size_t len, bool head);
+        std::tuple<bool, SDS> pop(bool head);
+
+    public:
+        QUICKLIST(int fill = QUICKLIST_FILL_DEFAULT, unsigned compress = QUICKLIST_NOCOMPRESS);
+
+        QUICKLIST(const QUICKLIST &ql);
+        QUICKLIST &operator=(const QUICKLIST &ql);
+        QUICKLIST(QUICKLIST &&ql);
+        QUICKLIST &operator=(QUICKLIST &&ql);
+
+        ~QUICKLIST();
+
+    public:
+        void pushHead(const void *s, size_t len);
+        void pushTail(const void *s, size_t len);
+        std::tuple<bool, SDS> popHead();
+        std::tuple<bool, SDS> popTail();
+        /* Entry at index, negative from the tail */
+        std::tuple<bool, SDS> index(long index) const;
+
+        /* Call fn(const ZIPLIST::entry &) on every entry, head to tail */
+        template <typename Fn>
+        void forEach(Fn fn) const
+        {
+            for (const quicklistNode *node = head_; node; node = node->next)
+            {
+                if (node->zl)
+                {
+                    for (size_t p = node->zl->first(); p; p = node->zl->next(p))
+                        fn(node->zl->get(p));
+                }
+                else
+                {
+                    ZIPLIST zl = plainCopy(node);
+                    for (size_t p = zl.first(); p; p = zl.next(p))
+                        fn(zl.get(p));
+                }
+            }
+        }
+
+    public:
+        size_t len() const;
+        size_t nodes() const;
+        size_t compressedNodes() const;
+        /* Bytes of the nodes as stored, compressed or not */
+        size_t bytes() const;
+    };
+
+} // namespace bRedis
+
+#endif
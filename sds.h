@@ -85,12 +85,18 @@ namespace bRedis
         size_t AllocSize();
     };
 
-    std::ostream &operator<<(std::ostream &os, const SDS &sds)
+    inline std::ostream &operator<<(std::ostream &os, const SDS &sds)
     {
         os << sds.buf();
         return os;
     }
 
+    /* Binary safe ordering of SDS strings, as SDS::cmp */
+    struct sdsLess
+    {
+        bool operator()(const SDS &a, const SDS &b) const { return a.cmp(b) < 0; }
+    };
+
 } // namespace bRedis
 
 #endif
\ No newline at end of file
@@ -0,0 +1,203 @@
+#include "shardeddict.h"
+
+#ifdef SHARDEDDICT_TEST_MAIN
+#include <string>
+#include <vector>
+#include <thread>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/time.h>
+
+using namespace bRedis;
+
+long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+void ok(void) {
+    printf("OK\n");
+}
+
+/* One DICT behind a single mutex, the baseline of the benchmark */
+struct lockedDict {
+    std::mutex lock;
+    DICT<long, long> d;
+
+    bool find(long key) {
+        std::lock_guard<std::mutex> lk(lock);
+        return d.find(key) != nullptr;
+    }
+    bool insert(long key, long val) {
+        std::lock_guard<std::mutex> lk(lock);
+        return d.add(key, val);
+    }
+    bool erase(long key) {
+        std::lock_guard<std::mutex> lk(lock);
+        return d.remove(key);
+    }
+};
+
+struct shardedDict {
+    ShardedDICT<long, long> d;
+
+    explicit shardedDict(unsigned shards) : d(shards) {}
+    bool find(long key) { return d.contains(key); }
+    bool insert(long key, long val) { return d.add(key, val); }
+    bool erase(long key) { return d.remove(key); }
+};
+
+/* Run ops operations split over nthreads threads, writePct percent of them
+ * being insert or erase (half each), and return the throughput in ops/usec.
+ * Hits are summed so that the compiler cannot drop unlocked lookups. */
+template <typename Dict>
+double bench(Dict &dict, int nthreads, int writePct, long keyspace, long ops) {
+    std::vector<std::thread> threads;
+    std::atomic<long> hits{0};
+    long long start = usec();
+    for (int t = 0; t < nthreads; ++t) {
+        threads.emplace_back([&dict, &hits, t, nthreads, writePct, keyspace, ops]() {
+            uint64_t s = 88172645463325252ULL + t;
+            long found = 0;
+            for (long i = 0; i < ops / nthreads; ++i) {
+                s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+                long key = s % keyspace;
+                int op = (s >> 32) % 100;
+                if (op >= writePct)
+                    found += dict.find(key);
+                else if (op % 2)
+                    dict.insert(key, key);
+                else
+                    dict.erase(key);
+            }
+            hits += found;
+        });
+    }
+    for (auto &th : threads)
+        th.join();
+    long long elapsed = usec() - start;
+    return elapsed ? (double)ops / elapsed : 0;
+}
+
+int main(int argc, char **argv) {
+
+    printf("Basic add/find/replace/remove: "); {
+        ShardedDICT<long, long> d(10);
+        assert(d.shards() == 16);
+        for (long i = 0; i < 10000; ++i)
+            assert(d.add(i, i));
+        assert(!d.add(5, 0) && d.size() == 10000);
+        for (long i = 0; i < 10000; ++i) {
+            auto [found, val] = d.find(i);
+            assert(found && val == i);
+        }
+        assert(!d.replace(7, 70) && std::get<1>(d.find(7)) == 70);
+        assert(d.replace(-7, 70) && d.contains(-7));
+        for (long i = 0; i < 10000; i += 2)
+            assert(d.remove(i));
+        assert(!d.remove(0) && !d.contains(0) && d.contains(1));
+        assert(d.size() == 5001);
+
+        /* Non trivial values take the locked path */
+        ShardedDICT<std::string, std::string> s(4);
+        assert(s.add("a", "1") && !s.replace("a", "2"));
+        assert(std::get<1>(s.find("a")) == "2" && !s.contains("b"));
+        ok();
+    }
+
+    printf("Readers racing with writers: "); {
+        /* Values are always twice the key: a torn read would show */
+        ShardedDICT<std::string, long> d(4);
+        const long keys = 2000;
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 2; ++t)
+            threads.emplace_back([&d, &stop, t]() {
+                uint64_t s = 0x9E3779B97F4A7C15ULL * (t + 1);
+                for (int i = 0; i < 200000; ++i) {
+                    s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+                    long k = s % keys;
+                    if (s & (1ULL << 40))
+                        d.add(std::to_string(k), 2 * k);
+                    else
+                        d.remove(std::to_string(k));
+                }
+                stop = true;
+            });
+        for (int t = 0; t < 4; ++t)
+            threads.emplace_back([&d, &stop, t]() {
+                uint64_t s = 88172645463325252ULL + t;
+                while (!stop) {
+                    s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+                    long k = s % keys;
+                    auto [found, val] = d.find(std::to_string(k));
+                    assert(!found || val == 2 * k);
+                }
+            });
+        for (auto &th : threads)
+            th.join();
+        EPOCH::reclaim();
+        ok();
+    }
+
+    printf("Readers racing with table growth: "); {
+        /* One shard growing from empty: each round crosses every table
+         * swap from 4 to 256K buckets under the readers */
+        long swaps = 0;
+        for (int round = 0; round < 5; ++round) {
+            ShardedDICT<long, long> d(1);
+            const long keys = 200000;
+            std::atomic<long> high{0};
+            std::vector<std::thread> threads;
+            threads.emplace_back([&d, &high]() {
+                for (long k = 0; k < keys; ++k) {
+                    d.add(k, 2 * k);
+                    if (k % 3 == 0)
+                        d.remove(k / 2);
+                    high.store(k, std::memory_order_relaxed);
+                }
+                high.store(keys, std::memory_order_relaxed);
+            });
+            for (int t = 0; t < 3; ++t)
+                threads.emplace_back([&d, &high, t]() {
+                    uint64_t s = 88172645463325252ULL + t;
+                    long h;
+                    while ((h = high.load(std::memory_order_relaxed)) < keys) {
+                        s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+                        long k = s % (h + 1);
+                        auto [found, val] = d.find(k);
+                        assert(!found || val == 2 * k);
+                    }
+                });
+            for (auto &th : threads)
+                th.join();
+            for (long n = 4; n < keys; n *= 2)
+                swaps++;
+        }
+        EPOCH::reclaim();
+        printf("%ld table swaps ", swaps);
+        ok();
+    }
+
+    printf("Scaling, ops/usec (ShardedDICT, 64 shards, vs mutex DICT):\n"); {
+        const long keyspace = 1 << 20, ops = (argc > 1) ? atol(argv[1]) : 1 << 22;
+        for (int writePct : {5, 50}) {
+            shardedDict sharded(64);
+            lockedDict locked;
+            for (long k = 0; k < keyspace; k += 2) {
+                sharded.insert(k, k);
+                locked.insert(k, k);
+            }
+            for (int nthreads = 1; nthreads <= 64; nthreads *= 2) {
+                double a = bench(sharded, nthreads, writePct, keyspace, ops);
+                double b = bench(locked, nthreads, writePct, keyspace, ops);
+                printf("  %2d%% writes, %2d threads: %8.3f vs %8.3f\n", writePct, nthreads, a, b);
+            }
+        }
+    }
+
+    return 0;
+}
+#endif
@@ -0,0 +1,203 @@
+#ifndef BOMENG_REDIS_SHARDEDDICT_H
+#define BOMENG_REDIS_SHARDEDDICT_H
+
+#include "dict.h"
+#include "epoch.h"
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* Entries and bucket arrays of a shard go through EPOCH, so that a reader
+ * racing with a writer never follows a pointer to freed memory */
+struct dictEpochAlloc : dictAlloc
+{
+    template <typename E>
+    void deleteEntry(E *e)
+    {
+        bRedis::EPOCH::retire(e, [](void *p) { delete (E *)p; });
+    }
+
+    void deleteTable(void *p)
+    {
+        if (p)
+            bRedis::EPOCH::retire(p, free);
+    }
+};
+
+/* A DICT split into independent shards, for many threads at once.
+ *
+ * The top bits of the hash pick the shard (DICT itself indexes buckets by
+ * the low bits). Each shard is a DICT with its own mutex and sequence
+ * counter, on its own cache lines, so shards grow and rehash on their
+ * own and writers to different shards never contend.
+ *
+ * Writers take the mutex of the shard, make the counter odd, mutate, and
+ * make it even again. Readers take no lock: they read the counter, load
+ * the tables and check the counter before walking them
+ * (DICT::findOptimistic), copy the value, then retry if the counter
+ * moved. A read
+ * therefore writes only to the EPOCH slot of its own thread, never to a
+ * line shared with other threads. Retired entries and tables are freed by
+ * EPOCH once no reader can still be traversing them.
+ *
+ * The optimistic path copies the value while a writer may be changing it,
+ * which is only sound for trivially copyable values. For other value
+ * types, find() takes the shard mutex. Keys may be of any type: DICT
+ * publishes an entry with a release store once its key is built, and
+ * never writes the key again. */
+template <typename K, typename V, typename Hash = dictHash<K>, typename KeyEqual = dictKeyEqual<K>>
+class ShardedDICT
+{
+private:
+    typedef DICT<K, V, Hash, KeyEqual, false, dictEpochAlloc> shardDict;
+
+    /* Readers give up optimism after that many torn reads in a row */
+    static constexpr int maxOptimisticTries = 16;
+    static constexpr bool optimisticReads = std::is_trivially_copyable<V>::value;
+
+    struct alignas(64) shard
+    {
+        std::atomic<uint64_t> seq{0};
+        std::mutex lock;
+        shardDict d;
+    };
+
+    /* Holds the mutex of a shard, the counter odd */
+    class writeGuard
+    {
+        shard &s_;
+
+    public:
+        explicit writeGuard(shard &s) : s_(s)
+        {
+            s_.lock.lock();
+            s_.seq.store(s_.seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+        ~writeGuard()
+        {
+            s_.seq.store(s_.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            s_.lock.unlock();
+        }
+    };
+
+private:
+    std::unique_ptr<shard[]> shards_;
+    unsigned shardBits_;
+
+private:
+    shard &_shard(const K &key) const
+    {
+        unsigned int h = Hash()(key);
+        return shards_[shardBits_ ? h >> (32 - shardBits_) : 0];
+    }
+
+    static void _pause()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#endif
+    }
+
+public:
+    /* shards is rounded up to a power of two */
+    explicit ShardedDICT(unsigned shards = 16) : shardBits_(0)
+    {
+        while ((1u << shardBits_) < shards && shardBits_ < 16)
+            shardBits_++;
+        shards_.reset(new shard[1u << shardBits_]);
+    }
+
+    ShardedDICT(const ShardedDICT &) = delete;
+    ShardedDICT &operator=(const ShardedDICT &) = delete;
+
+public:
+    size_t shards() const { return (size_t)1 << shardBits_; }
+
+    size_t size() const
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < shards(); ++i)
+        {
+            std::lock_guard<std::mutex> lk(shards_[i].lock);
+            n += shards_[i].d.size();
+        }
+        return n;
+    }
+
+    bool add(K key, V val)
+    {
+        shard &s = _shard(key);
+        writeGuard g(s);
+        return s.d.add(std::move(key), std::move(val));
+    }
+
+    bool replace(K key, V val)
+    {
+        shard &s = _shard(key);
+        writeGuard g(s);
+        return s.d.replace(std::move(key), std::move(val));
+    }
+
+    bool remove(const K &key)
+    {
+        shard &s = _shard(key);
+        writeGuard g(s);
+        return s.d.remove(key);
+    }
+
+    std::tuple<bool, V> find(const K &key) const
+    {
+        shard &s = _shard(key);
+
+        if constexpr (optimisticReads)
+        {
+            bRedis::EPOCH::guard g;
+            for (int i = 0; i < maxOptimisticTries; ++i)
+            {
+                uint64_t seq = s.seq.load(std::memory_order_acquire);
+                if (seq & 1)
+                {
+                    _pause();
+                    continue;
+                }
+
+                /* The tables must be checked before they are walked: a
+                 * table paired with the mask of another is read out of
+                 * bounds, and checking after the walk is too late */
+                auto stable = [&s, seq]() {
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    return s.seq.load(std::memory_order_relaxed) == seq;
+                };
+                auto [consistent, he] = s.d.findOptimistic(key, stable);
+                if (!consistent)
+                    continue;
+                std::tuple<bool, V> ret = he ? std::tuple<bool, V>{true, he->val} : std::tuple<bool, V>{false, V()};
+
+                if (stable())
+                    return ret;
+            }
+        }
+
+        /* Non trivial values, or a shard under constant writes */
+        std::lock_guard<std::mutex> lk(s.lock);
+        const shardDict &d = s.d;
+        auto *he = d.find(key);
+        if (he)
+            return {true, he->val};
+        return {false, V()};
+    }
+
+    bool contains(const K &key) const
+    {
+        return std::get<0>(find(key));
+    }
+};
+
+#endif
@@ -1,16 +1,21 @@
 #include "skiplist.h"
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include <random>
 #include <algorithm>
 #include <vector>
 #include <iomanip>
+#include <numeric>
+#include <cassert>
+#include <chrono>
 
 #define ptrp(ptr) std::showbase << std::internal << std::setfill('0') << std::setw(14) << std::hex << reinterpret_cast<uintptr_t>(ptr)
 #define valp(val) std::setfill(' ') << std::setw(1) << std::dec << (val)
 
-template<typename K, typename V, typename Cmp>
-std::ostream& operator<<(std::ostream& os, const SKIPLIST<K, V, Cmp> &sl)
+template<typename K, typename V, typename Cmp, typename Policy>
+std::ostream& operator<<(std::ostream& os, const SKIPLIST<K, V, Cmp, Policy> &sl)
 {
     auto *t = sl.header_;
     while (t)
@@ -42,7 +47,64 @@ std::vector<size_t> random_shuffle(size_t n) {
     return v;
 }
 
-int main()
+template <typename K, typename V, typename Cmp, typename Policy>
+void checkConsistency(SKIPLIST<K, V, Cmp, Policy> &sl)
+{
+    size_t n = 0;
+    for (auto it = sl.begin(); it != sl.end(); ++it)
+    {
+        ++n;
+        assert(sl.rank(it->first) == n);
+        assert(sl.atRank(n) == it);
+    }
+    assert(n == sl.size());
+    assert(sl.rangeByRank(0, -1).size() == n);
+}
+
+/* Latency of find, insert and erase, in ns per operation, on lists of
+ * 10^3 .. 10^maxExp elements built with fromSorted(randomized) so that the
+ * levels follow Policy. */
+template <typename Policy>
+void benchPolicy(const char *name, int maxExp)
+{
+    const long ops = 10000;
+    std::mt19937_64 gen(12345);
+
+    for (long n = 1000, e = 3; e <= maxExp; n *= 10, ++e)
+    {
+        std::vector<std::pair<long, long>> sorted;
+        sorted.reserve(n);
+        for (long i = 0; i < n; ++i)
+            sorted.emplace_back(i * 2, i);
+        auto sl = SKIPLIST<long, long, std::less<long>, Policy>::fromSorted(sorted.begin(), sorted.end(), true);
+        std::vector<std::pair<long, long>>().swap(sorted);
+
+        std::vector<long> keys(ops);
+        for (auto &k : keys)
+            k = gen() % n;
+
+        auto t0 = std::chrono::steady_clock::now();
+        long found = 0;
+        for (long k : keys)
+            found += sl.find(k * 2) != sl.end();
+        auto t1 = std::chrono::steady_clock::now();
+        for (long k : keys)
+            sl.insert(k * 2 + 1, k);
+        auto t2 = std::chrono::steady_clock::now();
+        for (long k : keys)
+            sl.erase(k * 2 + 1);
+        auto t3 = std::chrono::steady_clock::now();
+        assert(found == ops && sl.size() == (size_t)n);
+
+        auto ns = [ops](std::chrono::steady_clock::duration d) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / ops;
+        };
+        std::cout << std::dec << "  " << name << " n=10^" << e << ": find " << ns(t1 - t0)
+                  << "ns, insert " << ns(t2 - t1) << "ns, erase " << ns(t3 - t2) << "ns" << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
 {
     std::cout << "less: " << std::endl; {
         SKIPLIST<int, std::string, std::less<int>> skiplist;
@@ -169,5 +231,351 @@ int main()
         std::cout << sl5 << std::endl;
     }
 
+    std::cout << "\nrank: " << std::endl; {
+        SKIPLIST<int, std::string, std::less<int>> skiplist;
+        const size_t count = 100;
+        std::vector<size_t> nums = random_shuffle(count);
+        for (auto num : nums)
+            skiplist.insert(num, "zhang");
+
+        for (size_t i = 1; i <= count; ++i)
+        {
+            assert(skiplist.rank(i) == i);
+            assert(skiplist.atRank(i)->first == (int)i);
+        }
+        assert(skiplist.rank(0) == 0);
+        assert(skiplist.rank(count + 1) == 0);
+        assert(skiplist.atRank(0) == skiplist.end());
+        assert(skiplist.atRank(count + 1) == skiplist.end());
+        std::cout << "OK" << std::endl;
+    }
+
+    std::cout << "\nrange by rank: " << std::endl; {
+        SKIPLIST<int, std::string, std::less<int>> skiplist;
+        const size_t count = 100;
+        std::vector<size_t> nums = random_shuffle(count);
+        for (auto num : nums)
+            skiplist.insert(num, "zhang");
+
+        auto r = skiplist.rangeByRank(0, -1);
+        assert(r.size() == count);
+        for (size_t i = 0; i < count; ++i)
+            assert(r[i].first == (int)i + 1);
+
+        r = skiplist.rangeByRank(-3, -1);
+        assert(r.size() == 3 && r[0].first == 98 && r[2].first == 100);
+        r = skiplist.rangeByRank(10, 5);
+        assert(r.empty());
+        r = skiplist.rangeByRank(95, 1000);
+        assert(r.size() == 5 && r[0].first == 96);
+
+        assert(skiplist.eraseRangeByRank(0, 9) == 10);
+        assert(skiplist.size() == count - 10);
+        assert(skiplist.atRank(1)->first == 11);
+        assert(skiplist.eraseRangeByRank(-10, -1) == 10);
+        assert(skiplist.size() == count - 20);
+        assert(skiplist.rank(90) == 80);
+        assert(skiplist.rank(91) == 0);
+        assert(skiplist.eraseRangeByRank(0, -1) == count - 20);
+        assert(skiplist.empty());
+        std::cout << "OK" << std::endl;
+    }
+
+    std::cout << "\nrange by key: " << std::endl; {
+        SKIPLIST<int, std::string, std::less<int>> skiplist;
+        const size_t count = 100;
+        std::vector<size_t> nums = random_shuffle(count);
+        for (auto num : nums)
+            skiplist.insert(num * 2, "zhang");
+
+        assert(skiplist.lower_bound(10)->first == 10);
+        assert(skiplist.lower_bound(11)->first == 12);
+        assert(skiplist.upper_bound(10)->first == 12);
+        assert(skiplist.lower_bound(201) == skiplist.end());
+        assert(skiplist.upper_bound(200) == skiplist.end());
+
+        auto r = skiplist.range(10, 20);
+        assert(r.size() == 6 && r.front().first == 10 && r.back().first == 20);
+        r = skiplist.range(10, 20, true, true);
+        assert(r.size() == 4 && r.front().first == 12 && r.back().first == 18);
+        r = skiplist.range(9, 21, false, false, 2, 3);
+        assert(r.size() == 3 && r.front().first == 14 && r.back().first == 18);
+        r = skiplist.range(10, 20, false, false, 10);
+        assert(r.empty());
+        r = skiplist.range(300, 400);
+        assert(r.empty());
+
+        r = skiplist.revrange(10, 20);
+        assert(r.size() == 6 && r.front().first == 20 && r.back().first == 10);
+        r = skiplist.revrange(10, 20, false, true, 1, 2);
+        assert(r.size() == 2 && r.front().first == 16 && r.back().first == 14);
+        r = skiplist.revrange(0, 5);
+        assert(r.size() == 2 && r.back().first == 2);
+        std::cout << "OK" << std::endl;
+    }
+
+    std::cout << "\nerase range: " << std::endl; {
+        SKIPLIST<int, std::string, std::less<int>> skiplist;
+        const size_t count = 1000;
+        std::vector<size_t> nums = random_shuffle(count);
+        for (auto num : nums)
+            skiplist.insert(num, "zhang");
+
+        assert(skiplist.eraseRange(101, 200) == 100);
+        assert(skiplist.size() == count - 100);
+        assert(skiplist.find(150) == skiplist.end());
+        assert(skiplist.rank(201) == 101);
+        assert(skiplist.atRank(100)->first == 100);
+        assert(skiplist.eraseRange(901, 2000) == 100);
+        assert(skiplist.rank(900) == 800);
+        assert(skiplist.insert(1000, "zhang"));
+        assert(skiplist.rank(1000) == 801);
+        assert(skiplist.eraseRange(2000, 3000) == 0);
+        for (size_t i = 1; i <= skiplist.size(); ++i)
+            assert(skiplist.rank(skiplist.atRank(i)->first) == i);
+        assert(skiplist.revrange(0, 2000).size() == 801);
+        assert(skiplist.eraseRange(0, 2000) == 801);
+        assert(skiplist.empty());
+        std::cout << "OK" << std::endl;
+    }
+
+    std::cout << "\nheterogeneous lookup, emplace: " << std::endl; {
+        SKIPLIST<std::string, std::vector<int>, std::less<>> skiplist;
+        for (int i = 0; i < 100; ++i)
+            assert(skiplist.try_emplace("key:" + std::to_string(i), 3, i).second);
+
+        std::string_view sv("key:42");
+        assert(skiplist.find(sv) != skiplist.end() && skiplist.find(sv)->second == std::vector<int>(3, 42));
+        assert(skiplist.find("key:7")->second[0] == 7);
+        assert(skiplist.find(std::string_view("key:420")) == skiplist.end());
+        assert(skiplist.rank("key:0") == 1 && skiplist.rank(sv) == skiplist.rank(std::string("key:42")));
+        assert(skiplist.lower_bound("key:5")->first == "key:5");
+        assert(skiplist.upper_bound("key:5")->first == "key:50");
+
+        /* A present key is neither copied nor moved from */
+        std::string k("key:1");
+        auto res = skiplist.try_emplace(std::move(k), 1, -1);
+        assert(!res.second && res.first->second[0] == 1 && k == "key:1");
+
+        res = skiplist.emplace(std::piecewise_construct, std::forward_as_tuple("key:100"), std::forward_as_tuple(2, 100));
+        assert(res.second && res.first->second.size() == 2);
+        assert(!skiplist.emplace("key:100", std::vector<int>()).second);
+        assert(skiplist.size() == 101);
+
+        auto it = skiplist.updateKey("key:100", "key:00");
+        assert(it->first == "key:00" && it->second[0] == 100 && skiplist.rank("key:00") == 2);
+        assert(skiplist.erase(std::string_view("key:00")) && !skiplist.erase("key:00"));
+        assert(skiplist.size() == 100);
+        std::cout << "OK" << std::endl;
+    }
+
+    std::cout << "\nsnapshot: " << std::endl; {
+        typedef SKIPLIST<int, std::string> list;
+        list skiplist;
+        for (int i = 0; i < 1000; ++i)
+            skiplist.insert(i * 2, std::to_string(i));
+
+        auto contents = [](list::snapshot &snap) {
+            std::vector<std::pair<int, std::string>> v;
+            for (auto &kv : snap)
+                v.push_back(kv);
+            return v;
+        };
+
+        std::vector<std::pair<int, std::string>> before(skiplist.begin(), skiplist.end());
+        std::vector<std::pair<int, std::string>> seen;
+        {
+            list::snapshot snap = skiplist.getSnapshot();
+            assert(snap.size() == 1000);
+
+            /* Writes of every kind interleaved with the walk */
+            auto it = snap.begin();
+            std::mt19937 gen(7);
+            for (int step = 0; it != snap.end(); ++step, ++it)
+            {
+                seen.push_back(*it);
+                switch (step % 6)
+                {
+                case 0: skiplist.erase(gen() % 2000); break;
+                case 1: skiplist.insert(gen() % 2000, "new"); break;
+                case 2: skiplist.updateKey(gen() % 2000, 2000 + step); break;
+                case 3: skiplist.eraseRange(gen() % 2000, gen() % 2000); break;
+                case 4: skiplist.erase(it->first); break;
+                case 5: skiplist.append(3000 + step, "tail"); break;
+                }
+            }
+            assert(seen == before);
+
+            std::vector<std::pair<int, std::string>> middle(skiplist.begin(), skiplist.end());
+            list::snapshot snap2 = skiplist.getSnapshot();
+            skiplist.clear();
+            skiplist.insert(1, "after");
+            skiplist.insert(2, "after");
+
+            assert(contents(snap) == before && contents(snap2) == middle);
+            assert(snap.find(10) && snap.find(10)->second == "5" && !snap.find(11));
+            assert(!snap2.find(1) && skiplist.find(1) != skiplist.end());
+            assert(snap2.size() == middle.size());
+        }
+        /* Both released: every kept node has been freed (checked by ASAN) */
+        assert(skiplist.size() == 2);
+        checkConsistency(skiplist);
+
+        const int n = 100000;
+        list big;
+        for (int i = 0; i < n; ++i)
+            big.append(i, "v");
+        auto t0 = std::chrono::steady_clock::now();
+        list copy(big);
+        auto t1 = std::chrono::steady_clock::now();
+        {
+            list::snapshot snap = big.getSnapshot();
+            auto t2 = std::chrono::steady_clock::now();
+            for (int i = 0; i < n; ++i)
+                big.erase(i);
+            auto t3 = std::chrono::steady_clock::now();
+            assert(std::distance(snap.begin(), snap.end()) == n);
+            auto us = [](std::chrono::steady_clock::duration d) {
+                return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+            };
+            std::cout << std::dec << n << " elements, copy: " << us(t1 - t0) << "usec, snapshot: " << us(t2 - t1)
+                      << "usec, erase all under the snapshot: " << us(t3 - t2) << "usec" << std::endl;
+        }
+        std::cout << "OK" << std::endl;
+    }
+
+    std::cout << "\nfrom sorted: " << std::endl; {
+        std::vector<std::pair<int, std::string>> sorted;
+        const size_t count = 1000;
+        for (size_t i = 1; i <= count; ++i)
+            sorted.emplace_back((int)i * 2, "zhang");
+
+        for (bool randomized : {false, true})
+        {
+            auto skiplist = SKIPLIST<int, std::string, std::less<int>>::fromSorted(sorted.begin(), sorted.end(), randomized);
+            assert(skiplist.size() == count);
+            for (size_t i = 1; i <= count; ++i)
+            {
+                assert(skiplist.rank((int)i * 2) == i);
+                assert(skiplist.atRank(i)->first == (int)i * 2);
+                assert(skiplist.find((int)i * 2 - 1) == skiplist.end());
+            }
+            assert(skiplist.revrange(0, 3000).size() == count);
+            assert(skiplist.insert(1, "yang"));
+            assert(skiplist.rank(2) == 2);
+            assert(skiplist.erase(1000));
+            assert(skiplist.rank(1002) == 501);
+
+            SKIPLIST<int, std::string, std::less<int>> copy(skiplist);
+            assert(copy.size() == count);
+            for (size_t i = 1; i <= count; ++i)
+                assert(copy.rank(copy.atRank(i)->first) == i);
+        }
+
+        auto empty = SKIPLIST<int, std::string, std::less<int>>::fromSorted(sorted.begin(), sorted.begin());
+        assert(empty.empty() && empty.begin() == empty.end());
+        assert(empty.insert(1, "yang") && empty.rank(1) == 1);
+        std::cout << "OK" << std::endl;
+    }
+
+    std::cout << "\nmerge sorted: " << std::endl; {
+        SKIPLIST<int, std::string, std::less<int>> skiplist;
+        const size_t count = 1000;
+        std::vector<size_t> nums = random_shuffle(count);
+        for (auto num : nums)
+            skiplist.insert(num * 2, "zhang");
+
+        std::vector<std::pair<int, std::string>> batch;
+        for (int i = 1000; i <= 3000; ++i)
+            batch.emplace_back(i, "yang");
+
+        assert(skiplist.mergeSorted(batch.begin(), batch.end()) == 2001 - 501);
+        assert(skiplist.size() == count + 1500);
+        for (size_t i = 1; i <= skiplist.size(); ++i)
+            assert(skiplist.rank(skiplist.atRank(i)->first) == i);
+        assert(skiplist.find(1000)->second == "zhang");
+        assert(skiplist.find(1001)->second == "yang");
+        assert(skiplist.rank(3000) == skiplist.size());
+        assert(skiplist.revrange(0, 5000).size() == skiplist.size());
+        assert(skiplist.eraseRange(0, 999) == 499);
+        assert(skiplist.atRank(1)->first == 1000);
+        std::cout << "OK" << std::endl;
+    }
+
+    std::cout << "\nbulk build speed: " << std::endl; {
+        std::vector<std::pair<long, long>> sorted;
+        const size_t count = 20000;
+        for (size_t i = 0; i < count; ++i)
+            sorted.emplace_back(i, i);
+
+        auto start = std::chrono::steady_clock::now();
+        SKIPLIST<long, long> sl1;
+        for (auto &e : sorted)
+            sl1.insert(e.first, e.second);
+        auto mid = std::chrono::steady_clock::now();
+        auto sl2 = SKIPLIST<long, long>::fromSorted(sorted.begin(), sorted.end());
+        auto stop = std::chrono::steady_clock::now();
+        assert(sl1.size() == sl2.size());
+
+        std::cout << std::dec << count << " elements, insert: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(mid - start).count() << "usec, fromSorted: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(stop - mid).count() << "usec" << std::endl;
+    }
+
+    std::cout << "\nappend: " << std::endl; {
+        SKIPLIST<int, std::string, std::less<int>> skiplist;
+        for (int i = 1; i <= 1000; ++i)
+            assert(skiplist.append(i, "zhang"));
+        assert(!skiplist.append(1000, "yang"));
+        assert(!skiplist.append(5, "yang"));
+        checkConsistency(skiplist);
+
+        // sliding time window: append at the tail, expire from the head
+        for (int i = 1001; i <= 5000; ++i)
+        {
+            assert(skiplist.insert(i, "zhang"));
+            if (i % 100 == 0)
+                assert(skiplist.eraseRange(0, i - 1000) == 100);
+        }
+        assert(skiplist.size() == 1000);
+        checkConsistency(skiplist);
+
+        // slightly out of order keys go through the tail finger
+        for (int i = 5010; i <= 6000; i += 10)
+        {
+            assert(skiplist.insert(i, "zhang"));
+            assert(skiplist.insert(i - 5, "yang"));
+        }
+        checkConsistency(skiplist);
+        assert(skiplist.revrange(0, 10000).size() == skiplist.size());
+        assert(skiplist.erase(6000) && skiplist.erase(5995));
+        assert(skiplist.append(6001, "zhang"));
+        checkConsistency(skiplist);
+        std::cout << "OK" << std::endl;
+    }
+
+    std::cout << "\nmonotonic insert speed: " << std::endl; {
+        const long count = 200000;
+        auto start = std::chrono::steady_clock::now();
+        SKIPLIST<long, long> sl;
+        for (long i = 0; i < count; ++i)
+            sl.insert(i, i);
+        auto stop = std::chrono::steady_clock::now();
+        assert(sl.size() == count);
+
+        std::cout << std::dec << count << " increasing keys: "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() << "usec" << std::endl;
+    }
+
+    // pass the largest size as 10^argv[1], e.g. 8 for 10^8 elements
+    int maxExp = argc > 1 ? atoi(argv[1]) : 5;
+    std::cout << "\nlevel policy scaling: " << std::endl; {
+        // the old fixed policy degrades towards linear, stop it at 10^5
+        benchPolicy<skiplistLevelPolicy<8, 3, 4>>("max 8, p 3/4", std::min(maxExp, 5));
+        benchPolicy<skiplistLevelPolicy<16, 1, 2>>("max 16, p 1/2", maxExp);
+        benchPolicy<skiplistLevelPolicy<32, 1, 4>>("max 32, p 1/4", maxExp);
+        benchPolicy<skiplistLevelPolicy<32, 1, 8>>("max 32, p 1/8", maxExp);
+    }
+
     return 0;
 }
@@ -1,4 +1,4 @@
-#ifndef BOMENG_REDIS_SKUPLIST_H
+#ifndef BOMENG_REDIS_SKIPLIST_H
 #define BOMENG_REDIS_SKIPLIST_H
 
 #include <vector>
@@ -6,8 +6,67 @@
 #include <cassert>
 #include <ostream>
 #include <functional>
+#include <iterator>
+#include <atomic>
+#include <set>
+#include <stdint.h>
 
-template <typename K, typename V, typename Cmp = std::less<K>>
+/* Level policy of SKIPLIST: at most MaxLevel levels, each extra level
+ * drawn with probability P = Num / Den. Every list owns its generator
+ * (xorshift64*), so lists never share or reseed global PRNG state.
+ * The default matches Redis: 32 levels, P = 0.25. */
+template <int MaxLevel = 32, unsigned Num = 1, unsigned Den = 4>
+class skiplistLevelPolicy
+{
+    static_assert(MaxLevel >= 1 && Num > 0 && Num < Den, "invalid skiplist level policy");
+
+public:
+    static constexpr int maxLevel = MaxLevel;
+    /* Expected number of nodes skipped per level, 1 / P */
+    static constexpr unsigned fanout = (Den + Num - 1) / Num;
+
+private:
+    uint64_t s_;
+
+    uint64_t next()
+    {
+        s_ ^= s_ >> 12;
+        s_ ^= s_ << 25;
+        s_ ^= s_ >> 27;
+        return s_ * 2685821657736338717ULL;
+    }
+
+public:
+    skiplistLevelPolicy()
+    {
+        /* splitmix64 of a process wide sequence number and the address */
+        static std::atomic<uint64_t> seq{0};
+        uint64_t z = (seq.fetch_add(1) + 1) * 0x9E3779B97F4A7C15ULL ^ (uint64_t)(uintptr_t)this;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        s_ = (z ^ (z >> 31)) | 1;
+    }
+
+    size_t randomLevel()
+    {
+        size_t level = 1;
+        if constexpr ((Den & (Den - 1)) == 0 && Num == 1)
+        {
+            /* P = 1/2^b: count runs of b zero bits in a single draw */
+            constexpr int bits = __builtin_ctz(Den);
+            level += __builtin_ctzll(next() | (1ULL << 63)) / bits;
+        }
+        else
+        {
+            const uint64_t threshold = ((uint64_t)Num << 32) / Den;
+            while (level < MaxLevel && (next() >> 32) < threshold)
+                level += 1;
+        }
+        return (level < MaxLevel) ? level : MaxLevel;
+    }
+};
+
+template <typename K, typename V, typename Cmp = std::less<K>, typename Policy = skiplistLevelPolicy<>>
 class SKIPLIST
 {
 private:
@@ -21,18 +80,29 @@ private:
 
         std::pair<K, V> data;
         skiplistNode *backward = nullptr;
+        /* Value of version_ when the node was linked, see snapshot */
+        uint64_t version = 0;
         std::vector<skiplistLevel> level;
 
-        skiplistNode(K s, V val, size_t l) : data({s, val}), level(l)
+        /* data is constructed in place from args */
+        template <typename... Args>
+        skiplistNode(size_t l, Args &&...args) : data(std::forward<Args>(args)...), level(l)
         {
             assert(l >= 1);
         }
     };
 
-    static constexpr int maxLevel = 8;
-    static constexpr double probability = 0.75;
+    static constexpr int maxLevel = Policy::maxLevel;
 
 public:
+    /* Key interval used by the range functions, as in ZRANGEBYSCORE.
+     * minex/maxex make the respective end exclusive. */
+    struct rangespec
+    {
+        K min, max;
+        bool minex = false, maxex = false;
+    };
+
     class iterator : public std::iterator<std::bidirectional_iterator_tag, void *>
     {
     private:
@@ -42,13 +112,13 @@ public:
         iterator(skiplistNode *node) : node_(node) {}
         iterator &operator++()
         {
-            node_ = node_->level[0].forward();
+            node_ = node_->level[0].forward;
             return *this;
         }
         iterator operator++(int)
         {
             iterator it(node_);
-            node_ = node_->level[0].forward();
+            node_ = node_->level[0].forward;
             return it;
         }
         iterator &operator--()
@@ -78,13 +148,13 @@ public:
         const_iterator(const skiplistNode *node) : node_(node) {}
         const_iterator &operator++()
         {
-            node_ = node_->level[0].forward();
+            node_ = node_->level[0].forward;
             return *this;
         }
         const_iterator operator++(int)
         {
             const_iterator it(node_);
-            node_ = node_->level[0].forward();
+            node_ = node_->level[0].forward;
             return it;
         }
         const_iterator &operator--()
@@ -110,17 +180,49 @@ private:
     skiplistNode *tail_;
     size_t length_;
     size_t level_;
+    /* last_[i] is the last node with a level i, header_ if there is none.
+     * It is the finger used by append() and by inserts near the tail. */
+    skiplistNode *last_[maxLevel];
+
+private:
+    Policy policy_;
+
+private:
+    /* Nodes unlinked while a snapshot may still need them, ordered by key.
+     * erased is the value of version_ when the node was unlinked. */
+    struct retiredNode
+    {
+        skiplistNode *node;
+        uint64_t erased;
+    };
+
+    struct retiredLess
+    {
+        typedef void is_transparent;
+        bool operator()(const retiredNode &a, const retiredNode &b) const { return Cmp()(a.node->data.first, b.node->data.first); }
+        bool operator()(const retiredNode &a, const K &b) const { return Cmp()(a.node->data.first, b); }
+        bool operator()(const K &a, const retiredNode &b) const { return Cmp()(a, b.node->data.first); }
+    };
+
+    typedef std::multiset<retiredNode, retiredLess> graveyard;
+
+    uint64_t version_ = 0;
+    /* Bumped by every change of the links, so that snapshot iterators know
+     * when their cursors must be looked up again */
+    uint64_t mutations_ = 0;
+    std::multiset<uint64_t> snapshots_;
+    graveyard graveyard_;
 
 private:
     size_t randomLevel()
     {
-        size_t level = 1;
-        while ((random() & 0xFFFF) < (probability * 0xFFFF))
-            level += 1;
-        return (level < maxLevel) ? level : maxLevel;
+        return policy_.randomLevel();
     }
 
-    skiplistNode *_find(K key) const
+    /* Lookups are templated on the key type: Q is K, or with a transparent
+     * Cmp anything Cmp can compare against K (string_view, raw bytes...). */
+    template <typename Q>
+    skiplistNode *_find(const Q &key) const
     {
         skiplistNode *x = header_;
         for (int i = level_ - 1; i >= 0; --i)
@@ -133,68 +235,440 @@ private:
         return nullptr;
     }
 
-public:
-    SKIPLIST()
+    template <typename Q>
+    skiplistNode *_lowerBound(const Q &key) const
     {
-        srand(time(NULL));
-        level_ = 1;
-        length_ = 0;
-        header_ = new skiplistNode(K(), V(), maxLevel);
-        for (int i = 0; i < maxLevel; ++i)
+        skiplistNode *x = header_;
+        for (int i = level_ - 1; i >= 0; --i)
+            while (x->level[i].forward && Cmp()(x->level[i].forward->data.first, key))
+                x = x->level[i].forward;
+        return x->level[0].forward;
+    }
+
+    template <typename Q>
+    skiplistNode *_upperBound(const Q &key) const
+    {
+        skiplistNode *x = header_;
+        for (int i = level_ - 1; i >= 0; --i)
+            while (x->level[i].forward && !Cmp()(key, x->level[i].forward->data.first))
+                x = x->level[i].forward;
+        return x->level[0].forward;
+    }
+
+    template <typename Q>
+    size_t _rank(const Q &key) const
+    {
+        size_t rank = 0;
+        skiplistNode *x = header_;
+        for (int i = level_ - 1; i >= 0; --i)
         {
-            header_->level[i].forward = nullptr;
-            header_->level[i].span = 0;
+            while (x->level[i].forward && !Cmp()(key, x->level[i].forward->data.first))
+            {
+                rank += x->level[i].span;
+                x = x->level[i].forward;
+            }
+
+            /* x may be equal to key only once we have walked past the header */
+            if (x != header_ && !Cmp()(x->data.first, key))
+                return rank;
         }
-        header_->backward = nullptr;
-        tail_ = header_;
+        return 0;
     }
 
-    SKIPLIST(const SKIPLIST &sl)
+    /* Return the node at the given 1-based rank, or nullptr when out of range.
+     * Only the spans are used, so this is O(log n). */
+    skiplistNode *_atRank(size_t rank) const
     {
-        // 初始化
-        level_ = 1;
-        length_ = 0;
-        header_ = new skiplistNode(K(), V(), maxLevel);
-        for (int i = 0; i < maxLevel; ++i)
+        if (rank == 0 || rank > length_)
+            return nullptr;
+
+        size_t traversed = 0;
+        skiplistNode *x = header_;
+        for (int i = level_ - 1; i >= 0; --i)
         {
-            header_->level[i].forward = nullptr;
-            header_->level[i].span = 0;
+            while (x->level[i].forward && traversed + x->level[i].span <= rank)
+            {
+                traversed += x->level[i].span;
+                x = x->level[i].forward;
+            }
+            if (traversed == rank)
+                return x;
         }
-        header_->backward = nullptr;
-        tail_ = header_;
+        return nullptr;
+    }
 
-        // 拷贝
-        std::vector<skiplistNode*> vec;
-        vec.reserve(sl.length_+1);
-        vec.push_back(header_);
-        skiplistNode* x = sl.header_->level[0].forward;
-        while(x){
-            tail_->level[0].forward = new skiplistNode(x->data.first, x->data.second, x->level.size());
-            tail_->level[0].forward->backward = tail_;
-            tail_ = tail_->level[0].forward;
-            vec.push_back(tail_);
+    /* Unlink x from every level, update[i] being the rightmost node before x
+     * at level i. The node is not freed. */
+    void _unlinkNode(skiplistNode *x, skiplistNode **update)
+    {
+        for (size_t i = 0; i < level_; ++i)
+        {
+            if (update[i]->level[i].forward == x)
+            {
+                update[i]->level[i].span += x->level[i].span - 1;
+                update[i]->level[i].forward = x->level[i].forward;
+            }
+            else
+                update[i]->level[i].span -= 1;
 
-            x = x->level[0].forward;
+            if (last_[i] == x)
+                last_[i] = update[i];
+        }
+
+        if (x->level[0].forward)
+            x->level[0].forward->backward = x->backward;
+        else
+            tail_ = x->backward;
+
+        while (level_ > 1 && header_->level[level_ - 1].forward == nullptr)
+            --level_;
+
+        --length_;
+        ++mutations_;
+    }
+
+    /* Whether an active snapshot can see x, unlinked at version erased: one
+     * was taken between its insertion and its removal. */
+    bool _pinned(const skiplistNode *x, uint64_t erased) const
+    {
+        auto s = snapshots_.lower_bound(x->version);
+        return s != snapshots_.end() && *s < erased;
+    }
+
+    /* Free a node that has been unlinked, or keep it for the snapshots that
+     * can still see it. */
+    void _retire(skiplistNode *x)
+    {
+        if (_pinned(x, version_))
+            graveyard_.insert({x, version_});
+        else
+            delete x;
+    }
+
+    /* Unlink the contiguous run of nodes following update[0] for as long as
+     * inRun(node) holds, and free them. The links and spans of every level are
+     * fixed once at the end, so this is O(level + removed). */
+    template <typename Pred>
+    size_t _eraseRun(skiplistNode **update, Pred inRun)
+    {
+        skiplistNode *last[maxLevel];
+        size_t spans[maxLevel];
+        size_t removed = 0;
+
+        for (size_t i = 0; i < level_; ++i)
+        {
+            last[i] = nullptr;
+            spans[i] = update[i]->level[i].span;
         }
 
-        // 修改level数组
-        int idx = 0;
-        x = sl.header_;
-        while (x->level[0].forward)
+        skiplistNode *first = update[0]->level[0].forward;
+        skiplistNode *x = first;
+        while (x && inRun(x))
         {
-            for(int i=0; i<vec[idx]->level.size(); ++i)
+            for (size_t i = 0; i < x->level.size(); ++i)
             {
-                vec[idx]->level[i].span = x->level[i].span;
-                vec[idx]->level[i].forward = vec[idx  +  x->level[i].span];
+                last[i] = x;
+                spans[i] += x->level[i].span;
             }
+            removed++;
             x = x->level[0].forward;
-            idx++;
         }
-        for(int i=0; i<tail_->level.size(); ++i)
+        if (removed == 0)
+            return 0;
+
+        for (size_t i = 0; i < level_; ++i)
+        {
+            if (last[i])
+            {
+                update[i]->level[i].forward = last[i]->level[i].forward;
+                update[i]->level[i].span = spans[i] - removed;
+                if (update[i]->level[i].forward == nullptr)
+                    last_[i] = update[i];
+            }
+            else
+                update[i]->level[i].span -= removed;
+        }
+
+        if (x)
+            x->backward = update[0];
+        else
+            tail_ = update[0];
+
+        while (level_ > 1 && header_->level[level_ - 1].forward == nullptr)
+            --level_;
+        length_ -= removed;
+        ++mutations_;
+
+        while (first != x)
         {
-            tail_->level[i].span = 0;
-            tail_->level[i].forward = nullptr;
+            skiplistNode *next = first->level[0].forward;
+            _retire(first);
+            first = next;
         }
+
+        return removed;
+    }
+
+    bool _gteMin(const K &key, const rangespec &range) const
+    {
+        return range.minex ? Cmp()(range.min, key) : !Cmp()(key, range.min);
+    }
+
+    bool _lteMax(const K &key, const rangespec &range) const
+    {
+        return range.maxex ? Cmp()(key, range.max) : !Cmp()(range.max, key);
+    }
+
+    /* First node inside range, its 1-based rank is stored in *rank. */
+    skiplistNode *_firstInRange(const rangespec &range, size_t *rank) const
+    {
+        size_t traversed = 0;
+        skiplistNode *x = header_;
+        for (int i = level_ - 1; i >= 0; --i)
+            while (x->level[i].forward && !_gteMin(x->level[i].forward->data.first, range))
+            {
+                traversed += x->level[i].span;
+                x = x->level[i].forward;
+            }
+
+        x = x->level[0].forward;
+        if (!x || !_lteMax(x->data.first, range))
+            return nullptr;
+        *rank = traversed + 1;
+        return x;
+    }
+
+    /* Last node inside range, its 1-based rank is stored in *rank. */
+    skiplistNode *_lastInRange(const rangespec &range, size_t *rank) const
+    {
+        size_t traversed = 0;
+        skiplistNode *x = header_;
+        for (int i = level_ - 1; i >= 0; --i)
+            while (x->level[i].forward && _lteMax(x->level[i].forward->data.first, range))
+            {
+                traversed += x->level[i].span;
+                x = x->level[i].forward;
+            }
+
+        if (x == header_ || !_gteMin(x->data.first, range))
+            return nullptr;
+        *rank = traversed;
+        return x;
+    }
+
+    /* Rank of last_[i]. The last node of a level spans to the end of the
+     * list, so its rank is length_ minus its span. */
+    size_t _lastRank(size_t i) const
+    {
+        return (last_[i] == header_ || i >= level_) ? 0 : length_ - last_[i]->level[i].span;
+    }
+
+    /* Link x after the current tail. Its key must sort after every key in
+     * the list. Only last_[] is touched, so this is O(1) expected. */
+    skiplistNode *_appendNode(skiplistNode *x)
+    {
+        x->version = version_;
+        ++mutations_;
+        size_t level = x->level.size();
+        if (level > level_)
+        {
+            for (size_t i = level_; i < level; ++i)
+                header_->level[i].span = length_;
+            level_ = level;
+        }
+
+        for (size_t i = 0; i < level; ++i)
+        {
+            last_[i]->level[i].forward = x;
+            last_[i]->level[i].span++;
+            x->level[i].forward = nullptr;
+            x->level[i].span = 0;
+            last_[i] = x;
+        }
+        for (size_t i = level; i < level_; ++i)
+            last_[i]->level[i].span++;
+
+        x->backward = tail_;
+        tail_ = x;
+        ++length_;
+
+        return x;
+    }
+
+    /* Insert the node returned by make() at the position of key, unless key
+     * is already present. make() is only called once the position is known
+     * to be free, so nothing is built for a duplicate. The duplicate check
+     * reuses the insertion descent: only one search is done. */
+    template <typename Make>
+    std::pair<skiplistNode *, bool> _insert(const K &key, Make make)
+    {
+        /* Keys past the current maximum (timestamps, sequence ids) are linked
+         * directly after the tail */
+        if (length_ && Cmp()(tail_->data.first, key))
+            return {_appendNode(make()), true};
+
+        skiplistNode *update[maxLevel];
+        size_t rank[maxLevel];
+
+        /* Finger search from the tail: above the lowest level h whose last
+         * node still sorts before key, last_[] already holds the update
+         * nodes; the descent starts from last_[h]. Keys close to the tail
+         * cost O(log distance), keys near the head one full descent. */
+        int top = (int)level_;
+        int h = 0;
+        while (h < top && last_[h] != header_ && !Cmp()(last_[h]->data.first, key))
+            ++h;
+        for (int i = top - 1; i >= h; --i)
+        {
+            update[i] = last_[i];
+            rank[i] = _lastRank(i);
+        }
+
+        skiplistNode *x = (h < top) ? last_[h] : header_;
+        size_t traversed = (h < top) ? rank[h] : 0;
+        for (int i = h - 1; i >= 0; --i)
+        {
+            while (x->level[i].forward && (Cmp()(x->level[i].forward->data.first, key)))
+            {
+                traversed += x->level[i].span;
+                x = x->level[i].forward;
+            }
+            rank[i] = traversed;
+            update[i] = x;
+        }
+
+        x = x->level[0].forward;
+        if (x && !Cmp()(key, x->data.first))
+            return {x, false};
+
+        x = make();
+        x->version = version_;
+        ++mutations_;
+        size_t level = x->level.size();
+        if (level > level_)
+        {
+            for (size_t i = level_; i < level; ++i)
+            {
+                rank[i] = 0;
+                update[i] = header_;
+                update[i]->level[i].span = length_;
+            }
+            level_ = level;
+        }
+
+        for (size_t i = 0; i < level; ++i)
+        {
+            x->level[i].forward = update[i]->level[i].forward;
+            update[i]->level[i].forward = x;
+            x->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
+            update[i]->level[i].span = (rank[0] - rank[i]) + 1;
+            if (x->level[i].forward == nullptr)
+                last_[i] = x;
+        }
+
+        for (size_t i = level; i < level_; ++i)
+            update[i]->level[i].span++;
+
+        x->backward = update[0]; //(update[0] == header_)? nullptr : update[0];
+        if (x->level[0].forward)
+            x->level[0].forward->backward = x;
+        else
+            tail_ = x;
+
+        ++length_;
+
+        return {x, true};
+    }
+
+    /* Bulk linking: nodes are appended in key order after the current tail,
+     * last[i] being the last node with a level i and lastRank[i] its rank.
+     * Each append only touches those nodes, so building n nodes is O(n).
+     * _bulkBegin() starts from the current last node of every level. */
+    void _bulkBegin(skiplistNode **last, size_t *lastRank)
+    {
+        for (int i = 0; i < maxLevel; ++i)
+        {
+            last[i] = last_[i];
+            lastRank[i] = _lastRank(i);
+        }
+    }
+
+    void _bulkAppend(skiplistNode *x, skiplistNode **last, size_t *lastRank)
+    {
+        size_t rank = ++length_;
+        for (size_t i = 0; i < x->level.size(); ++i)
+        {
+            last[i]->level[i].forward = x;
+            last[i]->level[i].span = rank - lastRank[i];
+            last[i] = x;
+            lastRank[i] = rank;
+        }
+
+        x->backward = tail_;
+        tail_ = x;
+        if (x->level.size() > level_)
+            level_ = x->level.size();
+    }
+
+    void _bulkEnd(skiplistNode **last, size_t *lastRank)
+    {
+        for (size_t i = 0; i < maxLevel; ++i)
+        {
+            last[i]->level[i].forward = nullptr;
+            last[i]->level[i].span = (i < level_) ? length_ - lastRank[i] : 0;
+            last_[i] = last[i];
+        }
+    }
+
+    /* Convert ZRANGE style indexes (0-based, negative counts from the tail)
+     * into an inclusive 1-based rank range. Return false if it is empty. */
+    bool _normalizeRange(long &start, long &stop) const
+    {
+        long llen = length_;
+        if (start < 0)
+            start = llen + start;
+        if (stop < 0)
+            stop = llen + stop;
+        if (start < 0)
+            start = 0;
+
+        if (start > stop || start >= llen)
+            return false;
+        if (stop >= llen)
+            stop = llen - 1;
+
+        start += 1;
+        stop += 1;
+        return true;
+    }
+
+public:
+    SKIPLIST()
+    {
+        level_ = 1;
+        length_ = 0;
+        header_ = new skiplistNode(maxLevel);
+        for (int i = 0; i < maxLevel; ++i)
+        {
+            header_->level[i].forward = nullptr;
+            header_->level[i].span = 0;
+        }
+        header_->backward = nullptr;
+        tail_ = header_;
+        for (int i = 0; i < maxLevel; ++i)
+            last_[i] = header_;
+    }
+
+    SKIPLIST(const SKIPLIST &sl)
+        : SKIPLIST()
+    {
+        // 拷贝, 节点保持原来的层数
+        skiplistNode *last[maxLevel];
+        size_t lastRank[maxLevel];
+        _bulkBegin(last, lastRank);
+        for (skiplistNode *x = sl.header_->level[0].forward; x; x = x->level[0].forward)
+            _bulkAppend(new skiplistNode(x->level.size(), x->data), last, lastRank);
+        _bulkEnd(last, lastRank);
     }
 
     SKIPLIST &operator=(const SKIPLIST &sl)
@@ -209,6 +683,8 @@ public:
 
     SKIPLIST(SKIPLIST &&sl)
     {
+        assert(sl.snapshots_.empty());
+        version_ = sl.version_;
         header_ = sl.header_;
         tail_ = sl.tail_;
         length_ = sl.length_;
@@ -216,11 +692,13 @@ public:
 
         sl.level_ = 1;
         sl.length_ = 0;
-        sl.header_ = new skiplistNode(K(), V(), maxLevel);
+        sl.header_ = new skiplistNode(maxLevel);
         for (int i = 0; i < maxLevel; ++i)
         {
             sl.header_->level[i].forward = nullptr;
             sl.header_->level[i].span = 0;
+            last_[i] = sl.last_[i];
+            sl.last_[i] = sl.header_;
         }
         sl.header_->backward = nullptr;
         sl.tail_ = sl.header_;
@@ -228,25 +706,34 @@ public:
 
     SKIPLIST &operator=(SKIPLIST &&sl)
     {
-        if (this = &sl)
+        if (this == &sl)
             return *this;
 
+        assert(snapshots_.empty() && sl.snapshots_.empty());
         this->clear();
         skiplistNode *t = header_;
         header_ = sl.header_;
         tail_ = sl.tail_;
         length_ = sl.length_;
         level_ = sl.level_;
+        version_ = sl.version_;
         sl.header_ = t;
         sl.tail_ = sl.header_;
         sl.length_ = 0;
         sl.level_ = 1;
+        for (int i = 0; i < maxLevel; ++i)
+        {
+            last_[i] = sl.last_[i];
+            sl.last_[i] = sl.header_;
+        }
 
         return *this;
     }
 
+    /* Snapshots must not outlive their list */
     ~SKIPLIST()
     {
+        assert(snapshots_.empty());
         clear();
         delete header_;
         header_ = nullptr;
@@ -254,67 +741,204 @@ public:
     }
 
 public:
-    iterator begin() { return iterator(header_->level[0]); }
+    iterator begin() { return iterator(header_->level[0].forward); }
     iterator end() { return iterator(nullptr); }
-    const_iterator cbegin() { return const_iterator(header_->level[0]); }
+    const_iterator cbegin() { return const_iterator(header_->level[0].forward); }
     const_iterator cend() { return const_iterator(nullptr); }
-    size_t size() { return length_; }
-    bool empty() { return length_ == 0; }
+    size_t size() const { return length_; }
+    bool empty() const { return length_ == 0; }
 
 public:
+    /* Build a list from the elements in [first, last), which must be sorted
+     * by Cmp without duplicates, in one linear pass. By default the levels
+     * are deterministic: the list is perfectly balanced, with the fanout
+     * chosen so that the top level stays small for maxLevel levels. With
+     * randomized set, levels are drawn as insert() does. */
+    template <typename It>
+    static SKIPLIST fromSorted(It first, It last, bool randomized = false)
+    {
+        SKIPLIST sl;
+        size_t n = std::distance(first, last);
+
+        size_t fanout = Policy::fanout > 2 ? Policy::fanout : 2;
+        while (true)
+        {
+            double top = n;
+            for (int i = 1; i < maxLevel; ++i)
+                top /= fanout;
+            if (top <= fanout)
+                break;
+            fanout++;
+        }
+
+        skiplistNode *lastNode[maxLevel];
+        size_t lastRank[maxLevel];
+        sl._bulkBegin(lastNode, lastRank);
+        for (size_t rank = 1; first != last; ++first, ++rank)
+        {
+            assert(sl.length_ == 0 || Cmp()(sl.tail_->data.first, first->first));
+
+            size_t level = 1;
+            if (randomized)
+                level = sl.randomLevel();
+            else
+                for (size_t r = rank; level < maxLevel && r % fanout == 0; r /= fanout)
+                    level++;
+
+            sl._bulkAppend(new skiplistNode(level, first->first, first->second), lastNode, lastRank);
+        }
+        sl._bulkEnd(lastNode, lastRank);
+
+        return sl;
+    }
+
+    /* Insert the sorted elements of [first, last) by merging them with the
+     * list in one O(n + m) pass. Existing nodes are relinked, not copied, and
+     * keys already present are skipped. Return the number inserted. For a
+     * batch much smaller than the list, insert() each element instead. */
+    template <typename It>
+    size_t mergeSorted(It first, It last)
+    {
+        skiplistNode *x = header_->level[0].forward;
+        size_t inserted = 0;
+        ++mutations_;
+
+        for (int i = 0; i < maxLevel; ++i)
+        {
+            header_->level[i].forward = nullptr;
+            header_->level[i].span = 0;
+            last_[i] = header_;
+        }
+        level_ = 1;
+        length_ = 0;
+        tail_ = header_;
+
+        skiplistNode *lastNode[maxLevel];
+        size_t lastRank[maxLevel];
+        _bulkBegin(lastNode, lastRank);
+        while (x || first != last)
+        {
+            if (x && (first == last || !Cmp()(first->first, x->data.first)))
+            {
+                if (first != last && !Cmp()(x->data.first, first->first))
+                    ++first;
+
+                skiplistNode *next = x->level[0].forward;
+                _bulkAppend(x, lastNode, lastRank);
+                x = next;
+            }
+            else
+            {
+                assert(tail_ == header_ || Cmp()(tail_->data.first, first->first));
+                skiplistNode *n = new skiplistNode(randomLevel(), first->first, first->second);
+                n->version = version_;
+                _bulkAppend(n, lastNode, lastRank);
+                ++first;
+                ++inserted;
+            }
+        }
+        _bulkEnd(lastNode, lastRank);
+
+        return inserted;
+    }
+
     bool insert(K key, V val)
     {
-        if (find(key) != end())
+        return try_emplace(std::move(key), std::move(val)).second;
+    }
+
+    /* Fast path for monotonically increasing keys: O(1) expected, no
+     * descent. Return false without inserting if key does not sort after
+     * every key in the list. */
+    bool append(K key, V val)
+    {
+        if (length_ && !Cmp()(tail_->data.first, key))
             return false;
 
+        _appendNode(new skiplistNode(randomLevel(), std::move(key), std::move(val)));
+        return true;
+    }
+
+    /* Construct an element from args, as std::map::emplace does, and insert
+     * it if its key is not present yet. Return an iterator to the element
+     * with that key and whether it was inserted. */
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args &&...args)
+    {
+        skiplistNode *x = new skiplistNode(randomLevel(), std::forward<Args>(args)...);
+        auto res = _insert(x->data.first, [x]() { return x; });
+        if (!res.second)
+            delete x;
+        return {iterator(res.first), res.second};
+    }
+
+    /* Insert (key, V(args...)) if key is not present. Neither the key nor the
+     * value is copied or built when key already exists. */
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const K &key, Args &&...args)
+    {
+        auto res = _insert(key, [&]() {
+            return new skiplistNode(randomLevel(), std::piecewise_construct, std::forward_as_tuple(key),
+                                    std::forward_as_tuple(std::forward<Args>(args)...));
+        });
+        return {iterator(res.first), res.second};
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(K &&key, Args &&...args)
+    {
+        auto res = _insert(key, [&]() {
+            return new skiplistNode(randomLevel(), std::piecewise_construct, std::forward_as_tuple(std::move(key)),
+                                    std::forward_as_tuple(std::forward<Args>(args)...));
+        });
+        return {iterator(res.first), res.second};
+    }
+
+    /* Change the key of the element curKey to newKey, as ZINCRBY does with
+     * the score. When the element stays between its neighbours the key is
+     * rewritten in place, otherwise the element is moved. newKey must not
+     * belong to another element. Return the element, or end() if curKey is
+     * not present. */
+    iterator updateKey(const K &curKey, K newKey)
+    {
         skiplistNode *update[maxLevel];
-        size_t rank[maxLevel];
         skiplistNode *x = header_;
 
         for (int i = level_ - 1; i >= 0; --i)
         {
-            rank[i] = i == (level_ - 1) ? 0 : rank[i + 1];
-            while (x->level[i].forward && (Cmp()(x->level[i].forward->data.first, key)))
-            {
-                rank[i] += x->level[i].span;
+            while (x->level[i].forward && Cmp()(x->level[i].forward->data.first, curKey))
                 x = x->level[i].forward;
-            }
             update[i] = x;
         }
 
-        int level = randomLevel();
-        if (level > level_)
+        x = x->level[0].forward;
+        if (!x || Cmp()(curKey, x->data.first))
+            return end();
+
+        /* A snapshot may still see the element under curKey: leave that
+         * node alone and insert a copy under newKey. */
+        if (!snapshots_.empty())
         {
-            for (int i = level_; i < level; ++i)
-            {
-                rank[i] = 0;
-                update[i] = header_;
-                update[i]->level[i].span = length_;
-            }
-            level_ = level;
+            V val = x->data.second;
+            _unlinkNode(x, update);
+            _retire(x);
+            return try_emplace(std::move(newKey), std::move(val)).first;
         }
 
-        x = new skiplistNode(key, val, level);
-        for (int i = 0; i < level; ++i)
+        if ((x->backward == header_ || Cmp()(x->backward->data.first, newKey)) &&
+            (x->level[0].forward == nullptr || Cmp()(newKey, x->level[0].forward->data.first)))
         {
-            x->level[i].forward = update[i]->level[i].forward;
-            update[i]->level[i].forward = x;
-            x->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
-            update[i]->level[i].span = (rank[0] - rank[i]) + 1;
+            x->data.first = std::move(newKey);
+            return iterator(x);
         }
 
-        for (int i = level; i < level_; ++i)
-            update[i]->level[i].span++;
-
-        x->backward = update[0]; //(update[0] == header_)? nullptr : update[0];
-        if (x->level[0].forward)
-            x->level[0].forward->backward = x;
-        else
-            tail_ = x;
-
-        ++length_;
-
-        return true;
+        /* Relink the same node at its new position */
+        _unlinkNode(x, update);
+        x->data.first = std::move(newKey);
+        auto res = _insert(x->data.first, [x]() { return x; });
+        if (!res.second)
+            delete x;
+        return iterator(res.first);
     }
 
     bool erase(iterator it)
@@ -325,7 +949,20 @@ public:
         return erase(it->first);
     }
 
-    bool erase(K key)
+    bool erase(const K &key)
+    {
+        return _erase(key);
+    }
+
+    template <typename Q, typename C = Cmp, typename = typename C::is_transparent>
+    bool erase(const Q &key)
+    {
+        return _erase(key);
+    }
+
+private:
+    template <typename Q>
+    bool _erase(const Q &key)
     {
         skiplistNode *update[maxLevel];
         skiplistNode *x = header_;
@@ -338,32 +975,61 @@ public:
         }
 
         x = x->level[0].forward;
-        if(!x || Cmp()(x->data.first, key))
+        if(!x || Cmp()(key, x->data.first))
             return false;
-        
-        for(int i=0; i<level_; ++i)
+
+        _unlinkNode(x, update);
+        _retire(x);
+
+        return true;
+    }
+
+public:
+    /* Remove the elements between the ZRANGE style indexes start and stop,
+     * both inclusive. Return the number of elements removed. */
+    size_t eraseRangeByRank(long start, long stop)
+    {
+        if (!_normalizeRange(start, stop))
+            return 0;
+
+        skiplistNode *update[maxLevel];
+        size_t traversed = 0;
+        skiplistNode *x = header_;
+
+        for (int i = level_ - 1; i >= 0; --i)
         {
-            if(update[i]->level[i].forward == x)
+            while (x->level[i].forward && traversed + x->level[i].span < (size_t)start)
             {
-                update[i]->level[i].span += x->level[i].span - 1;
-                update[i]->level[i].forward = x->level[i].forward;
+                traversed += x->level[i].span;
+                x = x->level[i].forward;
             }
-            else
-                update[i]->level[i].span -= 1;
+            update[i] = x;
         }
 
-        if(x->level[0].forward)
-            x->level[0].forward->backward = x->backward;
-        else
-            tail_ = x->backward;
+        size_t remaining = stop - start + 1;
+        return _eraseRun(update, [&remaining](skiplistNode *) { return remaining-- > 0; });
+    }
 
-        while(level_ > 1 && header_->level[level_-1].forward == nullptr)
-            --level_;
-        
-        delete x;
-        --length_;
+    /* ZREMRANGEBYSCORE: remove every element whose key lies in range in a
+     * single pass. Return the number of elements removed. */
+    size_t eraseRange(const rangespec &range)
+    {
+        skiplistNode *update[maxLevel];
+        skiplistNode *x = header_;
 
-        return true;
+        for (int i = level_ - 1; i >= 0; --i)
+        {
+            while (x->level[i].forward && !_gteMin(x->level[i].forward->data.first, range))
+                x = x->level[i].forward;
+            update[i] = x;
+        }
+
+        return _eraseRun(update, [&](skiplistNode *n) { return _lteMax(n->data.first, range); });
+    }
+
+    size_t eraseRange(K min, K max)
+    {
+        return eraseRange(rangespec{min, max});
     }
 
     void clear()
@@ -372,13 +1038,15 @@ public:
         while (t != nullptr)
         {
             skiplistNode *next = t->level[0].forward;
-            delete t;
+            _retire(t);
             t = next;
         }
+        ++mutations_;
         for (int i = 0; i < maxLevel; ++i)
         {
             header_->level[i].forward = nullptr;
             header_->level[i].span = 0;
+            last_[i] = header_;
         }
         level_ = 1;
         length_ = 0;
@@ -386,19 +1054,319 @@ public:
         tail_ = header_;
     }
 
-    iterator find(K key)
+    /* Every lookup taking a key has a second overload, only enabled when Cmp
+     * is transparent (std::less<>, ...), that accepts any type Cmp compares
+     * against K. A SKIPLIST<std::string, V, std::less<>> can then be searched
+     * with a string_view or a char * without building a std::string. */
+    iterator find(const K &key)
+    {
+        return iterator(_find(key));
+    }
+
+    template <typename Q, typename C = Cmp, typename = typename C::is_transparent>
+    iterator find(const Q &key)
     {
         return iterator(_find(key));
     }
 
-    const_iterator find(K key) const
+    const_iterator find(const K &key) const
     {
         return const_iterator(_find(key));
     }
 
+    template <typename Q, typename C = Cmp, typename = typename C::is_transparent>
+    const_iterator find(const Q &key) const
+    {
+        return const_iterator(_find(key));
+    }
+
+    /* First element whose key is not less than key, or end(). */
+    iterator lower_bound(const K &key)
+    {
+        return iterator(_lowerBound(key));
+    }
+
+    template <typename Q, typename C = Cmp, typename = typename C::is_transparent>
+    iterator lower_bound(const Q &key)
+    {
+        return iterator(_lowerBound(key));
+    }
+
+    /* First element whose key is greater than key, or end(). */
+    iterator upper_bound(const K &key)
+    {
+        return iterator(_upperBound(key));
+    }
+
+    template <typename Q, typename C = Cmp, typename = typename C::is_transparent>
+    iterator upper_bound(const Q &key)
+    {
+        return iterator(_upperBound(key));
+    }
+
+    /* ZRANGEBYSCORE: elements whose key lies in range, in order, skipping
+     * the first offset matches and returning at most limit (-1: no limit).
+     * The offset is applied through the spans, not by walking. */
+    std::vector<std::pair<K, V>> range(const rangespec &range, size_t offset = 0, long limit = -1) const
+    {
+        std::vector<std::pair<K, V>> result;
+        size_t rank;
+        skiplistNode *x = _firstInRange(range, &rank);
+        if (x && offset)
+        {
+            x = _atRank(rank + offset);
+            if (x && !_lteMax(x->data.first, range))
+                x = nullptr;
+        }
+
+        while (x && limit != 0 && _lteMax(x->data.first, range))
+        {
+            result.push_back(x->data);
+            x = x->level[0].forward;
+            if (limit > 0)
+                --limit;
+        }
+        return result;
+    }
+
+    std::vector<std::pair<K, V>> range(K min, K max, bool minex = false, bool maxex = false,
+                                       size_t offset = 0, long limit = -1) const
+    {
+        return range(rangespec{min, max, minex, maxex}, offset, limit);
+    }
+
+    /* ZREVRANGEBYSCORE: same as range() but from the greatest key down,
+     * following the backward links. */
+    std::vector<std::pair<K, V>> revrange(const rangespec &range, size_t offset = 0, long limit = -1) const
+    {
+        std::vector<std::pair<K, V>> result;
+        size_t rank;
+        skiplistNode *x = _lastInRange(range, &rank);
+        if (x && offset)
+        {
+            x = offset < rank ? _atRank(rank - offset) : nullptr;
+            if (x && !_gteMin(x->data.first, range))
+                x = nullptr;
+        }
+
+        while (x && x != header_ && limit != 0 && _gteMin(x->data.first, range))
+        {
+            result.push_back(x->data);
+            x = x->backward;
+            if (limit > 0)
+                --limit;
+        }
+        return result;
+    }
+
+    std::vector<std::pair<K, V>> revrange(K min, K max, bool minex = false, bool maxex = false,
+                                          size_t offset = 0, long limit = -1) const
+    {
+        return revrange(rangespec{min, max, minex, maxex}, offset, limit);
+    }
+
+    /* Return the 1-based rank of key, or 0 when the key is not present. */
+    size_t rank(const K &key) const
+    {
+        return _rank(key);
+    }
+
+    template <typename Q, typename C = Cmp, typename = typename C::is_transparent>
+    size_t rank(const Q &key) const
+    {
+        return _rank(key);
+    }
+
+    /* Return the element at the given 1-based rank, or end(). */
+    iterator atRank(size_t rank)
+    {
+        return iterator(_atRank(rank));
+    }
+
+    const_iterator atRank(size_t rank) const
+    {
+        return const_iterator(_atRank(rank));
+    }
+
+    /* ZRANGE: elements between the 0-based indexes start and stop, both
+     * inclusive. Negative indexes count from the tail, -1 being the last. */
+    std::vector<std::pair<K, V>> rangeByRank(long start, long stop) const
+    {
+        std::vector<std::pair<K, V>> result;
+        if (!_normalizeRange(start, stop))
+            return result;
+
+        result.reserve(stop - start + 1);
+        skiplistNode *x = _atRank(start);
+        for (long n = stop - start + 1; x && n > 0; --n)
+        {
+            result.push_back(x->data);
+            x = x->level[0].forward;
+        }
+        return result;
+    }
+
+public:
+    /* Point-in-time view of the list. Taking one is O(1): nodes carry the
+     * version they were linked at, and nodes unlinked while a snapshot can
+     * still see them are kept aside (graveyard_) instead of being freed. A
+     * snapshot reads the live nodes that are old enough merged with those
+     * kept aside, so inserts and erases on the list go on at full speed, the
+     * only extra work being an O(log n) insertion into graveyard_ per erase.
+     * Kept nodes are freed when the last snapshot that can see them is
+     * released.
+     *
+     * The membership and keys of a snapshot are frozen. Values are shared
+     * with the list: a value changed in place through a list iterator is
+     * seen by the snapshot too. A snapshot is read in between the writes of
+     * its list, as a background job stepping through it would; it must not
+     * outlive the list, and the list must not be moved while it exists. */
+    class snapshot
+    {
+    private:
+        SKIPLIST *sl_;
+        uint64_t version_;
+        size_t length_;
+
+        friend class SKIPLIST;
+        snapshot(SKIPLIST *sl) : sl_(sl), version_(sl->version_++), length_(sl->length_)
+        {
+            sl->snapshots_.insert(version_);
+        }
+
+        bool _visible(const skiplistNode *x) const { return x->version <= version_; }
+        bool _visible(const retiredNode &r) const { return r.node->version <= version_ && version_ < r.erased; }
+
+    public:
+        /* Walks the live nodes and the retired ones side by side. When the
+         * list changed since the last step, both cursors are looked up
+         * again from the key of the current element. */
+        class iterator : public std::iterator<std::forward_iterator_tag, const void *>
+        {
+        private:
+            const snapshot *snap_;
+            skiplistNode *cur_;
+            skiplistNode *live_;
+            typename graveyard::const_iterator grave_;
+            uint64_t mutations_;
+
+            void _settle()
+            {
+                const graveyard &g = snap_->sl_->graveyard_;
+                while (live_ && !snap_->_visible(live_))
+                    live_ = live_->level[0].forward;
+                while (grave_ != g.end() && !snap_->_visible(*grave_))
+                    ++grave_;
+
+                if (live_ && (grave_ == g.end() || Cmp()(live_->data.first, grave_->node->data.first)))
+                {
+                    cur_ = live_;
+                    live_ = live_->level[0].forward;
+                }
+                else if (grave_ != g.end())
+                {
+                    cur_ = grave_->node;
+                    ++grave_;
+                }
+                else
+                    cur_ = nullptr;
+            }
+
+        public:
+            iterator(const snapshot *snap) : snap_(snap), cur_(nullptr), live_(nullptr) {}
+            iterator(const snapshot *snap, bool) : snap_(snap)
+            {
+                SKIPLIST *sl = snap->sl_;
+                live_ = sl->header_->level[0].forward;
+                grave_ = sl->graveyard_.begin();
+                mutations_ = sl->mutations_;
+                _settle();
+            }
+
+            iterator &operator++()
+            {
+                SKIPLIST *sl = snap_->sl_;
+                if (mutations_ != sl->mutations_)
+                {
+                    live_ = sl->_upperBound(cur_->data.first);
+                    grave_ = sl->graveyard_.upper_bound(cur_->data.first);
+                    mutations_ = sl->mutations_;
+                }
+                _settle();
+                return *this;
+            }
+            iterator operator++(int)
+            {
+                iterator it(*this);
+                ++*this;
+                return it;
+            }
+
+            bool operator==(const iterator &other) const { return cur_ == other.cur_; }
+            bool operator!=(const iterator &other) const { return cur_ != other.cur_; }
+            const std::pair<K, V> &operator*() const { return cur_->data; }
+            const std::pair<K, V> *operator->() const { return &(cur_->data); }
+        };
+
+    public:
+        snapshot(const snapshot &) = delete;
+        snapshot &operator=(const snapshot &) = delete;
+        snapshot(snapshot &&snap) : sl_(snap.sl_), version_(snap.version_), length_(snap.length_)
+        {
+            snap.sl_ = nullptr;
+        }
+
+        ~snapshot()
+        {
+            if (sl_)
+                sl_->_releaseSnapshot(version_);
+        }
+
+        iterator begin() const { return iterator(this, true); }
+        iterator end() const { return iterator(this); }
+        size_t size() const { return length_; }
+
+        /* The element with key as of the snapshot, nullptr if there was none */
+        const std::pair<K, V> *find(const K &key) const
+        {
+            skiplistNode *x = sl_->_find(key);
+            if (x && _visible(x))
+                return &x->data;
+
+            auto r = sl_->graveyard_.equal_range(key);
+            for (auto it = r.first; it != r.second; ++it)
+                if (_visible(*it))
+                    return &it->node->data;
+            return nullptr;
+        }
+    };
+
+    snapshot getSnapshot()
+    {
+        return snapshot(this);
+    }
+
+private:
+    /* Drop the nodes that no remaining snapshot can see */
+    void _releaseSnapshot(uint64_t version)
+    {
+        snapshots_.erase(snapshots_.find(version));
+        for (auto it = graveyard_.begin(); it != graveyard_.end();)
+        {
+            if (_pinned(it->node, it->erased))
+                ++it;
+            else
+            {
+                delete it->node;
+                it = graveyard_.erase(it);
+            }
+        }
+        ++mutations_;
+    }
+
     // for test
-    template <typename K_, typename V_, typename Cmp_>
-    friend std::ostream &operator<<(std::ostream &os, const SKIPLIST<K_, V_, Cmp_> &sl);
+    template <typename K_, typename V_, typename Cmp_, typename Policy_>
+    friend std::ostream &operator<<(std::ostream &os, const SKIPLIST<K_, V_, Cmp_, Policy_> &sl);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,193 @@
+#include "swissdict.h"
+
+#ifdef SWISSDICT_TEST_MAIN
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_map>
+
+using namespace bRedis;
+
+void ok(void)
+{
+    printf("OK\n");
+}
+
+/* Fill a table of a fixed number of slots to the given load, then time
+ * lookups of present and of missing keys. Return {hits, misses} in
+ * millions of lookups per second. */
+template <typename D, typename F>
+std::pair<double, double> lookups(unsigned long slots, double load, F key)
+{
+    D d;
+    d.expand(slots - slots / 8);
+    dictDisableResize();
+    long n = (long)(slots * load);
+    for (long i = 0; i < n; ++i)
+        d.add(key(i), i);
+    dictEnableResize();
+    assert(d.slots() == slots && !d.isRehashing());
+
+    std::mt19937_64 gen(1);
+    std::vector<decltype(key(0))> hits, misses;
+    for (long i = 0; i < n; ++i)
+    {
+        hits.push_back(key(gen() % n));
+        misses.push_back(key(n + gen() % n));
+    }
+
+    auto time = [&d](const std::vector<decltype(key(0))> &probes, long expect) {
+        long found = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (auto &k : probes)
+            found += d.find(k) != nullptr;
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        assert(found == expect);
+        return probes.size() / sec / 1e6;
+    };
+    double hit = time(hits, n);
+    return {hit, time(misses, 0)};
+}
+
+template <typename Chained, typename Swiss, typename F>
+void compare(const char *name, unsigned long slots, F key)
+{
+    printf("  %s keys, %lu slots, M lookups/s (swiss vs chained):\n", name, slots);
+    for (double load : {0.5, 0.6, 0.7, 0.8, 0.9})
+    {
+        auto [shit, smiss] = lookups<Swiss>(slots, load, key);
+        auto [chit, cmiss] = lookups<Chained>(slots, load, key);
+        printf("    load %.1f: hit %6.1f vs %6.1f  miss %6.1f vs %6.1f\n", load, shit, chit, smiss, cmiss);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    printf("Add/find/replace/remove against unordered_map: "); {
+        SWISSDICT<long, long> d;
+        std::unordered_map<long, long> m;
+        srand(1);
+        bool sawRehashing = false;
+        for (int i = 0; i < 400000; ++i)
+        {
+            /* A growing key range: the table grows while tombstones pile up */
+            long k = rand() % (1000 + i / 4);
+            switch (rand() % 4)
+            {
+            case 0:
+                assert(d.add(k, i) == m.emplace(k, i).second);
+                break;
+            case 1:
+                assert(d.replace(k, i) == (m.count(k) == 0));
+                m[k] = i;
+                break;
+            case 2:
+                assert(d.remove(k) == (m.erase(k) == 1));
+                break;
+            case 3:
+            {
+                auto *e = d.find(k);
+                auto it = m.find(k);
+                assert((e == nullptr) == (it == m.end()));
+                assert(!e || e->val == it->second);
+                break;
+            }
+            }
+            assert(d.size() == m.size());
+            sawRehashing |= d.isRehashing();
+        }
+        assert(sawRehashing);
+        for (auto &kv : m)
+            assert(std::get<0>(d.fetchValue(kv.first)) && std::get<1>(d.fetchValue(kv.first)) == kv.second);
+        ok();
+    }
+
+    printf("Incremental growth: "); {
+        SWISSDICT<std::string, int> d;
+        bool sawRehashing = false;
+        for (int i = 0; i < 100000; ++i)
+        {
+            assert(d.add("key:" + std::to_string(i), i));
+            sawRehashing |= d.isRehashing();
+            /* Lookups must see the keys in both tables */
+            assert(d.find("key:" + std::to_string(i / 2))->val == i / 2);
+        }
+        assert(sawRehashing && d.size() == 100000);
+        assert(!d.add("key:5", 0) && d.find("key:100000") == nullptr);
+        ok();
+    }
+
+    printf("Tombstones are reclaimed: "); {
+        SWISSDICT<long, long> d;
+        for (long i = 0; i < 100; ++i)
+            d.add(i, i);
+        while (d.rehash(100))
+            ;
+        size_t slots = d.slots();
+        /* A sliding window of 100 keys: the slot count must not keep growing */
+        for (long i = 100; i < 1000000; ++i)
+        {
+            assert(d.add(i, i) && d.remove(i - 100));
+            assert(d.slots() <= 4 * slots);
+        }
+        assert(d.size() == 100 && d.find(999999) && !d.find(999899));
+        ok();
+    }
+
+    printf("rehashMilliseconds, resize and clear: "); {
+        SWISSDICT<long, long> d;
+        for (long i = 0; i < 1 << 16; ++i)
+            d.add(i, i);
+        while (d.isRehashing())
+            d.rehashMilliseconds(1);
+        size_t slots = d.slots();
+
+        for (long i = 1; i < 1 << 16; ++i)
+            assert(d.remove(i));
+        assert(d.resize() && d.isRehashing());
+        d.rehashMilliseconds(100);
+        assert(!d.isRehashing() && d.slots() == SWISSDICT_GROUP_WIDTH && d.find(0));
+
+        /* Resizing disabled, through the switch shared with DICT: the table
+         * fills up to 15/16 */
+        dictDisableResize();
+        d.expand(1000);
+        while (d.rehash(100))
+            ;
+        slots = d.slots();
+        for (long i = 0; i < (long)(slots - slots / 16); ++i)
+            d.add(i, i);
+        assert(d.slots() == slots);
+        d.add(-1, -1);
+        assert(d.slots() > slots);
+        dictEnableResize();
+
+        d.clear();
+        assert(d.size() == 0 && d.slots() == 0 && !d.find(1));
+        assert(d.add(1, 1) && d.find(1));
+        ok();
+    }
+
+    printf("SDS keys: "); {
+        SWISSDICT<SDS, long> d;
+        for (long i = 0; i < 10000; ++i)
+            assert(d.add(SDS((long long)i), i));
+        assert(!d.add(SDS("42"), 0) && d.find(SDS("42"))->val == 42);
+        assert(d.remove(SDS("9999")) && !d.find(SDS("9999")));
+        ok();
+    }
+
+    unsigned long slots = (argc > 1) ? atol(argv[1]) : 1 << 20;
+    printf("Lookups by load factor:\n");
+    compare<DICT<long, long>, SWISSDICT<long, long>>("long", slots,
+                                                     [](long i) { return i * 0x9E3779B97F4A7C15L; });
+    compare<DICT<std::string, long>, SWISSDICT<std::string, long>>(
+        "std::string", slots, [](long i) { return "key:" + std::to_string(i); });
+
+    return 0;
+}
+#endif
@@ -0,0 +1,420 @@
+#ifndef BOMENG_REDIS_SWISSDICT_H
+#define BOMENG_REDIS_SWISSDICT_H
+
+#include "dict.h"
+#include <new>
+#include <cstring>
+#include <utility>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Number of slots probed together, one control byte each */
+#define SWISSDICT_GROUP_WIDTH 16
+
+/* Open addressing hash table with the DICT API (Swiss table layout).
+ *
+ * Entries live in a flat slot array, with no next pointer and no per-entry
+ * allocation. A parallel array holds one control byte per slot: empty,
+ * deleted, or the low 7 bits of the hash (H2) when the slot is full. The
+ * remaining hash bits (H1) pick a group of 16 slots, and the groups are
+ * probed in triangular order. A lookup compares the 16 control bytes of a
+ * group with H2 in one SSE2 instruction and looks only at matching keys,
+ * stopping at the first group that has an empty slot.
+ *
+ * Growing works as in DICT: ht[1] is allocated and every add, replace and
+ * remove migrates one group from ht[0], so no call rehashes the whole
+ * table. Migrated slots are marked deleted, not empty, so that the probe
+ * sequences of the keys still in ht[0] stay intact. Lookups do not migrate:
+ * a pointer returned by find() or addRaw() stays valid until the next add,
+ * replace, remove or rehash. */
+template <typename K, typename V, typename Hash = dictHash<K>, typename KeyEqual = dictKeyEqual<K>>
+class SWISSDICT
+{
+public:
+    struct Entry
+    {
+        K key;
+        V val;
+
+        Entry(K k, V v) : key(std::move(k)), val(std::move(v)) {}
+    };
+
+private:
+    static constexpr int8_t ctrlEmpty = -128;
+    static constexpr int8_t ctrlDeleted = -2;
+
+    struct SWISSht
+    {
+        int8_t *ctrl;
+        Entry *slots;
+        unsigned long size;
+        unsigned long groupmask;
+        unsigned long used;
+        unsigned long deleted;
+    };
+
+    /* The control bytes of one group as bitmasks, bit i for slot i */
+    struct group
+    {
+#ifdef __SSE2__
+        __m128i ctrl;
+
+        explicit group(const int8_t *p) : ctrl(_mm_load_si128((const __m128i *)p)) {}
+
+        uint32_t match(int8_t h2) const { return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl)); }
+        uint32_t matchEmpty() const { return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(ctrlEmpty), ctrl)); }
+        /* Empty and deleted are the only control bytes with the sign bit */
+        uint32_t matchFree() const { return _mm_movemask_epi8(ctrl); }
+#else
+        const int8_t *ctrl;
+
+        explicit group(const int8_t *p) : ctrl(p) {}
+
+        uint32_t matchIf(bool (*pred)(int8_t, int8_t), int8_t v) const
+        {
+            uint32_t m = 0;
+            for (int i = 0; i < SWISSDICT_GROUP_WIDTH; ++i)
+                m |= (uint32_t)pred(ctrl[i], v) << i;
+            return m;
+        }
+        uint32_t match(int8_t h2) const { return matchIf([](int8_t c, int8_t v) { return c == v; }, h2); }
+        uint32_t matchEmpty() const { return match(ctrlEmpty); }
+        uint32_t matchFree() const { return matchIf([](int8_t c, int8_t) { return c < 0; }, 0); }
+#endif
+    };
+
+private:
+    SWISSht ht[2];
+    long rehashidx;
+
+private:
+    static void _reset(SWISSht &t)
+    {
+        t.ctrl = nullptr;
+        t.slots = nullptr;
+        t.size = 0;
+        t.groupmask = 0;
+        t.used = 0;
+        t.deleted = 0;
+    }
+
+    static unsigned long _h1(unsigned int h) { return h >> 7; }
+    static int8_t _h2(unsigned int h) { return h & 0x7F; }
+
+    /* Smallest power of two number of slots holding size elements under
+     * the 7/8 maximum load */
+    static unsigned long _capacityFor(unsigned long size)
+    {
+        unsigned long i = SWISSDICT_GROUP_WIDTH;
+        while (i - i / 8 < size)
+            i *= 2;
+        return i;
+    }
+
+    /* Whether t must grow before one more slot is taken. With resizing
+     * disabled the table fills up to 15/16. */
+    static bool _full(const SWISSht &t)
+    {
+        unsigned long taken = t.used + t.deleted + 1;
+        return dictCanResize ? taken > t.size - t.size / 8 : taken > t.size - t.size / 16;
+    }
+
+    static void _freeTable(SWISSht &t)
+    {
+        for (unsigned long i = 0; i < t.size; ++i)
+            if (t.ctrl[i] >= 0)
+                t.slots[i].~Entry();
+        free(t.ctrl);
+        ::operator delete(t.slots);
+        _reset(t);
+    }
+
+    Entry *_findIn(const SWISSht &t, const K &key, unsigned int h) const
+    {
+        if (t.used == 0)
+            return nullptr;
+
+        unsigned long g = _h1(h) & t.groupmask;
+        for (unsigned long i = 1; i <= t.groupmask + 1; ++i)
+        {
+            const int8_t *ctrl = t.ctrl + g * SWISSDICT_GROUP_WIDTH;
+            group grp(ctrl);
+            for (uint32_t m = grp.match(_h2(h)); m; m &= m - 1)
+            {
+                Entry *e = t.slots + (ctrl - t.ctrl) + __builtin_ctz(m);
+                if (KeyEqual()(key, e->key))
+                    return e;
+            }
+            if (grp.matchEmpty())
+                return nullptr;
+            g = (g + i) & t.groupmask;
+        }
+        return nullptr;
+    }
+
+    Entry *_find(const K &key, unsigned int h) const
+    {
+        Entry *e = _findIn(ht[0], key, h);
+        if (!e && isRehashing())
+            e = _findIn(ht[1], key, h);
+        return e;
+    }
+
+    /* First free slot on the probe sequence of h. The caller made sure the
+     * key is not in t and that t has room. */
+    static Entry *_insertIn(SWISSht &t, unsigned int h, K &&key, V &&val)
+    {
+        unsigned long g = _h1(h) & t.groupmask;
+        for (unsigned long i = 1;; ++i)
+        {
+            uint32_t m = group(t.ctrl + g * SWISSDICT_GROUP_WIDTH).matchFree();
+            if (m)
+            {
+                unsigned long idx = g * SWISSDICT_GROUP_WIDTH + __builtin_ctz(m);
+                if (t.ctrl[idx] == ctrlDeleted)
+                    t.deleted--;
+                t.ctrl[idx] = _h2(h);
+                t.used++;
+                return new (&t.slots[idx]) Entry(std::move(key), std::move(val));
+            }
+            g = (g + i) & t.groupmask;
+        }
+    }
+
+    /* Free slot idx of t. A group that still has an empty slot ends every
+     * probe sequence that reaches it, so idx can go back to empty. */
+    static void _erase(SWISSht &t, unsigned long idx)
+    {
+        t.slots[idx].~Entry();
+        const int8_t *ctrl = t.ctrl + (idx & ~(unsigned long)(SWISSDICT_GROUP_WIDTH - 1));
+        if (group(ctrl).matchEmpty())
+            t.ctrl[idx] = ctrlEmpty;
+        else
+        {
+            t.ctrl[idx] = ctrlDeleted;
+            t.deleted++;
+        }
+        t.used--;
+    }
+
+    void _rehashStep()
+    {
+        if (isRehashing())
+            rehash(1);
+    }
+
+    void _expandIfNeeded()
+    {
+        if (ht[0].size == 0)
+        {
+            expand(SWISSDICT_GROUP_WIDTH);
+            return;
+        }
+
+        if (isRehashing())
+        {
+            /* ht[1] was sized for the whole migration: only an unusual
+             * insert rate can fill it first, then finish at once */
+            if (_full(ht[1]))
+                while (rehash(100))
+                    ;
+            return;
+        }
+
+        if (_full(ht[0]))
+            expand(ht[0].used * 2);
+    }
+
+public:
+    SWISSDICT() : rehashidx(-1)
+    {
+        _reset(ht[0]);
+        _reset(ht[1]);
+    }
+
+    SWISSDICT(const SWISSDICT &) = delete;
+    SWISSDICT &operator=(const SWISSDICT &) = delete;
+
+    ~SWISSDICT()
+    {
+        _freeTable(ht[0]);
+        _freeTable(ht[1]);
+    }
+
+public:
+    size_t size() const { return ht[0].used + ht[1].used; }
+    size_t slots() const { return ht[0].size + ht[1].size; }
+    bool isRehashing() const { return rehashidx != -1; }
+
+public:
+    /* Create or rebuild the table with room for size elements. Also used
+     * with the current capacity to drop the deleted slots. */
+    bool expand(unsigned long size)
+    {
+        if (isRehashing() || ht[0].used > size)
+            return false;
+
+        unsigned long realsize = _capacityFor(size);
+        if (realsize == ht[0].size && ht[0].deleted == 0)
+            return false;
+
+        SWISSht n;
+        _reset(n);
+        n.size = realsize;
+        n.groupmask = realsize / SWISSDICT_GROUP_WIDTH - 1;
+        n.ctrl = (int8_t *)aligned_alloc(SWISSDICT_GROUP_WIDTH, realsize);
+        if (n.ctrl == nullptr)
+            throw std::runtime_error("Failed to allocate memory");
+        n.slots = (Entry *)::operator new(realsize * sizeof(Entry), std::nothrow);
+        if (n.slots == nullptr)
+        {
+            free(n.ctrl);
+            throw std::runtime_error("Failed to allocate memory");
+        }
+        memset(n.ctrl, ctrlEmpty, realsize);
+
+        if (ht[0].ctrl == nullptr)
+        {
+            ht[0] = n;
+            return true;
+        }
+
+        ht[1] = n;
+        rehashidx = 0;
+        return true;
+    }
+
+    bool resize()
+    {
+        if (!dictCanResize || isRehashing())
+            return false;
+        return expand(ht[0].used);
+    }
+
+    /* Migrate up to n groups from ht[0] to ht[1]. Return whether groups
+     * remain to be migrated. */
+    bool rehash(int n)
+    {
+        if (!isRehashing())
+            return false;
+
+        while (n-- && ht[0].used != 0)
+        {
+            unsigned long base = rehashidx * SWISSDICT_GROUP_WIDTH;
+            for (uint32_t m = ~group(ht[0].ctrl + base).matchFree() & 0xFFFF; m; m &= m - 1)
+            {
+                unsigned long idx = base + __builtin_ctz(m);
+                Entry &e = ht[0].slots[idx];
+                _insertIn(ht[1], Hash()(e.key), std::move(e.key), std::move(e.val));
+                e.~Entry();
+                ht[0].ctrl[idx] = ctrlDeleted;
+                ht[0].used--;
+                ht[0].deleted++;
+            }
+            rehashidx++;
+        }
+
+        if (ht[0].used == 0)
+        {
+            _freeTable(ht[0]);
+            ht[0] = ht[1];
+            _reset(ht[1]);
+            rehashidx = -1;
+            return false;
+        }
+        return true;
+    }
+
+    /* Rehash in steps of 100 groups for about ms milliseconds. Return the
+     * number of groups migrated. */
+    long long rehashMilliseconds(int ms)
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto budget = std::chrono::milliseconds(ms);
+        long long rehashes = 0;
+
+        while (rehash(100))
+        {
+            rehashes += 100;
+            if (std::chrono::steady_clock::now() - start > budget)
+                break;
+        }
+        return rehashes;
+    }
+
+public:
+    bool add(K key, V val)
+    {
+        return addRaw(std::move(key), std::move(val)) != nullptr;
+    }
+
+    /* Add key and return its entry, or nullptr if key is present */
+    Entry *addRaw(K key, V val)
+    {
+        _rehashStep();
+        _expandIfNeeded();
+
+        unsigned int h = Hash()(key);
+        if (_find(key, h))
+            return nullptr;
+
+        return _insertIn(isRehashing() ? ht[1] : ht[0], h, std::move(key), std::move(val));
+    }
+
+    bool replace(K key, V val)
+    {
+        _rehashStep();
+        Entry *entry = _find(key, Hash()(key));
+        if (entry)
+        {
+            entry->val = std::move(val);
+            return false;
+        }
+        return add(std::move(key), std::move(val));
+    }
+
+    Entry *find(const K &key) const
+    {
+        return _find(key, Hash()(key));
+    }
+
+    std::tuple<bool, V> fetchValue(const K &key) const
+    {
+        Entry *he = find(key);
+        if (he)
+            return {true, he->val};
+        return {false, V()};
+    }
+
+    bool remove(const K &key)
+    {
+        _rehashStep();
+
+        unsigned int h = Hash()(key);
+        for (int table = 0; table <= 1; ++table)
+        {
+            Entry *e = _findIn(ht[table], key, h);
+            if (e)
+            {
+                _erase(ht[table], e - ht[table].slots);
+                return true;
+            }
+            if (!isRehashing())
+                break;
+        }
+        return false;
+    }
+
+    void clear()
+    {
+        if (ht[0].ctrl)
+            _freeTable(ht[0]);
+        if (ht[1].ctrl)
+            _freeTable(ht[1]);
+        rehashidx = -1;
+    }
+};
+
+#endif
@@ -0,0 +1,1426 @@
+#include "ziplist.h"
+#include <stdlib.h>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define ZIPLIST_ENCODING_7BIT_UINT 0
+#define ZIPLIST_ENCODING_7BIT_UINT_MASK 0x80
+#define ZIPLIST_ENCODING_6BIT_STR 0x80
+#define ZIPLIST_ENCODING_6BIT_STR_MASK 0xC0
+#define ZIPLIST_ENCODING_13BIT_INT 0xC0
+#define ZIPLIST_ENCODING_13BIT_INT_MASK 0xE0
+#define ZIPLIST_ENCODING_12BIT_STR 0xE0
+#define ZIPLIST_ENCODING_12BIT_STR_MASK 0xF0
+#define ZIPLIST_ENCODING_16BIT_INT 0xF1
+#define ZIPLIST_ENCODING_24BIT_INT 0xF2
+#define ZIPLIST_ENCODING_32BIT_INT 0xF3
+#define ZIPLIST_ENCODING_64BIT_INT 0xF4
+#define ZIPLIST_ENCODING_32BIT_STR 0xF0
+
+/* Longest <encoding> of an integer, or header of a string */
+#define ZIPLIST_MAX_INT_ENCODING_LEN 9
+#define ZIPLIST_MAX_BACKLEN_SIZE 5
+/* Bytes of an entry compared at once by find() */
+#define ZIPLIST_PREFIX_SIZE 16
+
+using namespace bRedis;
+
+namespace
+{
+    /* Parse s as an integer if it is printed canonically, as Redis
+     * lpStringToInt64(): no spaces, no '+', no leading zeros, no "-0" */
+    bool _ziplistStringToInt64(const char *s, size_t slen, long long *value)
+    {
+        const char *p = s;
+        size_t plen = 0;
+        bool negative = false;
+        unsigned long long v;
+
+        if (slen == 0 || slen >= ZIPLIST_INTBUF_SIZE)
+            return false;
+        if (slen == 1 && p[0] == '0')
+        {
+            *value = 0;
+            return true;
+        }
+        if (p[0] == '-')
+        {
+            negative = true;
+            p++;
+            plen++;
+            if (plen == slen)
+                return false;
+        }
+        if (p[0] < '1' || p[0] > '9')
+            return false;
+        v = p[0] - '0';
+        p++;
+        plen++;
+
+        while (plen < slen && p[0] >= '0' && p[0] <= '9')
+        {
+            if (v > ULLONG_MAX / 10)
+                return false;
+            v *= 10;
+            if (v > ULLONG_MAX - (p[0] - '0'))
+                return false;
+            v += p[0] - '0';
+            p++;
+            plen++;
+        }
+        if (plen < slen)
+            return false;
+
+        if (negative)
+        {
+            if (v > (unsigned long long)LLONG_MAX + 1)
+                return false;
+            *value = (long long)(0ULL - v);
+        }
+        else
+        {
+            if (v > LLONG_MAX)
+                return false;
+            *value = v;
+        }
+        return true;
+    }
+
+    /* Write the smallest encoding of v to buf, return its size */
+    size_t _ziplistEncodeInteger(long long v, unsigned char *buf)
+    {
+        if (v >= 0 && v <= 127)
+        {
+            buf[0] = v;
+            return 1;
+        }
+        else if (v >= -4096 && v <= 4095)
+        {
+            if (v < 0)
+                v = ((long long)1 << 13) + v;
+            buf[0] = (v >> 8) | ZIPLIST_ENCODING_13BIT_INT;
+            buf[1] = v & 0xff;
+            return 2;
+        }
+
+        size_t bytes;
+        unsigned char enc;
+        if (v >= -32768 && v <= 32767)
+            bytes = 2, enc = ZIPLIST_ENCODING_16BIT_INT;
+        else if (v >= -8388608 && v <= 8388607)
+            bytes = 3, enc = ZIPLIST_ENCODING_24BIT_INT;
+        else if (v >= -2147483648LL && v <= 2147483647LL)
+            bytes = 4, enc = ZIPLIST_ENCODING_32BIT_INT;
+        else
+            bytes = 8, enc = ZIPLIST_ENCODING_64BIT_INT;
+
+        /* Two's complement on bytes * 8 bits, little endian */
+        uint64_t u = (uint64_t)v;
+        buf[0] = enc;
+        for (size_t i = 0; i < bytes; ++i)
+            buf[1 + i] = (u >> (8 * i)) & 0xff;
+        return 1 + bytes;
+    }
+
+    /* Write the header of a string of len bytes to buf, return its size */
+    size_t _ziplistEncodeString(size_t len, unsigned char *buf)
+    {
+        if (len < 64)
+        {
+            buf[0] = len | ZIPLIST_ENCODING_6BIT_STR;
+            return 1;
+        }
+        else if (len < 4096)
+        {
+            buf[0] = (len >> 8) | ZIPLIST_ENCODING_12BIT_STR;
+            buf[1] = len & 0xff;
+            return 2;
+        }
+        buf[0] = ZIPLIST_ENCODING_32BIT_STR;
+        buf[1] = len & 0xff;
+        buf[2] = (len >> 8) & 0xff;
+        buf[3] = (len >> 16) & 0xff;
+        buf[4] = (len >> 24) & 0xff;
+        return 5;
+    }
+
+    /* Number of bytes of the backlen of an entry of l bytes */
+    inline size_t _ziplistBacklenSize(size_t l)
+    {
+        if (l <= 127)
+            return 1;
+        else if (l < 16383)
+            return 2;
+        else if (l < 2097151)
+            return 3;
+        else if (l < 268435455)
+            return 4;
+        return 5;
+    }
+
+    /* Write l to buf, the low 7 bits in the last byte, every byte but the
+     * first flagged with 128: read from the right, a byte without the flag
+     * is the last one */
+    size_t _ziplistEncodeBacklen(unsigned char *buf, size_t l)
+    {
+        size_t n = _ziplistBacklenSize(l);
+        for (size_t i = n; i-- > 0;)
+        {
+            buf[i] = (l & 127) | (i == 0 ? 0 : 128);
+            l >>= 7;
+        }
+        return n;
+    }
+
+    /* Decode the backlen whose last byte is at p */
+    inline size_t _ziplistDecodeBacklen(const unsigned char *p)
+    {
+        size_t val = 0;
+        unsigned shift = 0;
+        do
+        {
+            val |= (size_t)(p[0] & 127) << shift;
+            if (!(p[0] & 128))
+                break;
+            shift += 7;
+            p--;
+        } while (shift < 35);
+        return val;
+    }
+
+    /* Size of <encoding+data> of the entry at p */
+    inline size_t _ziplistEncodedSize(const unsigned char *p)
+    {
+        unsigned char c = p[0];
+        if ((c & ZIPLIST_ENCODING_7BIT_UINT_MASK) == ZIPLIST_ENCODING_7BIT_UINT)
+            return 1;
+        if ((c & ZIPLIST_ENCODING_6BIT_STR_MASK) == ZIPLIST_ENCODING_6BIT_STR)
+            return 1 + (c & 0x3F);
+        if ((c & ZIPLIST_ENCODING_13BIT_INT_MASK) == ZIPLIST_ENCODING_13BIT_INT)
+            return 2;
+        if ((c & ZIPLIST_ENCODING_12BIT_STR_MASK) == ZIPLIST_ENCODING_12BIT_STR)
+            return 2 + (((size_t)(c & 0xF) << 8) | p[1]);
+        switch (c)
+        {
+        case ZIPLIST_ENCODING_16BIT_INT:
+            return 3;
+        case ZIPLIST_ENCODING_24BIT_INT:
+            return 4;
+        case ZIPLIST_ENCODING_32BIT_INT:
+            return 5;
+        case ZIPLIST_ENCODING_64BIT_INT:
+            return 9;
+        case ZIPLIST_ENCODING_32BIT_STR:
+            return 5 + ((size_t)p[1] | (size_t)p[2] << 8 | (size_t)p[3] << 16 | (size_t)p[4] << 24);
+        default:
+            return 1;
+        }
+    }
+
+    /* Size of the entry at p, backlen included */
+    inline size_t _ziplistEntrySize(const unsigned char *p)
+    {
+        size_t l = _ziplistEncodedSize(p);
+        return l + _ziplistBacklenSize(l);
+    }
+
+    ZIPLIST::entry _ziplistGet(const unsigned char *p)
+    {
+        ZIPLIST::entry e = {nullptr, 0, 0};
+        unsigned char c = p[0];
+        uint64_t uval, negstart, negmax;
+
+        if ((c & ZIPLIST_ENCODING_7BIT_UINT_MASK) == ZIPLIST_ENCODING_7BIT_UINT)
+        {
+            e.lval = c & 0x7F;
+            return e;
+        }
+        if ((c & ZIPLIST_ENCODING_6BIT_STR_MASK) == ZIPLIST_ENCODING_6BIT_STR)
+        {
+            e.slen = c & 0x3F;
+            e.sval = p + 1;
+            return e;
+        }
+        if ((c & ZIPLIST_ENCODING_13BIT_INT_MASK) == ZIPLIST_ENCODING_13BIT_INT)
+        {
+            uval = ((uint64_t)(c & 0x1F) << 8) | p[1];
+            negstart = (uint64_t)1 << 12;
+            negmax = 8191;
+        }
+        else if ((c & ZIPLIST_ENCODING_12BIT_STR_MASK) == ZIPLIST_ENCODING_12BIT_STR)
+        {
+            e.slen = ((uint32_t)(c & 0xF) << 8) | p[1];
+            e.sval = p + 2;
+            return e;
+        }
+        else if (c == ZIPLIST_ENCODING_32BIT_STR)
+        {
+            e.slen = (uint32_t)p[1] | (uint32_t)p[2] << 8 | (uint32_t)p[3] << 16 | (uint32_t)p[4] << 24;
+            e.sval = p + 5;
+            return e;
+        }
+        else
+        {
+            size_t bytes = c == ZIPLIST_ENCODING_16BIT_INT   ? 2
+                           : c == ZIPLIST_ENCODING_24BIT_INT ? 3
+                           : c == ZIPLIST_ENCODING_32BIT_INT ? 4
+                                                             : 8;
+            uval = 0;
+            for (size_t i = 0; i < bytes; ++i)
+                uval |= (uint64_t)p[1 + i] << (8 * i);
+            if (bytes == 8)
+            {
+                e.lval = (long long)uval;
+                return e;
+            }
+            negstart = (uint64_t)1 << (bytes * 8 - 1);
+            negmax = ((uint64_t)1 << (bytes * 8)) - 1;
+        }
+
+        /* Two's complement of the width of the encoding */
+        if (uval >= negstart)
+            e.lval = -(long long)(negmax - uval) - 1;
+        else
+            e.lval = (long long)uval;
+        return e;
+    }
+
+    inline uint32_t _ziplistGetBytes(const unsigned char *lp)
+    {
+        return (uint32_t)lp[0] | (uint32_t)lp[1] << 8 | (uint32_t)lp[2] << 16 | (uint32_t)lp[3] << 24;
+    }
+
+    inline uint32_t _ziplistGetCount(const unsigned char *lp)
+    {
+        return (uint32_t)lp[4] | (uint32_t)lp[5] << 8;
+    }
+
+    /* One byte hash of an entry of l encoded bytes at p, from its first
+     * ZIPLIST_PREFIX_SIZE bytes and its size */
+    inline uint8_t _ziplistTag(const unsigned char *p, size_t l)
+    {
+        uint64_t a = 0, b = 0;
+        size_t n = l < ZIPLIST_PREFIX_SIZE ? l : ZIPLIST_PREFIX_SIZE;
+        memcpy(&a, p, n < 8 ? n : 8);
+        if (n > 8)
+            memcpy(&b, p + 8, n - 8);
+        uint64_t h = a * 0x9E3779B97F4A7C15ULL ^ (b + l) * 0xC2B2AE3D27D4EB4FULL;
+        return h >> 56;
+    }
+
+    /* A string encoded as the entry that would hold it. Entries are
+     * encoded canonically (integers in their smallest encoding), so an
+     * entry holds the string if and only if its encoded bytes are equal. */
+    struct _ziplistNeedle
+    {
+        alignas(16) unsigned char prefix[ZIPLIST_PREFIX_SIZE];
+        size_t prefixLen;
+        /* Data past the prefix */
+        const unsigned char *rest;
+        size_t restLen;
+        /* Size of <encoding+data> */
+        size_t size;
+        uint8_t tag;
+#ifdef __SSE2__
+        __m128i vec;
+        int mask;
+#endif
+
+        _ziplistNeedle(const unsigned char *enc, size_t enclen, const unsigned char *data, size_t len)
+        {
+            memset(prefix, 0, sizeof(prefix));
+            memcpy(prefix, enc, enclen);
+            size_t n = len < ZIPLIST_PREFIX_SIZE - enclen ? len : ZIPLIST_PREFIX_SIZE - enclen;
+            if (n)
+                memcpy(prefix + enclen, data, n);
+            prefixLen = enclen + n;
+            rest = data + n;
+            restLen = len - n;
+            size = enclen + len;
+            tag = _ziplistTag(prefix, size);
+#ifdef __SSE2__
+            vec = _mm_load_si128((const __m128i *)prefix);
+            mask = (1 << prefixLen) - 1;
+#endif
+        }
+
+        /* Whether the entry at p, in a list ending at end, is the needle */
+        bool match(const unsigned char *p, const unsigned char *end) const
+        {
+            if ((size_t)(end - p) < size)
+                return false;
+#ifdef __SSE2__
+            if (end - p >= ZIPLIST_PREFIX_SIZE)
+            {
+                __m128i v = _mm_loadu_si128((const __m128i *)p);
+                if ((_mm_movemask_epi8(_mm_cmpeq_epi8(v, vec)) & mask) != mask)
+                    return false;
+            }
+            else
+#endif
+            if (memcmp(p, prefix, prefixLen) != 0)
+                return false;
+            return restLen == 0 || memcmp(p + prefixLen, rest, restLen) == 0;
+        }
+    };
+
+    /* Bit i set if tags[i] == tag, for 16 tags */
+    inline unsigned _ziplistMatchTags(const uint8_t *tags, uint8_t tag)
+    {
+#ifdef __SSE2__
+        __m128i v = _mm_loadu_si128((const __m128i *)tags);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)tag)));
+#else
+        unsigned bits = 0;
+        for (unsigned i = 0; i < 16; ++i)
+            bits |= (unsigned)(tags[i] == tag) << i;
+        return bits;
+#endif
+    }
+}
+
+/* The tags of the entries, with room for capacity of them, a multiple of
+ * 16, then the offsets of entries 0, ZIPLIST_INDEX_STRIDE,
+ * 2 * ZIPLIST_INDEX_STRIDE... Tags past count are 0. */
+struct ZIPLIST::ziplistIndex
+{
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t allocSize;
+    uint32_t *offsets;
+    uint8_t tags[];
+};
+
+bool ZIPLIST::indexEnabled_ = true;
+
+namespace
+{
+    inline size_t _ziplistIndexBlocks(size_t count)
+    {
+        return (count + ZIPLIST_INDEX_STRIDE - 1) / ZIPLIST_INDEX_STRIDE;
+    }
+}
+
+const ZIPLIST::ziplistIndex *ZIPLIST::buildIndex() const
+{
+    size_t count = len();
+    size_t capacity = (count + 15) & ~(size_t)15;
+    size_t size = sizeof(ziplistIndex) + capacity + _ziplistIndexBlocks(capacity) * sizeof(uint32_t);
+    ziplistIndex *idx = (ziplistIndex *)malloc(size);
+    if (idx == nullptr)
+        throw std::runtime_error("Failed to allocate memory");
+
+    idx->count = count;
+    idx->capacity = capacity;
+    idx->allocSize = size;
+    idx->offsets = (uint32_t *)(idx->tags + capacity);
+    memset(idx->tags + count, 0, capacity - count);
+
+    size_t p = ZIPLIST_HDR_SIZE;
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t l = _ziplistEncodedSize(lp_ + p);
+        idx->tags[i] = _ziplistTag(lp_ + p, l);
+        if (i % ZIPLIST_INDEX_STRIDE == 0)
+            idx->offsets[i / ZIPLIST_INDEX_STRIDE] = p;
+        p += l + _ziplistBacklenSize(l);
+    }
+
+    index_ = idx;
+    return idx;
+}
+
+void ZIPLIST::dropIndex()
+{
+    free(index_);
+    index_ = nullptr;
+}
+
+/* Number of the entry at p, or of the entries if p is the EOF. Only reads
+ * the offsets and the entries before p, so it can be called once the list
+ * has been modified at p. */
+size_t ZIPLIST::indexEntry(size_t p) const
+{
+    const ziplistIndex *idx = index_;
+    size_t blocks = _ziplistIndexBlocks(idx->count);
+    size_t b = std::upper_bound(idx->offsets, idx->offsets + blocks, (uint32_t)p) - idx->offsets;
+    if (b == 0)
+        return 0;
+    b--;
+    size_t k = b * ZIPLIST_INDEX_STRIDE;
+    for (size_t q = idx->offsets[b]; q != p; q += _ziplistEntrySize(lp_ + q))
+        k++;
+    return k;
+}
+
+/* An entry of size bytes was inserted at p */
+void ZIPLIST::indexInserted(size_t p, size_t size)
+{
+    size_t k = indexEntry(p);
+    ziplistIndex *idx = index_;
+    size_t count = idx->count;
+    if (count == idx->capacity)
+    {
+        /* Grow by a quarter, the offsets moving up past the new tags */
+        size_t capacity = (count + count / 4 + 16) & ~(size_t)15;
+        size_t allocSize = sizeof(ziplistIndex) + capacity + _ziplistIndexBlocks(capacity) * sizeof(uint32_t);
+        idx = (ziplistIndex *)realloc(idx, allocSize);
+        if (idx == nullptr)
+        {
+            dropIndex();
+            throw std::runtime_error("Failed to allocate memory");
+        }
+        memmove(idx->tags + capacity, idx->tags + count, _ziplistIndexBlocks(count) * sizeof(uint32_t));
+        memset(idx->tags + count, 0, capacity - count);
+        idx->offsets = (uint32_t *)(idx->tags + capacity);
+        idx->capacity = capacity;
+        idx->allocSize = allocSize;
+        index_ = idx;
+    }
+
+    memmove(idx->tags + k + 1, idx->tags + k, count - k);
+    size_t l = _ziplistEncodedSize(lp_ + p);
+    idx->tags[k] = _ziplistTag(lp_ + p, l);
+
+    /* New entry b * ZIPLIST_INDEX_STRIDE past k is the entry before the
+     * one the block started with, now size bytes further. A block opened
+     * by the insertion starts with the last entry. */
+    size_t oldBlocks = _ziplistIndexBlocks(count), blocks = _ziplistIndexBlocks(count + 1);
+    size_t eof = _ziplistGetBytes(lp_) - 1;
+    for (size_t b = (k + ZIPLIST_INDEX_STRIDE - 1) / ZIPLIST_INDEX_STRIDE; b < blocks; ++b)
+    {
+        if (b * ZIPLIST_INDEX_STRIDE == k)
+            idx->offsets[b] = p;
+        else
+            idx->offsets[b] = prev(b < oldBlocks ? idx->offsets[b] + size : eof);
+    }
+    idx->count = count + 1;
+}
+
+/* count entries of bytes bytes were removed at p */
+void ZIPLIST::indexRemoved(size_t p, size_t count, size_t bytes)
+{
+    if (count == 0)
+        return;
+    size_t k = indexEntry(p);
+    ziplistIndex *idx = index_;
+    size_t oldCount = idx->count, newCount = oldCount - count;
+    memmove(idx->tags + k, idx->tags + k + count, newCount - k);
+    memset(idx->tags + newCount, 0, count);
+
+    size_t blocks = _ziplistIndexBlocks(newCount);
+    size_t b = (k + ZIPLIST_INDEX_STRIDE - 1) / ZIPLIST_INDEX_STRIDE;
+    if (count == 1)
+    {
+        /* New entry b * ZIPLIST_INDEX_STRIDE past k follows the entry the
+         * block started with, now bytes closer */
+        for (; b < blocks; ++b)
+        {
+            if (b * ZIPLIST_INDEX_STRIDE == k)
+                idx->offsets[b] = p;
+            else
+            {
+                size_t q = idx->offsets[b] - bytes;
+                idx->offsets[b] = q + _ziplistEntrySize(lp_ + q);
+            }
+        }
+    }
+    else if (b < blocks)
+    {
+        /* Walk from the last block start before the removed entries */
+        size_t e = k / ZIPLIST_INDEX_STRIDE * ZIPLIST_INDEX_STRIDE;
+        size_t q = e == k ? p : idx->offsets[e / ZIPLIST_INDEX_STRIDE];
+        for (; e < newCount; ++e, q += _ziplistEntrySize(lp_ + q))
+            if (e % ZIPLIST_INDEX_STRIDE == 0)
+                idx->offsets[e / ZIPLIST_INDEX_STRIDE] = q;
+    }
+    idx->count = newCount;
+}
+
+/* The entry at p was replaced, the entries after it moved by delta bytes */
+void ZIPLIST::indexReplaced(size_t p, ptrdiff_t delta)
+{
+    size_t k = indexEntry(p);
+    ziplistIndex *idx = index_;
+    size_t l = _ziplistEncodedSize(lp_ + p);
+    idx->tags[k] = _ziplistTag(lp_ + p, l);
+    if (delta == 0)
+        return;
+    for (size_t b = k / ZIPLIST_INDEX_STRIDE + 1; b < _ziplistIndexBlocks(idx->count); ++b)
+        idx->offsets[b] += delta;
+}
+
+void ZIPLIST::resize(size_t bytes)
+{
+    if (bytes > UINT32_MAX)
+        throw std::runtime_error("ZIPLIST is too large");
+    unsigned char *lp = (unsigned char *)realloc(lp_, bytes);
+    if (lp == nullptr)
+        throw std::runtime_error("Failed to allocate memory");
+    lp_ = lp;
+}
+
+void ZIPLIST::setBytes(size_t bytes)
+{
+    lp_[0] = bytes & 0xff;
+    lp_[1] = (bytes >> 8) & 0xff;
+    lp_[2] = (bytes >> 16) & 0xff;
+    lp_[3] = (bytes >> 24) & 0xff;
+}
+
+/* Past ZIPLIST_NUMELE_UNKNOWN the count is not kept, and len() walks */
+void ZIPLIST::setCount(uint32_t count)
+{
+    if (count > ZIPLIST_NUMELE_UNKNOWN)
+        count = ZIPLIST_NUMELE_UNKNOWN;
+    lp_[4] = count & 0xff;
+    lp_[5] = (count >> 8) & 0xff;
+}
+
+/* Insert an entry made of enc then slen bytes of s, before p or after it */
+size_t ZIPLIST::insertEncoded(size_t p, const unsigned char *enc, size_t enclen, const void *s, size_t slen,
+                              bool after)
+{
+    size_t total = _ziplistGetBytes(lp_);
+    size_t eof = total - 1;
+    size_t dst;
+    if (p == 0)
+        dst = eof;
+    else if (after)
+        dst = p + _ziplistEntrySize(lp_ + p);
+    else
+        dst = p;
+
+    unsigned char backlen[ZIPLIST_MAX_BACKLEN_SIZE];
+    size_t backlenSize = _ziplistEncodeBacklen(backlen, enclen + slen);
+    size_t size = enclen + slen + backlenSize;
+
+    resize(total + size);
+    memmove(lp_ + dst + size, lp_ + dst, total - dst);
+    unsigned char *q = lp_ + dst;
+    memcpy(q, enc, enclen);
+    if (slen)
+        memcpy(q + enclen, s, slen);
+    memcpy(q + enclen + slen, backlen, backlenSize);
+
+    setBytes(total + size);
+    uint32_t count = _ziplistGetCount(lp_);
+    if (count != ZIPLIST_NUMELE_UNKNOWN)
+        setCount(count + 1);
+    if (index_)
+        indexInserted(dst, size);
+    return dst;
+}
+
+size_t ZIPLIST::insertString(size_t p, const void *s, size_t len, bool after)
+{
+    long long value;
+    if (_ziplistStringToInt64((const char *)s, len, &value))
+        return insertInteger(p, value, after);
+
+    unsigned char enc[ZIPLIST_MAX_INT_ENCODING_LEN];
+    size_t enclen = _ziplistEncodeString(len, enc);
+    return insertEncoded(p, enc, enclen, s, len, after);
+}
+
+size_t ZIPLIST::insertInteger(size_t p, long long value, bool after)
+{
+    unsigned char enc[ZIPLIST_MAX_INT_ENCODING_LEN];
+    size_t enclen = _ziplistEncodeInteger(value, enc);
+    return insertEncoded(p, enc, enclen, nullptr, 0, after);
+}
+
+/* Remove count entries spanning bytes bytes from p */
+size_t ZIPLIST::removeRaw(size_t p, size_t count, size_t bytes)
+{
+    size_t total = _ziplistGetBytes(lp_);
+    memmove(lp_ + p, lp_ + p + bytes, total - p - bytes);
+    resize(total - bytes);
+    setBytes(total - bytes);
+
+    uint32_t num = _ziplistGetCount(lp_);
+    if (num != ZIPLIST_NUMELE_UNKNOWN)
+        setCount(num - count);
+    if (index_)
+        indexRemoved(p, count, bytes);
+    return lp_[p] == ZIPLIST_EOF ? 0 : p;
+}
+
+ZIPLIST::ZIPLIST()
+    : lp_(nullptr), index_(nullptr)
+{
+    lp_ = (unsigned char *)malloc(ZIPLIST_HDR_SIZE + 1);
+    if (lp_ == nullptr)
+        throw std::runtime_error("Failed to allocate memory");
+    setBytes(ZIPLIST_HDR_SIZE + 1);
+    setCount(0);
+    lp_[ZIPLIST_HDR_SIZE] = ZIPLIST_EOF;
+}
+
+ZIPLIST::ZIPLIST(const void *data, size_t bytes)
+    : lp_(nullptr), index_(nullptr)
+{
+    if (bytes < ZIPLIST_HDR_SIZE + 1 || _ziplistGetBytes((const unsigned char *)data) != bytes ||
+        ((const unsigned char *)data)[bytes - 1] != ZIPLIST_EOF)
+        throw std::runtime_error("Invalid ZIPLIST");
+    lp_ = (unsigned char *)malloc(bytes);
+    if (lp_ == nullptr)
+        throw std::runtime_error("Failed to allocate memory");
+    memcpy(lp_, data, bytes);
+}
+
+ZIPLIST::ZIPLIST(const ZIPLIST &zl)
+    : lp_(nullptr), index_(nullptr)
+{
+    size_t bytes = zl.bytes();
+    lp_ = (unsigned char *)malloc(bytes);
+    if (lp_ == nullptr)
+        throw std::runtime_error("Failed to allocate memory");
+    memcpy(lp_, zl.lp_, bytes);
+}
+
+ZIPLIST &ZIPLIST::operator=(const ZIPLIST &zl)
+{
+    if (&zl == this)
+        return *this;
+
+    size_t bytes = zl.bytes();
+    unsigned char *lp = (unsigned char *)malloc(bytes);
+    if (lp == nullptr)
+        throw std::runtime_error("Failed to allocate memory");
+    memcpy(lp, zl.lp_, bytes);
+
+    dropIndex();
+    free(lp_);
+    lp_ = lp;
+    return *this;
+}
+
+ZIPLIST::ZIPLIST(ZIPLIST &&zl)
+    : lp_(zl.lp_), index_(zl.index_)
+{
+    zl.lp_ = nullptr;
+    zl.index_ = nullptr;
+}
+
+ZIPLIST &ZIPLIST::operator=(ZIPLIST &&zl)
+{
+    if (&zl == this)
+        return *this;
+
+    dropIndex();
+    free(lp_);
+    lp_ = zl.lp_;
+    index_ = zl.index_;
+    zl.lp_ = nullptr;
+    zl.index_ = nullptr;
+    return *this;
+}
+
+ZIPLIST::~ZIPLIST()
+{
+    dropIndex();
+    free(lp_);
+}
+
+size_t ZIPLIST::first() const
+{
+    return lp_[ZIPLIST_HDR_SIZE] == ZIPLIST_EOF ? 0 : ZIPLIST_HDR_SIZE;
+}
+
+size_t ZIPLIST::last() const
+{
+    return prev(_ziplistGetBytes(lp_) - 1);
+}
+
+size_t ZIPLIST::next(size_t p) const
+{
+    p += _ziplistEntrySize(lp_ + p);
+    return lp_[p] == ZIPLIST_EOF ? 0 : p;
+}
+
+/* Also used on the EOF offset, to get the last entry */
+size_t ZIPLIST::prev(size_t p) const
+{
+    if (p <= ZIPLIST_HDR_SIZE)
+        return 0;
+    size_t l = _ziplistDecodeBacklen(lp_ + p - 1);
+    return p - l - _ziplistBacklenSize(l);
+}
+
+size_t ZIPLIST::seek(long index) const
+{
+    uint32_t count = _ziplistGetCount(lp_);
+    bool forward = index >= 0;
+
+    if (count != ZIPLIST_NUMELE_UNKNOWN)
+    {
+        if (index < 0)
+            index = (long)count + index;
+        if (index < 0 || index >= (long)count)
+            return 0;
+        /* Walk from the nearest end */
+        forward = index <= (long)count / 2;
+        if (!forward)
+            index = index - (long)count;
+    }
+
+    if (forward)
+    {
+        size_t p = first();
+        while (p && index-- > 0)
+            p = next(p);
+        return p;
+    }
+
+    size_t p = last();
+    while (p && ++index < 0)
+        p = prev(p);
+    return p;
+}
+
+ZIPLIST::entry ZIPLIST::get(size_t p) const
+{
+    return _ziplistGet(lp_ + p);
+}
+
+void ZIPLIST::append(const void *s, size_t len)
+{
+    insertString(0, s, len, false);
+}
+
+void ZIPLIST::append(long long value)
+{
+    insertInteger(0, value, false);
+}
+
+void ZIPLIST::prepend(const void *s, size_t len)
+{
+    insertString(ZIPLIST_HDR_SIZE, s, len, false);
+}
+
+void ZIPLIST::prepend(long long value)
+{
+    insertInteger(ZIPLIST_HDR_SIZE, value, false);
+}
+
+size_t ZIPLIST::insert(size_t p, const void *s, size_t len, bool after)
+{
+    return insertString(p, s, len, after);
+}
+
+size_t ZIPLIST::insert(size_t p, long long value, bool after)
+{
+    return insertInteger(p, value, after);
+}
+
+/* Replace the entry at p with enc then slen bytes of s, moving the tail
+ * by the difference in place */
+size_t ZIPLIST::replaceEncoded(size_t p, const unsigned char *enc, size_t enclen, const void *s, size_t slen)
+{
+    unsigned char backlen[ZIPLIST_MAX_BACKLEN_SIZE];
+    size_t backlenSize = _ziplistEncodeBacklen(backlen, enclen + slen);
+    size_t size = enclen + slen + backlenSize;
+
+    size_t total = _ziplistGetBytes(lp_);
+    size_t old = _ziplistEntrySize(lp_ + p);
+    if (size > old)
+        resize(total + size - old);
+    memmove(lp_ + p + size, lp_ + p + old, total - p - old);
+    if (size < old)
+        resize(total + size - old);
+    memcpy(lp_ + p, enc, enclen);
+    if (slen)
+        memcpy(lp_ + p + enclen, s, slen);
+    memcpy(lp_ + p + enclen + slen, backlen, backlenSize);
+    setBytes(total + size - old);
+    if (index_)
+        indexReplaced(p, (ptrdiff_t)size - (ptrdiff_t)old);
+    return p;
+}
+
+size_t ZIPLIST::replace(size_t p, const void *s, size_t len)
+{
+    long long value;
+    if (_ziplistStringToInt64((const char *)s, len, &value))
+        return replace(p, value);
+
+    unsigned char enc[ZIPLIST_MAX_INT_ENCODING_LEN];
+    size_t enclen = _ziplistEncodeString(len, enc);
+    return replaceEncoded(p, enc, enclen, s, len);
+}
+
+size_t ZIPLIST::replace(size_t p, long long value)
+{
+    unsigned char enc[ZIPLIST_MAX_INT_ENCODING_LEN];
+    size_t enclen = _ziplistEncodeInteger(value, enc);
+    return replaceEncoded(p, enc, enclen, nullptr, 0);
+}
+
+size_t ZIPLIST::remove(size_t p)
+{
+    return removeRaw(p, 1, _ziplistEntrySize(lp_ + p));
+}
+
+size_t ZIPLIST::removeRange(long index, size_t count)
+{
+    size_t p = seek(index);
+    if (p == 0 || count == 0)
+        return 0;
+
+    size_t q = p, removed = 0;
+    while (lp_[q] != ZIPLIST_EOF && removed < count)
+    {
+        q += _ziplistEntrySize(lp_ + q);
+        removed++;
+    }
+    removeRaw(p, removed, q - p);
+    return removed;
+}
+
+size_t ZIPLIST::find(const void *s, size_t len, size_t p, unsigned skip) const
+{
+    if (p == 0)
+        return 0;
+
+    unsigned char enc[ZIPLIST_MAX_INT_ENCODING_LEN];
+    long long value;
+    size_t enclen;
+    if (_ziplistStringToInt64((const char *)s, len, &value))
+    {
+        enclen = _ziplistEncodeInteger(value, enc);
+        len = 0;
+    }
+    else
+        enclen = _ziplistEncodeString(len, enc);
+    _ziplistNeedle needle(enc, enclen, (const unsigned char *)s, len);
+    const unsigned char *end = lp_ + _ziplistGetBytes(lp_);
+
+    const ziplistIndex *idx = indexEnabled_ ? index_ : nullptr;
+    if (idx == nullptr && indexEnabled_ && _ziplistGetCount(lp_) >= ZIPLIST_INDEX_MIN_ENTRIES)
+        idx = buildIndex();
+    if (idx == nullptr)
+    {
+        unsigned skipcnt = 0;
+        while (lp_[p] != ZIPLIST_EOF)
+        {
+            const unsigned char *q = lp_ + p;
+            if (skipcnt == 0)
+            {
+                if (needle.match(q, end))
+                    return p;
+                skipcnt = skip;
+            }
+            else
+                skipcnt--;
+            p += _ziplistEntrySize(q);
+        }
+        return 0;
+    }
+
+    size_t start = indexEntry(p);
+
+    for (size_t base = start & ~(size_t)15; base < idx->count; base += 16)
+    {
+        unsigned bits = _ziplistMatchTags(idx->tags + base, needle.tag);
+        if (base < start)
+            bits &= ~0u << (start - base);
+        if (idx->count - base < 16)
+            bits &= (1u << (idx->count - base)) - 1;
+
+        while (bits)
+        {
+            size_t i = base + __builtin_ctz(bits);
+            bits &= bits - 1;
+            if ((i - start) % (skip + 1))
+                continue;
+
+            size_t q = idx->offsets[i / ZIPLIST_INDEX_STRIDE];
+            for (size_t k = i % ZIPLIST_INDEX_STRIDE; k > 0; --k)
+                q += _ziplistEntrySize(lp_ + q);
+            if (needle.match(lp_ + q, end))
+                return q;
+        }
+    }
+    return 0;
+}
+
+bool ZIPLIST::compare(size_t p, const void *s, size_t len) const
+{
+    entry e = _ziplistGet(lp_ + p);
+    if (e.sval)
+        return e.slen == len && memcmp(e.sval, s, len) == 0;
+
+    long long value;
+    return _ziplistStringToInt64((const char *)s, len, &value) && value == e.lval;
+}
+
+size_t ZIPLIST::len() const
+{
+    uint32_t count = _ziplistGetCount(lp_);
+    if (count != ZIPLIST_NUMELE_UNKNOWN)
+        return count;
+
+    size_t n = 0;
+    for (size_t p = first(); p; p = next(p))
+        n++;
+    /* Count again once it fits */
+    if (n < ZIPLIST_NUMELE_UNKNOWN)
+        const_cast<ZIPLIST *>(this)->setCount(n);
+    return n;
+}
+
+size_t ZIPLIST::bytes() const
+{
+    return _ziplistGetBytes(lp_);
+}
+
+const unsigned char *ZIPLIST::data() const
+{
+    return lp_;
+}
+
+size_t ZIPLIST::indexBytes() const
+{
+    return index_ ? index_->allocSize : 0;
+}
+
+#ifdef ZIPLIST_TEST_MAIN
+#include "sds.h"
+#include "skiplist.h"
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cassert>
+#include <cstdio>
+#include <malloc.h>
+
+size_t heapBytes(void)
+{
+    return mallinfo2().uordblks;
+}
+
+void ok(void)
+{
+    printf("OK\n");
+}
+
+std::string entryString(const ZIPLIST::entry &e)
+{
+    if (e.sval)
+        return std::string((const char *)e.sval, e.slen);
+    return std::to_string(e.lval);
+}
+
+/* find() the slow way: decode every entry */
+size_t findDecoded(const ZIPLIST &zl, const std::string &s, size_t p, unsigned skip)
+{
+    for (unsigned i = 0; p; p = zl.next(p), i = (i + 1) % (skip + 1))
+        if (i == 0 && entryString(zl.get(p)) == s)
+            return p;
+    return 0;
+}
+
+/* Walk zl both ways and compare it with the model */
+void check(const ZIPLIST &zl, const std::vector<std::string> &model)
+{
+    assert(zl.len() == model.size());
+    size_t i = 0;
+    for (size_t p = zl.first(); p; p = zl.next(p), ++i)
+        assert(entryString(zl.get(p)) == model[i]);
+    assert(i == model.size());
+    for (size_t p = zl.last(); p; p = zl.prev(p))
+        assert(entryString(zl.get(p)) == model[--i]);
+    assert(i == 0);
+}
+
+/* Print bytes per element and ns per element of a full forward walk, for
+ * n elements written by gen(i, buf), in lists of per elements */
+template <typename Gen>
+void bench(const char *name, long n, long per, Gen gen)
+{
+    char buf[256];
+    long lists = n / per;
+    n = lists * per;
+    printf("  %s, %ld lists of %ld:\n", name, lists, per);
+
+    {
+        size_t before = heapBytes();
+        std::vector<ZIPLIST> v(lists);
+        for (long l = 0; l < lists; ++l)
+            for (long i = 0; i < per; ++i)
+                v[l].append(buf, gen(l * per + i, buf));
+        double bytes = heapBytes() - before;
+
+        long long sum = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (auto &zl : v)
+            for (size_t p = zl.first(); p; p = zl.next(p))
+            {
+                ZIPLIST::entry e = zl.get(p);
+                sum += e.sval ? e.slen + e.sval[0] : e.lval;
+            }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        assert(sum != 0);
+        printf("    %-22s %6.1f bytes/element  %5.2f ns/element\n", "ZIPLIST", bytes / n, ns / n);
+    }
+
+    {
+        size_t before = heapBytes();
+        std::vector<std::vector<bRedis::SDS>> v(lists);
+        for (long l = 0; l < lists; ++l)
+            for (long i = 0; i < per; ++i)
+                v[l].emplace_back(buf, gen(l * per + i, buf));
+        for (auto &vec : v)
+            vec.shrink_to_fit();
+        double bytes = heapBytes() - before;
+
+        long long sum = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (auto &vec : v)
+            for (auto &s : vec)
+                sum += s.len() + s.buf()[0];
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        assert(sum != 0);
+        printf("    %-22s %6.1f bytes/element  %5.2f ns/element\n", "std::vector<SDS>", bytes / n, ns / n);
+    }
+
+    {
+        size_t before = heapBytes();
+        std::vector<SKIPLIST<long, bRedis::SDS>> v(lists);
+        for (long l = 0; l < lists; ++l)
+            for (long i = 0; i < per; ++i)
+                v[l].insert(i, bRedis::SDS(buf, gen(l * per + i, buf)));
+        double bytes = heapBytes() - before;
+
+        long long sum = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (auto &sl : v)
+            for (auto it = sl.begin(); it != sl.end(); ++it)
+                sum += it->second.len() + it->second.buf()[0];
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        assert(sum != 0);
+        printf("    %-22s %6.1f bytes/element  %5.2f ns/element\n", "SKIPLIST<long, SDS>", bytes / n, ns / n);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    printf("Encodings: "); {
+        ZIPLIST zl;
+        assert(zl.len() == 0 && zl.bytes() == ZIPLIST_HDR_SIZE + 1 && !zl.first() && !zl.last());
+        std::vector<std::string> model;
+        long long ints[] = {0, 127, 128, -1, -4096, 4095, 4096, -4097, 32767, -32768, 32768, 8388607,
+                            -8388608, 8388608, 2147483647LL, -2147483648LL, 2147483648LL, LLONG_MAX, LLONG_MIN};
+        for (long long v : ints)
+        {
+            zl.append(v);
+            model.push_back(std::to_string(v));
+        }
+        for (size_t len : {0, 1, 63, 64, 127, 128, 4095, 4096, 20000})
+        {
+            std::string s(len, 'a' + len % 26);
+            zl.append(s.data(), s.size());
+            model.push_back(s);
+        }
+        /* Not canonical integers stay strings */
+        for (const char *s : {"007", "-0", "+1", " 1", "9223372036854775808", "-9223372036854775809", "1e3"})
+        {
+            zl.append(s, strlen(s));
+            model.push_back(s);
+        }
+        check(zl, model);
+
+        /* In place integer encoding: 7 bit, 13 bit and 64 bit */
+        ZIPLIST ints2;
+        ints2.append("100", 3);
+        ints2.append("-100", 4);
+        ints2.append("-9223372036854775808", 20);
+        assert(ints2.bytes() == ZIPLIST_HDR_SIZE + 2 + 3 + 10 + 1);
+        assert(!ints2.get(ints2.first()).sval && ints2.get(ints2.last()).lval == LLONG_MIN);
+        ok();
+    }
+
+    printf("Insert, replace, remove, seek: "); {
+        ZIPLIST zl;
+        std::vector<std::string> model;
+        std::mt19937_64 gen(1);
+        for (int i = 0; i < 20000; ++i)
+        {
+            std::string s;
+            switch (gen() % 4)
+            {
+            case 0:
+                s = std::to_string((long long)gen() >> (gen() % 64));
+                break;
+            case 1:
+                s = std::to_string((long long)(gen() % 20000) - 10000);
+                break;
+            default:
+                s = std::string(gen() % 3 ? gen() % 70 : gen() % 300, 'a' + gen() % 26);
+            }
+
+            long idx = model.empty() ? 0 : gen() % model.size();
+            switch (model.empty() ? 0 : gen() % 6)
+            {
+            case 0:
+            {
+                size_t p = model.empty() ? 0 : zl.seek(idx);
+                bool after = !model.empty() && gen() % 2;
+                size_t q = zl.insert(p, s.data(), s.size(), after);
+                long at = model.empty() ? 0 : idx + after;
+                model.insert(model.begin() + at, s);
+                assert(entryString(zl.get(q)) == s && zl.seek(at) == q);
+                break;
+            }
+            case 1:
+                zl.append(s.data(), s.size());
+                model.push_back(s);
+                break;
+            case 2:
+                zl.prepend(s.data(), s.size());
+                model.insert(model.begin(), s);
+                break;
+            case 3:
+            {
+                size_t q = zl.replace(zl.seek(idx - (long)model.size()), s.data(), s.size());
+                model[idx] = s;
+                assert(entryString(zl.get(q)) == s);
+                break;
+            }
+            case 4:
+            {
+                size_t q = zl.remove(zl.seek(idx));
+                model.erase(model.begin() + idx);
+                assert(q == zl.seek(idx));
+                break;
+            }
+            case 5:
+            {
+                size_t count = gen() % 4;
+                assert(zl.removeRange(idx, count) == std::min(count, model.size() - idx));
+                model.erase(model.begin() + idx, model.begin() + std::min(idx + count, model.size()));
+                break;
+            }
+            }
+            if (i % 1000 == 0)
+                check(zl, model);
+            assert(zl.seek(-1) == zl.last() && zl.seek(model.size()) == 0 && zl.seek(-(long)model.size() - 1) == 0);
+        }
+        check(zl, model);
+
+        ZIPLIST copy(zl), moved(std::move(copy));
+        check(moved, model);
+        copy = moved;
+        check(copy, model);
+        ZIPLIST raw(zl.data(), zl.bytes());
+        check(raw, model);
+        ok();
+    }
+
+    printf("Find, count past 65535: "); {
+        ZIPLIST zl;
+        for (int i = 0; i < 100; ++i)
+        {
+            std::string f = "field" + std::to_string(i), v = std::to_string(i * 1000);
+            zl.append(f.data(), f.size());
+            zl.append(v.data(), v.size());
+        }
+        /* Fields only: one entry in two */
+        size_t p = zl.find("field42", 7, zl.first(), 1);
+        assert(p && zl.get(zl.next(p)).lval == 42000);
+        assert(zl.find("42000", 5, zl.first(), 1) == 0);
+        assert(zl.find("42000", 5, zl.next(zl.first()), 1) == zl.next(p));
+        assert(zl.compare(p, "field42", 7) && zl.compare(zl.next(p), "42000", 5) && !zl.compare(p, "field4", 6));
+
+        ZIPLIST big;
+        for (long i = 0; i < 70000; ++i)
+            big.append(i);
+        assert(big.data()[4] == 0xFF && big.data()[5] == 0xFF);
+        assert(big.len() == 70000 && big.get(big.seek(69999)).lval == 69999 && big.get(big.seek(-1)).lval == 69999);
+        assert(big.removeRange(0, 10000) == 10000 && big.len() == 60000);
+        assert(big.data()[4] == (60000 & 0xff) && big.get(big.first()).lval == 10000);
+        ok();
+    }
+
+    printf("Find with and without the index: "); {
+        std::mt19937_64 gen(7);
+        for (int round = 0; round < 40; ++round)
+        {
+            ZIPLIST zl;
+            std::vector<std::string> model;
+            size_t n = gen() % 300;
+            for (size_t i = 0; i < n; ++i)
+            {
+                /* Strings sharing long prefixes, long strings and integers */
+                std::string s = gen() % 3 == 0   ? std::to_string((long long)(gen() % 5000) - 2500)
+                                : gen() % 4 == 0 ? std::string(10 + gen() % 5000, 'p') + std::to_string(gen() % 30)
+                                                 : "user:profile:field:" + std::to_string(gen() % 200);
+                zl.append(s.data(), s.size());
+                model.push_back(s);
+            }
+            for (int t = 0; t < 200; ++t)
+            {
+                std::string s = t % 5 == 0 ? "absent" : model.empty() ? "x" : model[gen() % model.size()];
+                unsigned skip = gen() % 3;
+                size_t p = model.empty() ? 0 : zl.seek(gen() % model.size());
+                size_t expected = findDecoded(zl, s, p, skip);
+                ZIPLIST::disableIndex();
+                assert(zl.find(s.data(), s.size(), p, skip) == expected);
+                ZIPLIST::enableIndex();
+                assert(zl.find(s.data(), s.size(), p, skip) == expected);
+                assert(zl.indexBytes() > 0 || model.size() < ZIPLIST_INDEX_MIN_ENTRIES);
+                /* Modifications keep the index up to date */
+                size_t indexed = zl.indexBytes();
+                long idx = model.empty() ? 0 : gen() % model.size();
+                s = gen() % 2 ? std::to_string((long long)(gen() % 100000) - 50000)
+                              : std::string(gen() % 3 ? gen() % 40 : gen() % 400, 'a' + gen() % 3);
+                switch (model.empty() ? gen() % 2 : gen() % 6)
+                {
+                case 0:
+                    zl.append(s.data(), s.size());
+                    model.push_back(s);
+                    break;
+                case 1:
+                    zl.prepend(s.data(), s.size());
+                    model.insert(model.begin(), s);
+                    break;
+                case 2:
+                    zl.insert(zl.seek(idx), s.data(), s.size(), false);
+                    model.insert(model.begin() + idx, s);
+                    break;
+                case 3:
+                    zl.replace(zl.seek(idx), s.data(), s.size());
+                    model[idx] = s;
+                    break;
+                case 4:
+                    zl.remove(zl.seek(idx));
+                    model.erase(model.begin() + idx);
+                    break;
+                case 5:
+                {
+                    size_t count = gen() % 20;
+                    zl.removeRange(idx, count);
+                    model.erase(model.begin() + idx, model.begin() + std::min(idx + count, model.size()));
+                    break;
+                }
+                }
+                assert(indexed == 0 || zl.indexBytes() > 0);
+            }
+            check(zl, model);
+        }
+        ok();
+    }
+
+    long n = (argc > 1) ? atol(argv[1]) : 1000000;
+
+    printf("HGET on %ld hashes of 50 to 100 fields:\n", n / 100);
+    {
+        static const char *words[] = {"name", "email", "created", "login", "country", "city", "plan", "visits",
+                                      "score", "referrer", "lang", "tz", "status", "age", "followers"};
+        long lists = n / 100;
+        std::vector<ZIPLIST> hashes(lists);
+        std::vector<std::vector<std::string>> fields(lists);
+        std::mt19937_64 gen(1);
+        char buf[64];
+        for (long i = 0; i < lists; ++i)
+        {
+            size_t nf = 50 + gen() % 51;
+            for (size_t j = 0; j < nf; ++j)
+            {
+                size_t flen = snprintf(buf, sizeof(buf), "%s_%zu", words[j % 15], j / 15);
+                fields[i].emplace_back(buf, flen);
+                hashes[i].append(buf, flen);
+                size_t vlen = j % 3 ? snprintf(buf, sizeof(buf), "value-%llu", (unsigned long long)gen() % 100000000)
+                                    : snprintf(buf, sizeof(buf), "%llu", (unsigned long long)gen() % 1000000);
+                hashes[i].append(buf, vlen);
+            }
+        }
+
+        long lookups = 4000000;
+        std::vector<std::pair<long, const std::string *>> queries(lookups);
+        for (auto &q : queries)
+        {
+            q.first = gen() % lists;
+            q.second = &fields[q.first][gen() % fields[q.first].size()];
+        }
+
+        auto run = [&](const char *name, int mode) {
+            size_t sum = 0;
+            auto t0 = std::chrono::steady_clock::now();
+            for (auto &q : queries)
+            {
+                const ZIPLIST &zl = hashes[q.first];
+                sum += mode ? zl.find(q.second->data(), q.second->size(), zl.first(), 1)
+                            : findDecoded(zl, *q.second, zl.first(), 1);
+            }
+            auto t1 = std::chrono::steady_clock::now();
+            assert(sum > 0);
+            double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+            size_t index = 0, bytes = 0;
+            for (auto &zl : hashes)
+                index += zl.indexBytes(), bytes += zl.bytes();
+            printf("    %-26s %6.1f ns/lookup  index %4.1f%% of the list bytes\n", name, ns / lookups,
+                   100.0 * index / bytes);
+        };
+        ZIPLIST::disableIndex();
+        run("decoding every entry", 0);
+        run("find(), no index", 1);
+        ZIPLIST::enableIndex();
+        run("find(), sidecar index", 1);
+
+        /* One HSET of an existing field, which replaces its value, after
+         * every two HGET */
+        auto mixed = [&](const char *name) {
+            size_t sum = 0;
+            long i = 0;
+            auto t0 = std::chrono::steady_clock::now();
+            for (auto &q : queries)
+            {
+                ZIPLIST &zl = hashes[q.first];
+                size_t p = zl.find(q.second->data(), q.second->size(), zl.first(), 1);
+                sum += p;
+                if (++i % 3 == 0)
+                {
+                    size_t vlen = i % 2 ? snprintf(buf, sizeof(buf), "value-%ld", i % 100000000)
+                                        : snprintf(buf, sizeof(buf), "%ld", i % 1000000);
+                    zl.replace(zl.next(p), buf, vlen);
+                }
+            }
+            auto t1 = std::chrono::steady_clock::now();
+            assert(sum > 0);
+            double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+            printf("    %-26s %6.1f ns/operation\n", name, ns / lookups);
+        };
+        printf("  1 HSET per 2 HGET:\n");
+        ZIPLIST::disableIndex();
+        mixed("find(), no index");
+        ZIPLIST::enableIndex();
+        mixed("find(), sidecar index");
+    }
+
+    printf("%ld elements:\n", n);
+    bench("integers 0-9999", n, 128, [](long i, char *buf) {
+        return (size_t)snprintf(buf, 256, "%ld", i * 7919 % 10000);
+    });
+    for (size_t len : {8, 32})
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%zu byte strings", len);
+        bench(name, n, 128, [len](long i, char *buf) {
+            for (size_t j = 0; j < len; ++j)
+                buf[j] = 'a' + (i + j) % 26;
+            return len;
+        });
+    }
+
+    return 0;
+}
+#endif
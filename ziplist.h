@@ -0,0 +1,158 @@
+#ifndef BOMENG_REDIS_ZIPLIST_H
+#define BOMENG_REDIS_ZIPLIST_H
+
+#include <stdint.h>
+#include <tuple>
+#include <cstddef>
+
+/* Bytes of the header: total bytes (32 bits) and number of entries (16
+ * bits) */
+#define ZIPLIST_HDR_SIZE 6
+/* Number of entries past which the header stops counting them */
+#define ZIPLIST_NUMELE_UNKNOWN UINT16_MAX
+#define ZIPLIST_EOF 0xFF
+/* Longest string whose integer value is looked for */
+#define ZIPLIST_INTBUF_SIZE 21
+/* Lists of that many entries get a sidecar index on their first find() */
+#define ZIPLIST_INDEX_MIN_ENTRIES 64
+/* The index keeps the offset of one entry in ZIPLIST_INDEX_STRIDE */
+#define ZIPLIST_INDEX_STRIDE 8
+
+namespace bRedis
+{
+
+    /* A list of strings and integers packed in one allocation, in the
+     * listpack format of Redis 7:
+     *
+     * <total bytes> <num entries> <entry> ... <entry> <EOF>
+     *
+     * where every entry is
+     *
+     * <encoding+data> <backlen>
+     *
+     * Integers take 1 to 9 bytes: 7 bit unsigned in the encoding byte
+     * itself, then 13, 16, 24, 32 and 64 bit signed. Strings that hold an
+     * integer printed canonically are stored as that integer. Other strings
+     * have a 1, 2 or 5 byte length header. backlen is the size of
+     * <encoding+data>, written from right to left on 1 to 5 bytes, 7 bits
+     * per byte, so that the list can be walked backwards from any entry.
+     *
+     * Unlike the older ziplist format, an entry does not store the size of
+     * its predecessor, so growing an entry never cascades into updating the
+     * following ones: an insertion or deletion moves the tail once.
+     *
+     * Entries are designated by their byte offset in the list, which stays
+     * valid until the list is modified before it. Offset 0 (the header) is
+     * never an entry, and is returned when there is no entry. Strings given
+     * to the list must not point inside it: it may be reallocated.
+     *
+     * find() does not decode entries. It encodes the string it looks for
+     * once, as an entry, and compares the first 16 bytes of that entry
+     * with each candidate in one SSE2 comparison, which checks the length
+     * and the first bytes at once. It skips the other entries by their
+     * encoded size. Lists of ZIPLIST_INDEX_MIN_ENTRIES entries or more
+     * also get a sidecar index on their first find(): a one byte hash of
+     * every entry and the offset of one entry in ZIPLIST_INDEX_STRIDE.
+     * find() then compares 16 hashes at a time and only walks to the
+     * entries whose hash matches. Modifications keep the index up to
+     * date: a replace() updates one hash and shifts the offsets after it,
+     * an insertion or removal also moves the hashes after it. */
+    class ZIPLIST
+    {
+    public:
+        /* An entry: a string if sval is set, an integer otherwise. sval
+         * points inside the list and is valid until it is modified. */
+        struct entry
+        {
+            const unsigned char *sval;
+            uint32_t slen;
+            long long lval;
+        };
+
+    private:
+        struct ziplistIndex;
+
+    private:
+        unsigned char *lp_;
+        /* Sidecar index, nullptr until find() builds it */
+        mutable ziplistIndex *index_;
+        static bool indexEnabled_;
+
+    private:
+        const ziplistIndex *buildIndex() const;
+        void dropIndex();
+        size_t indexEntry(size_t p) const;
+        void indexInserted(size_t p, size_t size);
+        void indexRemoved(size_t p, size_t count, size_t bytes);
+        void indexReplaced(size_t p, ptrdiff_t delta);
+        void resize(size_t bytes);
+        void setBytes(size_t bytes);
+        void setCount(uint32_t count);
+        size_t insertEncoded(size_t p, const unsigned char *enc, size_t enclen, const void *s, size_t slen,
+                             bool after);
+        size_t insertString(size_t p, const void *s, size_t len, bool after);
+        size_t insertInteger(size_t p, long long value, bool after);
+        size_t removeRaw(size_t p, size_t count, size_t bytes);
+        size_t replaceEncoded(size_t p, const unsigned char *enc, size_t enclen, const void *s, size_t slen);
+
+    public:
+        ZIPLIST();
+        /* Copy of the list serialized at data, as returned by data() */
+        ZIPLIST(const void *data, size_t bytes);
+
+        ZIPLIST(const ZIPLIST &zl);
+        ZIPLIST &operator=(const ZIPLIST &zl);
+        ZIPLIST(ZIPLIST &&zl);
+        ZIPLIST &operator=(ZIPLIST &&zl);
+
+        ~ZIPLIST();
+
+    public:
+        /* Walk the list: 0 when there is no such entry */
+        size_t first() const;
+        size_t last() const;
+        size_t next(size_t p) const;
+        size_t prev(size_t p) const;
+        /* Entry at index, negative from the tail, walking from the nearest
+         * end */
+        size_t seek(long index) const;
+        entry get(size_t p) const;
+
+    public:
+        void append(const void *s, size_t len);
+        void append(long long value);
+        void prepend(const void *s, size_t len);
+        void prepend(long long value);
+        /* Insert before p (after p if after is set, at the tail if p is 0)
+         * and return the offset of the new entry */
+        size_t insert(size_t p, const void *s, size_t len, bool after = false);
+        size_t insert(size_t p, long long value, bool after = false);
+        /* Replace the entry at p, return its offset */
+        size_t replace(size_t p, const void *s, size_t len);
+        size_t replace(size_t p, long long value);
+        /* Remove the entry at p, return the offset of the entry that
+         * followed it */
+        size_t remove(size_t p);
+        /* Remove count entries from index, return the number removed */
+        size_t removeRange(long index, size_t count);
+
+    public:
+        /* First entry equal to s from p on, comparing one entry in
+         * skip + 1. Integer entries are compared as integers. */
+        size_t find(const void *s, size_t len, size_t p, unsigned skip = 0) const;
+        bool compare(size_t p, const void *s, size_t len) const;
+
+    public:
+        size_t len() const;
+        size_t bytes() const;
+        const unsigned char *data() const;
+        /* Bytes of the sidecar index, 0 if there is none */
+        size_t indexBytes() const;
+
+        static void enableIndex() { indexEnabled_ = true; }
+        static void disableIndex() { indexEnabled_ = false; }
+    };
+
+} // namespace bRedis
+
+#endif
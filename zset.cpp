@@ -0,0 +1,720 @@
+#include "zset.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+using namespace bRedis;
+
+namespace
+{
+    /* Convert ZRANGE style indexes into a 1-based inclusive rank range.
+     * Return false if the range is empty. */
+    bool normalizeRange(long &start, long &stop, long llen)
+    {
+        if (start < 0)
+            start = llen + start;
+        if (stop < 0)
+            stop = llen + stop;
+        if (start < 0)
+            start = 0;
+
+        if (start > stop || start >= llen)
+            return false;
+        if (stop >= llen)
+            stop = llen - 1;
+
+        start += 1;
+        stop += 1;
+        return true;
+    }
+
+    SDS entryToSDS(const ZIPLIST::entry &e)
+    {
+        return e.sval ? SDS(e.sval, e.slen) : SDS(e.lval);
+    }
+
+    /* Compare a packed member with member, as SDS::cmp */
+    int entryCmp(const ZIPLIST::entry &e, const SDS &member)
+    {
+        char buf[ZIPLIST_INTBUF_SIZE];
+        const char *s = (const char *)e.sval;
+        size_t len = e.slen;
+        if (s == nullptr)
+        {
+            len = snprintf(buf, sizeof(buf), "%lld", e.lval);
+            s = buf;
+        }
+
+        size_t minlen = len < member.len() ? len : member.len();
+        int cmp = memcmp(s, member.buf(), minlen);
+        if (cmp == 0)
+            return len < member.len() ? -1 : len > member.len();
+        return cmp;
+    }
+
+    /* Print a score the way it is packed, as Redis d2string: integral
+     * scores as integers, which the ZIPLIST then stores as such, others
+     * with enough digits to read back the same double. -0 keeps its sign:
+     * as a string, since the integer would be 0. */
+    size_t scoreToString(char *buf, size_t size, double score)
+    {
+        if (score == 0 && std::signbit(score))
+            return snprintf(buf, size, "-0");
+        if (score == std::trunc(score) && std::fabs(score) < (double)(1LL << 53))
+            return snprintf(buf, size, "%lld", (long long)score);
+        return snprintf(buf, size, "%.17g", score);
+    }
+}
+
+void ZSET::convert()
+{
+    if (encoding_ == ZSET_ENCODING_SKIPLIST)
+        return;
+
+    std::unique_ptr<zset> zs(new zset);
+    zs->dict.expand(len());
+    for (size_t p = packed_.first(); p; p = packed_.next(packed_.next(p)))
+    {
+        zsetKey key(packedScore(packed_.next(p)), entryToSDS(packed_.get(p)));
+        auto it = zs->zsl.emplace(std::move(key), zsetNoValue()).first;
+        zs->dict.add(&it->first.second, it);
+    }
+
+    packed_ = ZIPLIST();
+    zs_ = std::move(zs);
+    encoding_ = ZSET_ENCODING_SKIPLIST;
+}
+
+/* Offset of the member, 0 if it is not present. Its score follows it. */
+size_t ZSET::packedFind(const SDS &member) const
+{
+    return packed_.find(member.buf(), member.len(), packed_.first(), 1);
+}
+
+/* Score at offset p */
+double ZSET::packedScore(size_t p) const
+{
+    ZIPLIST::entry e = packed_.get(p);
+    if (e.sval == nullptr)
+        return e.lval;
+
+    char buf[64];
+    size_t len = e.slen < sizeof(buf) - 1 ? e.slen : sizeof(buf) - 1;
+    memcpy(buf, e.sval, len);
+    buf[len] = '\0';
+    return strtod(buf, nullptr);
+}
+
+void ZSET::packedInsert(double score, const SDS &member)
+{
+    size_t p = packed_.first();
+    while (p)
+    {
+        size_t q = packed_.next(p);
+        double s = packedScore(q);
+        if (s > score || (s == score && entryCmp(packed_.get(p), member) > 0))
+            break;
+        p = packed_.next(q);
+    }
+
+    char buf[64];
+    size_t len = scoreToString(buf, sizeof(buf), score);
+    p = packed_.insert(p, member.buf(), member.len());
+    packed_.insert(p, buf, len, true);
+}
+
+/* Remove the member at offset p and its score */
+void ZSET::packedRemove(size_t p)
+{
+    packed_.remove(packed_.remove(p));
+}
+
+/* Add member or update its score, like ZADD (and ZINCRBY when incr is set).
+ * The resulting score is stored in *newscore. Return true if the member was
+ * added, false if it was already present. */
+bool ZSET::zsetAdd(double score, const SDS &member, bool incr, double *newscore)
+{
+    if (std::isnan(score))
+        throw std::runtime_error("score is not a number (NaN)");
+
+    if (encoding_ == ZSET_ENCODING_PACKED)
+    {
+        size_t p = packedFind(member);
+        if (p)
+        {
+            double curscore = packedScore(packed_.next(p));
+            if (incr)
+            {
+                score += curscore;
+                if (std::isnan(score))
+                    throw std::runtime_error("resulting score is not a number (NaN)");
+            }
+            if (newscore)
+                *newscore = score;
+
+            if (score != curscore)
+            {
+                packedRemove(p);
+                packedInsert(score, member);
+            }
+            return false;
+        }
+
+        if (newscore)
+            *newscore = score;
+        if (len() + 1 <= maxPackedEntries_ && member.len() <= maxPackedValue_)
+        {
+            packedInsert(score, member);
+            return true;
+        }
+        convert();
+    }
+
+    auto *found = zs_->dict.find(&member);
+    if (found)
+    {
+        zskiplist::iterator it = found->val;
+        double curscore = it->first.first;
+        if (incr)
+        {
+            score += curscore;
+            if (std::isnan(score))
+                throw std::runtime_error("resulting score is not a number (NaN)");
+        }
+        if (newscore)
+            *newscore = score;
+
+        if (score != curscore)
+        {
+            /* The node is reused when its position does not change, otherwise
+             * the entry has to point at the member of the new node. Same
+             * string, so the entry stays in its bucket. */
+            it = zs_->zsl.updateKey(it->first, zsetKey(score, member));
+            found->key = &it->first.second;
+            found->val = it;
+        }
+        return false;
+    }
+
+    if (newscore)
+        *newscore = score;
+    auto it = zs_->zsl.emplace(zsetKey(score, member), zsetNoValue()).first;
+    zs_->dict.add(&it->first.second, it);
+    return true;
+}
+
+/* 1-based rank of the first element with score >= min (> min if minex),
+ * len() + 1 if there is none. */
+size_t ZSET::firstRank(double min, bool minex) const
+{
+    size_t len = this->len();
+    if (minex && min == HUGE_VAL)
+        return len + 1;
+
+    if (encoding_ == ZSET_ENCODING_PACKED)
+    {
+        size_t rank = 1;
+        for (size_t p = packed_.first(); p; p = packed_.next(packed_.next(p)), ++rank)
+        {
+            double score = packedScore(packed_.next(p));
+            if (minex ? score > min : score >= min)
+                break;
+        }
+        return rank;
+    }
+
+    zsetKey key(minex ? std::nextafter(min, HUGE_VAL) : min, SDS());
+    auto it = zs_->zsl.lower_bound(key);
+    return it == zs_->zsl.end() ? len + 1 : zs_->zsl.rank(it->first);
+}
+
+/* 1-based rank of the last element with score <= max (< max if maxex),
+ * 0 if there is none. */
+size_t ZSET::lastRank(double max, bool maxex) const
+{
+    size_t len = this->len();
+    if (!maxex && max == HUGE_VAL)
+        return len;
+
+    if (encoding_ == ZSET_ENCODING_PACKED)
+    {
+        size_t rank = 0;
+        for (size_t p = packed_.first(); p; p = packed_.next(packed_.next(p)), ++rank)
+        {
+            double score = packedScore(packed_.next(p));
+            if (maxex ? score >= max : score > max)
+                break;
+        }
+        return rank;
+    }
+
+    zsetKey key(maxex ? max : std::nextafter(max, HUGE_VAL), SDS());
+    auto it = zs_->zsl.lower_bound(key);
+    return it == zs_->zsl.end() ? len : zs_->zsl.rank(it->first) - 1;
+}
+
+/* Return count elements starting at the 1-based rank, walking towards the
+ * head when reverse is set. */
+std::vector<std::pair<SDS, double>> ZSET::collect(size_t rank, size_t count, bool reverse) const
+{
+    std::vector<std::pair<SDS, double>> result;
+    result.reserve(count);
+
+    if (encoding_ == ZSET_ENCODING_PACKED)
+    {
+        size_t p = packed_.seek(2 * (rank - 1));
+        for (size_t i = 0; i < count; ++i)
+        {
+            size_t q = packed_.next(p);
+            result.emplace_back(entryToSDS(packed_.get(p)), packedScore(q));
+            if (i + 1 < count)
+                p = reverse ? packed_.prev(packed_.prev(p)) : packed_.next(q);
+        }
+        return result;
+    }
+
+    auto it = zs_->zsl.atRank(rank);
+    for (size_t i = 0; i < count; ++i)
+    {
+        result.emplace_back(it->first.second, it->first.first);
+        if (reverse)
+            --it;
+        else
+            ++it;
+    }
+    return result;
+}
+
+size_t ZSET::removeRanks(size_t first, size_t last)
+{
+    if (first > last)
+        return 0;
+
+    if (encoding_ == ZSET_ENCODING_PACKED)
+    {
+        packed_.removeRange(2 * (first - 1), 2 * (last - first + 1));
+        return last - first + 1;
+    }
+
+    auto it = zs_->zsl.atRank(first);
+    for (size_t i = first; i <= last; ++i, ++it)
+        zs_->dict.remove(&it->first.second);
+    return zs_->zsl.eraseRangeByRank(first - 1, last - 1);
+}
+
+ZSET::ZSET(size_t maxPackedEntries, size_t maxPackedValue)
+    : encoding_(ZSET_ENCODING_PACKED),
+      maxPackedEntries_(maxPackedEntries),
+      maxPackedValue_(maxPackedValue)
+{
+}
+
+ZSET::ZSET(const ZSET &zs)
+    : encoding_(zs.encoding_),
+      maxPackedEntries_(zs.maxPackedEntries_),
+      maxPackedValue_(zs.maxPackedValue_),
+      packed_(zs.packed_)
+{
+    if (zs.zs_)
+    {
+        zs_.reset(new zset);
+        zs_->zsl = zs.zs_->zsl;
+        zs_->dict.expand(zs_->zsl.size());
+        for (auto it = zs_->zsl.begin(); it != zs_->zsl.end(); ++it)
+            zs_->dict.add(&it->first.second, it);
+    }
+}
+
+ZSET &ZSET::operator=(const ZSET &zs)
+{
+    if (&zs == this)
+        return *this;
+
+    ZSET t(zs);
+    *this = std::move(t);
+    return *this;
+}
+
+ZSET::ZSET(ZSET &&zs)
+    : encoding_(zs.encoding_),
+      maxPackedEntries_(zs.maxPackedEntries_),
+      maxPackedValue_(zs.maxPackedValue_),
+      packed_(std::move(zs.packed_)),
+      zs_(std::move(zs.zs_))
+{
+    zs.encoding_ = ZSET_ENCODING_PACKED;
+    zs.packed_ = ZIPLIST();
+}
+
+ZSET &ZSET::operator=(ZSET &&zs)
+{
+    if (&zs == this)
+        return *this;
+
+    encoding_ = zs.encoding_;
+    maxPackedEntries_ = zs.maxPackedEntries_;
+    maxPackedValue_ = zs.maxPackedValue_;
+    packed_ = std::move(zs.packed_);
+    zs_ = std::move(zs.zs_);
+
+    zs.encoding_ = ZSET_ENCODING_PACKED;
+    zs.packed_ = ZIPLIST();
+
+    return *this;
+}
+
+ZSET::~ZSET()
+{
+}
+
+bool ZSET::add(double score, const SDS &member)
+{
+    return zsetAdd(score, member, false, nullptr);
+}
+
+double ZSET::incrby(double incr, const SDS &member)
+{
+    double newscore;
+    zsetAdd(incr, member, true, &newscore);
+    return newscore;
+}
+
+bool ZSET::remove(const SDS &member)
+{
+    if (encoding_ == ZSET_ENCODING_PACKED)
+    {
+        size_t p = packedFind(member);
+        if (p == 0)
+            return false;
+        packedRemove(p);
+        return true;
+    }
+
+    auto *found = zs_->dict.find(&member);
+    if (found == nullptr)
+        return false;
+
+    /* The key points into the node: unindex it before freeing the node */
+    zskiplist::iterator it = found->val;
+    zs_->dict.remove(&member);
+    zs_->zsl.erase(it);
+    return true;
+}
+
+std::tuple<bool, double> ZSET::score(const SDS &member) const
+{
+    if (encoding_ == ZSET_ENCODING_PACKED)
+    {
+        size_t p = packedFind(member);
+        if (p == 0)
+            return {false, 0};
+        return {true, packedScore(packed_.next(p))};
+    }
+
+    const zsetDict &dict = zs_->dict;
+    auto *found = dict.find(&member);
+    if (found == nullptr)
+        return {false, 0};
+    return {true, found->val->first.first};
+}
+
+/* 0-based rank of member, counted from the highest score if reverse. */
+std::tuple<bool, size_t> ZSET::rank(const SDS &member, bool reverse) const
+{
+    size_t r;
+    if (encoding_ == ZSET_ENCODING_PACKED)
+    {
+        size_t p = packedFind(member);
+        if (p == 0)
+            return {false, 0};
+        r = 1;
+        for (size_t q = packed_.first(); q != p; q = packed_.next(packed_.next(q)))
+            r++;
+    }
+    else
+    {
+        const zsetDict &dict = zs_->dict;
+        auto *found = dict.find(&member);
+        if (found == nullptr)
+            return {false, 0};
+        r = zs_->zsl.rank(found->val->first);
+    }
+
+    return {true, reverse ? len() - r : r - 1};
+}
+
+/* ZRANGE / ZREVRANGE */
+std::vector<std::pair<SDS, double>> ZSET::range(long start, long stop, bool reverse) const
+{
+    size_t len = this->len();
+    if (!normalizeRange(start, stop, len))
+        return {};
+
+    return collect(reverse ? len + 1 - start : start, stop - start + 1, reverse);
+}
+
+/* ZRANGEBYSCORE / ZREVRANGEBYSCORE */
+std::vector<std::pair<SDS, double>> ZSET::rangeByScore(double min, double max, bool minex, bool maxex,
+                                                       size_t offset, long limit, bool reverse) const
+{
+    size_t first = firstRank(min, minex);
+    size_t last = lastRank(max, maxex);
+    if (first > last || offset > last - first)
+        return {};
+
+    size_t count = last - first + 1 - offset;
+    if (limit >= 0 && (size_t)limit < count)
+        count = limit;
+
+    return collect(reverse ? last - offset : first + offset, count, reverse);
+}
+
+/* ZREMRANGEBYRANK */
+size_t ZSET::removeRangeByRank(long start, long stop)
+{
+    if (!normalizeRange(start, stop, len()))
+        return 0;
+    return removeRanks(start, stop);
+}
+
+/* ZREMRANGEBYSCORE */
+size_t ZSET::removeRangeByScore(double min, double max, bool minex, bool maxex)
+{
+    return removeRanks(firstRank(min, minex), lastRank(max, maxex));
+}
+
+size_t ZSET::len() const
+{
+    return encoding_ == ZSET_ENCODING_PACKED ? packed_.len() / 2 : zs_->zsl.size();
+}
+
+uint32_t ZSET::encoding() const
+{
+    return encoding_;
+}
+
+#ifdef ZSET_TEST_MAIN
+#include <cassert>
+#include <cstdio>
+#include <malloc.h>
+#include <sys/time.h>
+
+long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+void ok(void) {
+    printf("OK\n");
+}
+
+void checkRanks(const ZSET &zs) {
+    auto all = zs.range(0, -1);
+    assert(all.size() == zs.len());
+    for (size_t i = 0; i < all.size(); ++i) {
+        auto [found, r] = zs.rank(all[i].first);
+        assert(found && r == i);
+        auto [found2, score] = zs.score(all[i].first);
+        assert(found2 && score == all[i].second);
+        if (i > 0)
+            assert(all[i-1].second < all[i].second ||
+                   (all[i-1].second == all[i].second && all[i-1].first.cmp(all[i].first) < 0));
+    }
+}
+
+void basicTests(size_t maxPackedEntries) {
+    printf("Add and update (max packed entries %zu): ", maxPackedEntries); {
+        ZSET zs(maxPackedEntries);
+        assert(zs.add(1, "a"));
+        assert(zs.add(1, "c"));
+        assert(zs.add(1, "b"));
+        assert(zs.add(0, "z"));
+        assert(!zs.add(2, "z"));
+        assert(zs.len() == 4);
+
+        auto r = zs.range(0, -1);
+        assert(r[0].first.cmp("a") == 0 && r[1].first.cmp("b") == 0);
+        assert(r[2].first.cmp("c") == 0 && r[3].first.cmp("z") == 0);
+        assert(std::get<1>(zs.rank("z")) == 3);
+        assert(std::get<1>(zs.rank("z", true)) == 0);
+        assert(!std::get<0>(zs.rank("x")));
+        checkRanks(zs);
+        ok();
+    }
+
+    printf("Incrby (max packed entries %zu): ", maxPackedEntries); {
+        ZSET zs(maxPackedEntries);
+        for (int i = 0; i < 10; ++i)
+            zs.add(i * 10, SDS((long long)i));
+        assert(zs.incrby(1, "3") == 31);
+        assert(std::get<1>(zs.rank("3")) == 3);
+        assert(zs.incrby(100, "3") == 131);
+        assert(std::get<1>(zs.rank("3")) == 9);
+        assert(zs.incrby(5, "new") == 5);
+        assert(std::get<1>(zs.rank("new")) == 1);
+        checkRanks(zs);
+        ok();
+    }
+
+    printf("Range by score (max packed entries %zu): ", maxPackedEntries); {
+        ZSET zs(maxPackedEntries);
+        for (int i = 0; i < 20; ++i)
+            zs.add(i / 2, SDS((long long)i));
+
+        auto r = zs.rangeByScore(2, 4);
+        assert(r.size() == 6 && r.front().second == 2 && r.back().second == 4);
+        r = zs.rangeByScore(2, 4, true, true);
+        assert(r.size() == 2 && r.front().second == 3);
+        r = zs.rangeByScore(2, 4, false, false, 1, 2);
+        assert(r.size() == 2 && r.front().first.cmp("5") == 0);
+        r = zs.rangeByScore(2, 4, false, false, 0, -1, true);
+        assert(r.size() == 6 && r.front().first.cmp("9") == 0 && r.back().first.cmp("4") == 0);
+        r = zs.rangeByScore(-HUGE_VAL, HUGE_VAL);
+        assert(r.size() == 20);
+        r = zs.rangeByScore(100, 200);
+        assert(r.empty());
+
+        assert(zs.removeRangeByScore(2, 4, true, false) == 4);
+        assert(zs.len() == 16);
+        assert(zs.removeRangeByRank(0, 1) == 2);
+        assert(!std::get<0>(zs.score("0")));
+        checkRanks(zs);
+        assert(zs.remove("19"));
+        assert(!zs.remove("19"));
+        assert(zs.len() == 13);
+        checkRanks(zs);
+        ok();
+    }
+}
+
+int main(int argc, char **argv) {
+    basicTests(ZSET_MAX_PACKED_ENTRIES);
+    basicTests(0);
+
+    printf("Convert on growth: "); {
+        ZSET zs(16, 8);
+        for (int i = 0; i < 16; ++i)
+            zs.add(i, SDS((long long)i));
+        assert(zs.encoding() == ZSET_ENCODING_PACKED);
+        zs.add(16, "16");
+        assert(zs.encoding() == ZSET_ENCODING_SKIPLIST);
+        checkRanks(zs);
+
+        ZSET zs2(16, 8);
+        zs2.add(1, "a");
+        zs2.add(2, "a long member");
+        assert(zs2.encoding() == ZSET_ENCODING_SKIPLIST);
+        checkRanks(zs2);
+
+        ZSET zs3(zs);
+        zs.remove("3");
+        assert(zs3.len() == 17 && zs.len() == 16);
+        checkRanks(zs3);
+        ok();
+    }
+
+    printf("Packed scores and members: "); {
+        ZSET zs;
+        zs.add(0.1, "a");
+        zs.add(-HUGE_VAL, "b");
+        zs.add(HUGE_VAL, "c");
+        zs.add(1e300, "d");
+        zs.add(-2.5, "e");
+        zs.add(4, "10");
+        zs.add(4, "9");
+        zs.add(4, "x");
+        assert(zs.encoding() == ZSET_ENCODING_PACKED);
+        assert(std::get<1>(zs.score("a")) == 0.1 && std::get<1>(zs.score("d")) == 1e300);
+        assert(std::get<1>(zs.score("b")) == -HUGE_VAL && std::get<1>(zs.score("c")) == HUGE_VAL);
+        /* Members that look like integers still sort as strings */
+        auto r = zs.range(0, -1);
+        const char *order[] = {"b", "e", "a", "10", "9", "x", "d", "c"};
+        for (int i = 0; i < 8; ++i)
+            assert(r[i].first.cmp(order[i]) == 0);
+        assert(zs.rangeByScore(4, 4).size() == 3 && zs.rangeByScore(4, 4, false, false, 0, -1, true)[0].first.cmp("x") == 0);
+        assert(zs.incrby(0.2, "a") == 0.1 + 0.2);
+        checkRanks(zs);
+        zs.add(-0.0, "z");
+        assert(std::signbit(std::get<1>(zs.score("z"))) && std::signbit(zs.rangeByScore(0, 0)[0].second));
+
+        ZSET big(1000);
+        std::vector<double> scores;
+        for (int i = 0; i < 1000; ++i) {
+            double score = (rand() - RAND_MAX / 2) / 7.0;
+            big.add(score, SDS((long long)i));
+            scores.push_back(score);
+        }
+        assert(big.encoding() == ZSET_ENCODING_PACKED);
+        checkRanks(big);
+        for (int i = 0; i < 1000; ++i)
+            assert(std::get<1>(big.score(SDS((long long)i))) == scores[i]);
+        big.add(0, "convert");
+        assert(big.encoding() == ZSET_ENCODING_SKIPLIST);
+        for (int i = 0; i < 1000; ++i)
+            assert(std::get<1>(big.score(SDS((long long)i))) == scores[i]);
+        checkRanks(big);
+        ok();
+    }
+
+    printf("Stress add+incrby: "); {
+        ZSET zs;
+        long long start = usec();
+        for (int i = 0; i < 100000; ++i) {
+            SDS member((long long)(rand() % 10000));
+            if (rand() % 2)
+                zs.add(rand() % 1000, member);
+            else
+                zs.incrby(rand() % 10 - 5, member);
+        }
+        checkRanks(zs);
+        printf("%lldusec ", usec() - start);
+        ok();
+    }
+
+    /* n leaderboards of 5 to 20 players: bytes per set, then the time of
+     * a ZADD, a ZSCORE and a ZRANGE of the top 3 */
+    long n = (argc > 1) ? atol(argv[1]) : 1000000;
+    printf("%ld sorted sets of 5 to 20 members:\n", n);
+    for (size_t max : {(size_t)ZSET_MAX_PACKED_ENTRIES, (size_t)0}) {
+        std::vector<ZSET> sets;
+        sets.reserve(n);
+        char buf[32];
+        size_t members = 0, before = mallinfo2().uordblks;
+        long long start = usec();
+        for (long i = 0; i < n; ++i) {
+            sets.emplace_back(max);
+            size_t nm = 5 + i % 16;
+            for (size_t j = 0; j < nm; ++j) {
+                size_t len = snprintf(buf, sizeof(buf), "player:%zu", j * 7919 % 1000);
+                sets.back().add(rand() % 100000, SDS(buf, len));
+            }
+            members += nm;
+        }
+        long long added = usec() - start;
+        double bytes = mallinfo2().uordblks - before;
+
+        long lookups = 2000000;
+        size_t found = 0;
+        start = usec();
+        for (long i = 0; i < lookups; ++i) {
+            size_t len = snprintf(buf, sizeof(buf), "player:%d", rand() % 20 * 7919 % 1000);
+            found += std::get<0>(sets[rand() % n].score(SDS(buf, len)));
+        }
+        long long scored = usec() - start;
+        start = usec();
+        for (long i = 0; i < lookups; ++i)
+            found += sets[rand() % n].range(0, 2, true).size();
+        long long ranged = usec() - start;
+        assert(found > 0);
+
+        printf("    %-26s %7.1f bytes/set  ZADD %6.1f ns  ZSCORE %6.1f ns  ZREVRANGE 0 2 %6.1f ns\n",
+               max ? "packed up to 128 entries" : "always SKIPLIST", bytes / n, added * 1e3 / members,
+               scored * 1e3 / lookups, ranged * 1e3 / lookups);
+    }
+
+    return 0;
+}
+#endif
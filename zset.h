@@ -0,0 +1,117 @@
+#ifndef BOMENG_REDIS_ZSET_H
+#define BOMENG_REDIS_ZSET_H
+
+#include "sds.h"
+#include "skiplist.h"
+#include "dict.h"
+#include "ziplist.h"
+#include <stdint.h>
+#include <tuple>
+#include <vector>
+#include <memory>
+
+/* Encodings of a sorted set. Small sets are kept as a ZIPLIST of
+ * alternating members and scores, sorted by score, and converted to a
+ * skiplist plus a member index once they grow past the configured limits,
+ * as Redis zset-max-listpack-entries and zset-max-listpack-value. */
+#define ZSET_ENCODING_PACKED 0
+#define ZSET_ENCODING_SKIPLIST 1
+
+#define ZSET_MAX_PACKED_ENTRIES 128
+#define ZSET_MAX_PACKED_VALUE 64
+
+namespace bRedis
+{
+
+    class ZSET
+    {
+    public:
+        typedef std::pair<double, SDS> zsetKey;
+
+    private:
+        /* Order by score, ties ordered by member */
+        struct zsetKeyLess
+        {
+            bool operator()(const zsetKey &a, const zsetKey &b) const
+            {
+                return a.first < b.first || (a.first == b.first && a.second.cmp(b.second) < 0);
+            }
+        };
+
+        struct zsetNoValue
+        {
+        };
+
+        typedef SKIPLIST<zsetKey, zsetNoValue, zsetKeyLess> zskiplist;
+
+        struct sdsPtrHash
+        {
+            unsigned int operator()(const SDS *s) const { return dictGenHashFunction(s->buf(), s->len()); }
+        };
+
+        struct sdsPtrEqual
+        {
+            bool operator()(const SDS *a, const SDS *b) const { return a->len() == b->len() && a->cmp(*b) == 0; }
+        };
+
+        /* The index is keyed by the member stored inside the skiplist node,
+         * so each member is only stored once, as Redis zset->dict. */
+        typedef DICT<const SDS *, zskiplist::iterator, sdsPtrHash, sdsPtrEqual> zsetDict;
+
+        struct zset
+        {
+            zskiplist zsl;
+            zsetDict dict;
+        };
+
+    private:
+        uint32_t encoding_;
+        size_t maxPackedEntries_;
+        size_t maxPackedValue_;
+        ZIPLIST packed_;
+        std::unique_ptr<zset> zs_;
+
+    private:
+        void convert();
+        size_t packedFind(const SDS &member) const;
+        double packedScore(size_t p) const;
+        void packedInsert(double score, const SDS &member);
+        void packedRemove(size_t p);
+        bool zsetAdd(double score, const SDS &member, bool incr, double *newscore);
+        size_t firstRank(double min, bool minex) const;
+        size_t lastRank(double max, bool maxex) const;
+        std::vector<std::pair<SDS, double>> collect(size_t rank, size_t count, bool reverse) const;
+        size_t removeRanks(size_t first, size_t last);
+
+    public:
+        ZSET(size_t maxPackedEntries = ZSET_MAX_PACKED_ENTRIES, size_t maxPackedValue = ZSET_MAX_PACKED_VALUE);
+
+        ZSET(const ZSET &zs);
+        ZSET &operator=(const ZSET &zs);
+        ZSET(ZSET &&zs);
+        ZSET &operator=(ZSET &&zs);
+
+        ~ZSET();
+
+    public:
+        bool add(double score, const SDS &member);
+        double incrby(double incr, const SDS &member);
+        bool remove(const SDS &member);
+        std::tuple<bool, double> score(const SDS &member) const;
+        std::tuple<bool, size_t> rank(const SDS &member, bool reverse = false) const;
+
+    public:
+        std::vector<std::pair<SDS, double>> range(long start, long stop, bool reverse = false) const;
+        std::vector<std::pair<SDS, double>> rangeByScore(double min, double max, bool minex = false, bool maxex = false,
+                                                         size_t offset = 0, long limit = -1, bool reverse = false) const;
+        size_t removeRangeByRank(long start, long stop);
+        size_t removeRangeByScore(double min, double max, bool minex = false, bool maxex = false);
+
+    public:
+        size_t len() const;
+        uint32_t encoding() const;
+    };
+
+} // namespace bRedis
+
+#endif